@@ -1,1233 +1,8013 @@
 #define GLFW_INCLUDE_VULKAN
 
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 #include <vulkan/vulkan.h>
 #include <GLFW/glfw3.h>
 
-int main() {
+// GPU memory is allocated in large blocks per memory type, which are divided with a buddy
+// allocator. Every node of a block is either free, allocated or split into two halves of half the
+// size. Nodes are aligned to their size, so a node that is large enough also satisfies the
+// alignment. Resources that do not fit into a block get a dedicated allocation.
+
+#define MEMORY_BLOCK_SIZE ((VkDeviceSize)64 << 20)
+#define MEMORY_MIN_NODE_SIZE ((VkDeviceSize)256)
+
+// Nodes are numbered like a binary heap: the root (the whole block) is 1 and the children of node
+// `i` are `2i` and `2i + 1`. The nodes on level `l` are `size >> l` bytes large. The order of a
+// node is its size in powers of two above the minimum node size.
+//
+// Every node stores the order of the largest free node in its subtree plus one (zero if there is
+// none), so an allocation finds a free node by walking down from the root and a free merges
+// buddies by walking back up, both in O(levels).
+
+typedef struct MemoryBlock {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint32_t memory_type_index;
+    uint8_t *mapped_data;
+    uint32_t level_count;
+    uint8_t *free_orders;
+    VkDeviceSize used_size;
+    VkDeviceSize requested_size;
+    uint32_t allocation_count;
+} MemoryBlock;
+
+// A range of device memory handed out by the allocator. `mapped_data` points to the range if the
+// memory is host visible (blocks are mapped persistently).
+
+typedef struct MemoryAllocation {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    void *mapped_data;
+    uint32_t block_index;
+    uint32_t node_index;
+} MemoryAllocation;
+
+typedef struct MemoryAllocator {
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    VkDeviceSize min_node_size;
+    MemoryBlock *blocks;
+    uint32_t block_count;
+} MemoryAllocator;
+
+// Used is the size of the allocated nodes, requested the size the resources asked for. The
+// difference is lost to rounding up to node sizes (internal fragmentation). The free memory that
+// is not part of the largest free node can only be used by smaller allocations (external
+// fragmentation).
+
+typedef struct MemoryStats {
+    uint32_t block_count;
+    uint32_t dedicated_block_count;
+    uint32_t allocation_count;
+    VkDeviceSize reserved_size;
+    VkDeviceSize used_size;
+    VkDeviceSize requested_size;
+    VkDeviceSize largest_free_size;
+} MemoryStats;
+
+// Returns the index of a memory type allowed by `memory_type_bits`, preferring one with all of the
+// `preferred_flags`, or UINT32_MAX if no memory type is allowed.
+
+static uint32_t find_memory_type(const VkPhysicalDeviceMemoryProperties *memory_properties, uint32_t memory_type_bits, VkMemoryPropertyFlags preferred_flags) {
+    uint32_t memory_type_index = UINT32_MAX;
+
+    for (uint32_t i = 0; i < memory_properties->memoryTypeCount; i++) {
+        if (memory_type_bits & (1u << i)) {
+            if ((memory_properties->memoryTypes[i].propertyFlags & preferred_flags) == preferred_flags) {
+                return i;
+            }
+
+            if (memory_type_index == UINT32_MAX) {
+                memory_type_index = i;
+            }
+        }
+    }
+
+    return memory_type_index;
+}
+
+static uint32_t memory_node_level(uint32_t node_index) {
+    uint32_t level = 0;
+
+    while (node_index >>= 1) {
+        level++;
+    }
+
+    return level;
+}
+
+// The value a node stores when its whole subtree is free.
+
+static uint8_t memory_node_full_order(const MemoryBlock *block, uint32_t node_index) {
+    return (uint8_t)(block->level_count - memory_node_level(node_index));
+}
+
+static void memory_allocator_init(MemoryAllocator *allocator, VkDevice device, VkPhysicalDevice physical_device) {
+    *allocator = (MemoryAllocator) { 0 };
+    allocator->device = device;
+
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &allocator->memory_properties);
+
+    // Linear and optimal resources must not share a page of bufferImageGranularity bytes. Nodes
+    // at least that large never do, since they are aligned to their size.
+
+    VkPhysicalDeviceProperties physical_device_properties;
+    vkGetPhysicalDeviceProperties(physical_device, &physical_device_properties);
+
+    allocator->min_node_size = MEMORY_MIN_NODE_SIZE;
+
+    while (allocator->min_node_size < physical_device_properties.limits.bufferImageGranularity && allocator->min_node_size < MEMORY_BLOCK_SIZE) {
+        allocator->min_node_size *= 2;
+    }
+}
+
+static VkResult memory_block_create(MemoryAllocator *allocator, uint32_t memory_type_index, VkDeviceSize size, bool dedicated, uint32_t *block_index) {
+    // Reuse the slot of a freed dedicated block.
+
+    uint32_t index = allocator->block_count;
+
+    for (uint32_t i = 0; i < allocator->block_count; i++) {
+        if (allocator->blocks[i].memory == VK_NULL_HANDLE) {
+            index = i;
+            break;
+        }
+    }
+
+    if (index == allocator->block_count) {
+        MemoryBlock *blocks = realloc(allocator->blocks, (allocator->block_count + 1) * sizeof *blocks);
+
+        if (blocks == NULL) {
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+
+        allocator->blocks = blocks;
+        allocator->blocks[allocator->block_count++] = (MemoryBlock) { 0 };
+    }
+
+    MemoryBlock block = {
+        .memory = VK_NULL_HANDLE,
+        .size = size,
+        .memory_type_index = memory_type_index,
+        .mapped_data = NULL,
+        .level_count = 0,
+        .free_orders = NULL,
+        .used_size = 0,
+        .requested_size = 0,
+        .allocation_count = 0,
+    };
+
+    if (!dedicated) {
+        while ((allocator->min_node_size << block.level_count) <= size) {
+            block.level_count++;
+        }
+
+        block.free_orders = malloc((size_t)1 << block.level_count);
+
+        if (block.free_orders == NULL) {
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+
+        for (uint32_t i = 1; i < (1u << block.level_count); i++) {
+            block.free_orders[i] = memory_node_full_order(&block, i);
+        }
+    }
+
+    const VkMemoryAllocateInfo memory_allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = NULL,
+        .allocationSize = size,
+        .memoryTypeIndex = memory_type_index,
+    };
+
+    VkResult result = vkAllocateMemory(allocator->device, &memory_allocate_info, NULL, &block.memory);
+
+    if (result == VK_SUCCESS && allocator->memory_properties.memoryTypes[memory_type_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        result = vkMapMemory(allocator->device, block.memory, 0, VK_WHOLE_SIZE, 0, (void **)&block.mapped_data);
+
+        if (result != VK_SUCCESS) {
+            vkFreeMemory(allocator->device, block.memory, NULL);
+        }
+    }
+
+    if (result != VK_SUCCESS) {
+        free(block.free_orders);
+        return result;
+    }
+
+    allocator->blocks[index] = block;
+    *block_index = index;
+
+    return VK_SUCCESS;
+}
+
+// Allocates a node of the given order, returning its index or 0 if no node is free.
+
+static uint32_t memory_block_allocate_node(MemoryBlock *block, uint32_t order) {
+    if (block->free_orders[1] < order + 1) {
+        return 0;
+    }
+
+    // Walk down to a free node of the right size, through the child with the smallest free node
+    // that still fits (best fit keeps the large nodes intact).
+
+    uint32_t node_index = 1;
+
+    for (uint32_t level = 0; block->level_count - 1 - level > order; level++) {
+        const uint32_t left = node_index * 2;
+        const uint32_t right = left + 1;
+        const bool left_fits = block->free_orders[left] >= order + 1;
+        const bool right_fits = block->free_orders[right] >= order + 1;
+
+        node_index = left_fits && (!right_fits || block->free_orders[left] <= block->free_orders[right]) ? left : right;
+    }
+
+    block->free_orders[node_index] = 0;
+
+    // Update the ancestors.
+
+    for (uint32_t parent = node_index / 2; parent > 0; parent /= 2) {
+        const uint8_t left = block->free_orders[parent * 2];
+        const uint8_t right = block->free_orders[parent * 2 + 1];
+        block->free_orders[parent] = left > right ? left : right;
+    }
+
+    return node_index;
+}
+
+static void memory_block_free_node(MemoryBlock *block, uint32_t node_index) {
+    block->free_orders[node_index] = memory_node_full_order(block, node_index);
+
+    // Merge free buddies on the way up.
+
+    for (uint32_t parent = node_index / 2; parent > 0; parent /= 2) {
+        const uint8_t left = block->free_orders[parent * 2];
+        const uint8_t right = block->free_orders[parent * 2 + 1];
+        const uint8_t child_full_order = memory_node_full_order(block, parent * 2);
+
+        if (left == child_full_order && right == child_full_order) {
+            block->free_orders[parent] = child_full_order + 1;
+        } else {
+            block->free_orders[parent] = left > right ? left : right;
+        }
+    }
+}
+
+// Allocates memory for the given requirements from a memory type with all of the
+// `required_flags`, preferring one with all of the `preferred_flags` as well.
+
+static VkResult memory_allocate(MemoryAllocator *allocator, const VkMemoryRequirements *memory_requirements, VkMemoryPropertyFlags required_flags, VkMemoryPropertyFlags preferred_flags, MemoryAllocation *allocation) {
+    uint32_t memory_type_bits = 0;
+
+    for (uint32_t i = 0; i < allocator->memory_properties.memoryTypeCount; i++) {
+        if ((allocator->memory_properties.memoryTypes[i].propertyFlags & required_flags) == required_flags) {
+            memory_type_bits |= 1u << i;
+        }
+    }
+
+    const uint32_t memory_type_index = find_memory_type(&allocator->memory_properties, memory_requirements->memoryTypeBits & memory_type_bits, preferred_flags);
+
+    if (memory_type_index == UINT32_MAX) {
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+    }
+
+    // Large resources get a block of their own.
+
+    if (memory_requirements->size > MEMORY_BLOCK_SIZE / 2) {
+        uint32_t block_index = 0;
+        const VkResult result = memory_block_create(allocator, memory_type_index, memory_requirements->size, true, &block_index);
+
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+
+        MemoryBlock *block = &allocator->blocks[block_index];
+        block->used_size = block->size;
+        block->requested_size = block->size;
+        block->allocation_count = 1;
+
+        *allocation = (MemoryAllocation) {
+            .memory = block->memory,
+            .offset = 0,
+            .size = block->size,
+            .mapped_data = block->mapped_data,
+            .block_index = block_index,
+            .node_index = 0,
+        };
+
+        return VK_SUCCESS;
+    }
+
+    // Find the order of the node that holds the resource.
+
+    uint32_t order = 0;
+
+    while ((allocator->min_node_size << order) < memory_requirements->size || (allocator->min_node_size << order) < memory_requirements->alignment) {
+        order++;
+    }
+
+    // Try the existing blocks of the memory type first, then a new one.
+
+    uint32_t block_index = UINT32_MAX;
+    uint32_t node_index = 0;
+
+    for (uint32_t i = 0; i < allocator->block_count && node_index == 0; i++) {
+        MemoryBlock *block = &allocator->blocks[i];
+
+        if (block->memory != VK_NULL_HANDLE && block->free_orders != NULL && block->memory_type_index == memory_type_index) {
+            block_index = i;
+            node_index = memory_block_allocate_node(block, order);
+        }
+    }
+
+    if (node_index == 0) {
+        const VkResult result = memory_block_create(allocator, memory_type_index, MEMORY_BLOCK_SIZE, false, &block_index);
+
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+
+        node_index = memory_block_allocate_node(&allocator->blocks[block_index], order);
+    }
+
+    MemoryBlock *block = &allocator->blocks[block_index];
+    const uint32_t level = memory_node_level(node_index);
+    const VkDeviceSize node_size = block->size >> level;
+    const VkDeviceSize offset = (node_index - (1u << level)) * node_size;
+
+    block->used_size += node_size;
+    block->requested_size += memory_requirements->size;
+    block->allocation_count++;
+
+    *allocation = (MemoryAllocation) {
+        .memory = block->memory,
+        .offset = offset,
+        .size = memory_requirements->size,
+        .mapped_data = block->mapped_data != NULL ? block->mapped_data + offset : NULL,
+        .block_index = block_index,
+        .node_index = node_index,
+    };
+
+    return VK_SUCCESS;
+}
+
+static void memory_free(MemoryAllocator *allocator, const MemoryAllocation *allocation) {
+    MemoryBlock *block = &allocator->blocks[allocation->block_index];
+
+    // Dedicated blocks are given back right away, regular blocks are kept for later allocations.
+
+    if (allocation->node_index == 0) {
+        vkFreeMemory(allocator->device, block->memory, NULL);
+        *block = (MemoryBlock) { 0 };
+        return;
+    }
+
+    block->used_size -= block->size >> memory_node_level(allocation->node_index);
+    block->requested_size -= allocation->size;
+    block->allocation_count--;
+
+    memory_block_free_node(block, allocation->node_index);
+}
+
+static MemoryStats memory_allocator_stats(const MemoryAllocator *allocator) {
+    MemoryStats stats = { 0 };
+
+    for (uint32_t i = 0; i < allocator->block_count; i++) {
+        const MemoryBlock *block = &allocator->blocks[i];
+
+        if (block->memory == VK_NULL_HANDLE) {
+            continue;
+        }
+
+        stats.block_count++;
+        stats.dedicated_block_count += block->free_orders == NULL ? 1 : 0;
+        stats.allocation_count += block->allocation_count;
+        stats.reserved_size += block->size;
+        stats.used_size += block->used_size;
+        stats.requested_size += block->requested_size;
+
+        if (block->free_orders != NULL && block->free_orders[1] > 0) {
+            const VkDeviceSize largest_free_size = allocator->min_node_size << (block->free_orders[1] - 1);
+
+            if (largest_free_size > stats.largest_free_size) {
+                stats.largest_free_size = largest_free_size;
+            }
+        }
+    }
+
+    return stats;
+}
+
+// Returns the internal and external fragmentation as fractions of the used and free memory.
+
+static void memory_stats_fragmentation(const MemoryStats *stats, double *internal_fragmentation, double *external_fragmentation) {
+    const VkDeviceSize free_size = stats->reserved_size - stats->used_size;
+
+    *internal_fragmentation = stats->used_size > 0 ? 1.0 - (double)stats->requested_size / (double)stats->used_size : 0.0;
+    *external_fragmentation = free_size > 0 ? 1.0 - (double)stats->largest_free_size / (double)free_size : 0.0;
+}
+
+static void memory_allocator_destroy(MemoryAllocator *allocator) {
+    for (uint32_t i = 0; i < allocator->block_count; i++) {
+        if (allocator->blocks[i].memory != VK_NULL_HANDLE) {
+            vkFreeMemory(allocator->device, allocator->blocks[i].memory, NULL);
+        }
+
+        free(allocator->blocks[i].free_orders);
+    }
+
+    free(allocator->blocks);
+}
+
+// A linear arena for data that only lives for one frame (uniforms, instance data, staging). The
+// arena is a range of a persistently mapped buffer. Allocating only moves the head, and the whole
+// arena is reset once the frame that used it has finished.
+
+typedef struct LinearArena {
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    VkDeviceSize head;
+    VkDeviceSize peak_head;
+    uint8_t *mapped_data;
+} LinearArena;
+
+// Allocates `size` bytes at the given (power of two) alignment, returning the offset in the buffer
+// and a pointer to the mapped memory. Returns false if the arena is full.
+
+static bool linear_arena_allocate(LinearArena *arena, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *offset, void **data) {
+    const VkDeviceSize aligned_head = (arena->offset + arena->head + alignment - 1) / alignment * alignment - arena->offset;
+
+    if (aligned_head + size > arena->size) {
+        return false;
+    }
+
+    *offset = arena->offset + aligned_head;
+    *data = arena->mapped_data + aligned_head;
+    arena->head = aligned_head + size;
+
+    if (arena->head > arena->peak_head) {
+        arena->peak_head = arena->head;
+    }
+
+    return true;
+}
+
+static void linear_arena_reset(LinearArena *arena) {
+    arena->head = 0;
+}
+
+// Creates a timeline semaphore starting at zero. Each queue that signals one uses its own, so the
+// values it signals only have to increase in the order of its submissions.
+
+static VkResult timeline_semaphore_create(VkDevice device, VkSemaphore *semaphore) {
+    const VkSemaphoreTypeCreateInfo semaphore_type_create_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .pNext = NULL,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+
+    const VkSemaphoreCreateInfo semaphore_create_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &semaphore_type_create_info,
+        .flags = 0,
+    };
+
+    return vkCreateSemaphore(device, &semaphore_create_info, NULL, semaphore);
+}
+
+// Uploads go through a persistently mapped staging ring buffer and are copied on the transfer
+// queue. A large upload is split into chunks, and only as many chunks are copied per frame as fit
+// into the frame's budget and the free part of the ring, so the frame loop never waits for an
+// upload. When the transfer queue belongs to another queue family than the graphics queue, the
+// ownership of every finished resource is released on the transfer queue and acquired by the next
+// frame on the graphics queue, unless the resource is shared by all queue families (concurrent
+// sharing). Every batch signals the next value of a timeline semaphore, which
+// the frame waits on and which tells when the staging memory of a batch can be reused.
+
+#define UPLOAD_BATCH_COUNT 4
+
+typedef struct UploadRequest {
+    uint64_t id;
+    const uint8_t *data;
+    VkDeviceSize size;
+    VkDeviceSize uploaded_size;
+    VkBuffer buffer;
+    VkDeviceSize buffer_offset;
+    VkImage image;
+    VkExtent3D image_extent;
+    VkDeviceSize texel_size;
+    VkPipelineStageFlags dst_stage_mask;
+    VkAccessFlags dst_access_mask;
+    bool concurrent;
+} UploadRequest;
+
+// The copies submitted together. A batch is reused once the timeline semaphore has reached the
+// value its submission signals. The stages that use the resources it finished wait for that value.
+
+typedef struct UploadBatch {
+    VkCommandBuffer command_buffer;
+    uint64_t semaphore_value;
+    bool recording;
+    VkPipelineStageFlags wait_stage_mask;
+    VkDeviceSize staging_end;
+    uint64_t last_request_id;
+} UploadBatch;
+
+// A barrier that still has to be recorded on the graphics queue to acquire a finished resource.
+
+typedef struct UploadAcquire {
+    uint32_t batch_index;
+    bool submitted;
+    VkPipelineStageFlags dst_stage_mask;
+    VkBufferMemoryBarrier buffer_memory_barrier;
+    VkImageMemoryBarrier image_memory_barrier;
+} UploadAcquire;
+
+typedef struct UploadContext {
+    VkDevice device;
+    VkQueue queue;
+    uint32_t queue_family_index;
+    uint32_t graphics_queue_family_index;
+    VkCommandPool command_pool;
+    VkSemaphore semaphore;
+    uint64_t submitted_semaphore_value;
+    uint64_t wait_semaphore_value;
+    VkPipelineStageFlags wait_stage_mask;
+    VkBuffer staging_buffer;
+    MemoryAllocation staging_allocation;
+    VkDeviceSize staging_size;
+    VkDeviceSize staging_alignment;
+    VkDeviceSize staging_head;
+    VkDeviceSize staging_tail;
+    UploadBatch batches[UPLOAD_BATCH_COUNT];
+    uint32_t first_batch_index;
+    uint32_t batch_count;
+    UploadRequest *requests;
+    uint32_t request_count;
+    uint32_t request_capacity;
+    UploadAcquire *acquires;
+    uint32_t acquire_count;
+    uint32_t acquire_capacity;
+    uint64_t next_request_id;
+    uint64_t submitted_request_id;
+    uint64_t ready_request_id;
+} UploadContext;
+
+static VkResult upload_context_create(UploadContext *upload, MemoryAllocator *allocator, VkQueue queue, uint32_t queue_family_index, uint32_t graphics_queue_family_index, VkDeviceSize staging_size, VkDeviceSize staging_alignment) {
+    *upload = (UploadContext) { 0 };
+    upload->device = allocator->device;
+    upload->queue = queue;
+    upload->queue_family_index = queue_family_index;
+    upload->graphics_queue_family_index = graphics_queue_family_index;
+    upload->staging_size = staging_size;
+    upload->staging_alignment = staging_alignment;
+    upload->next_request_id = 1;
+
+    const VkCommandPoolCreateInfo command_pool_create_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = queue_family_index,
+    };
+
+    VkResult result = vkCreateCommandPool(upload->device, &command_pool_create_info, NULL, &upload->command_pool);
+
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    result = timeline_semaphore_create(upload->device, &upload->semaphore);
+
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    for (uint32_t i = 0; i < UPLOAD_BATCH_COUNT; i++) {
+        const VkCommandBufferAllocateInfo command_buffer_allocate_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .pNext = NULL,
+            .commandPool = upload->command_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+
+        result = vkAllocateCommandBuffers(upload->device, &command_buffer_allocate_info, &upload->batches[i].command_buffer);
+
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+
+    // Create the staging ring buffer.
+
+    const VkBufferCreateInfo buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .size = staging_size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = 0,
+        .pQueueFamilyIndices = NULL,
+    };
+
+    result = vkCreateBuffer(upload->device, &buffer_create_info, NULL, &upload->staging_buffer);
+
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkMemoryRequirements memory_requirements;
+    vkGetBufferMemoryRequirements(upload->device, upload->staging_buffer, &memory_requirements);
+
+    result = memory_allocate(allocator, &memory_requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, &upload->staging_allocation);
+
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    return vkBindBufferMemory(upload->device, upload->staging_buffer, upload->staging_allocation.memory, upload->staging_allocation.offset);
+}
+
+static bool upload_enqueue(UploadContext *upload, const UploadRequest *request, uint64_t *request_id) {
+    if (upload->request_count == upload->request_capacity) {
+        const uint32_t request_capacity = upload->request_capacity == 0 ? 16 : upload->request_capacity * 2;
+        UploadRequest *requests = realloc(upload->requests, request_capacity * sizeof *requests);
+
+        if (requests == NULL) {
+            return false;
+        }
+
+        upload->requests = requests;
+        upload->request_capacity = request_capacity;
+    }
+
+    *request_id = upload->next_request_id++;
+
+    upload->requests[upload->request_count] = *request;
+    upload->requests[upload->request_count].id = *request_id;
+    upload->requests[upload->request_count].uploaded_size = 0;
+    upload->request_count++;
+
+    return true;
+}
+
+// Queues an upload to a buffer. The data has to stay valid until the upload is ready. The sharing
+// mode has to match the one the buffer was created with.
+
+static bool upload_buffer(UploadContext *upload, VkBuffer buffer, VkDeviceSize buffer_offset, const void *data, VkDeviceSize size, VkSharingMode sharing_mode, VkPipelineStageFlags dst_stage_mask, VkAccessFlags dst_access_mask, uint64_t *request_id) {
+    const UploadRequest request = {
+        .id = 0,
+        .data = data,
+        .size = size,
+        .uploaded_size = 0,
+        .buffer = buffer,
+        .buffer_offset = buffer_offset,
+        .image = VK_NULL_HANDLE,
+        .image_extent = { 0, 0, 0 },
+        .texel_size = 0,
+        .dst_stage_mask = dst_stage_mask,
+        .dst_access_mask = dst_access_mask,
+        .concurrent = sharing_mode == VK_SHARING_MODE_CONCURRENT,
+    };
+
+    return upload_enqueue(upload, &request, request_id);
+}
+
+// Queues an upload to the first mip level of a 2D image, which ends up in the shader read only
+// layout. The data is tightly packed, and a single row has to fit into half of the staging ring.
+
+static bool upload_image(UploadContext *upload, VkImage image, VkExtent2D image_extent, VkDeviceSize texel_size, const void *data, VkPipelineStageFlags dst_stage_mask, VkAccessFlags dst_access_mask, uint64_t *request_id) {
+    if (image_extent.width * texel_size > upload->staging_size / 2) {
+        return false;
+    }
+
+    const UploadRequest request = {
+        .id = 0,
+        .data = data,
+        .size = image_extent.width * image_extent.height * texel_size,
+        .uploaded_size = 0,
+        .buffer = VK_NULL_HANDLE,
+        .buffer_offset = 0,
+        .image = image,
+        .image_extent = { image_extent.width, image_extent.height, 1 },
+        .texel_size = texel_size,
+        .dst_stage_mask = dst_stage_mask,
+        .dst_access_mask = dst_access_mask,
+        .concurrent = false,
+    };
+
+    return upload_enqueue(upload, &request, request_id);
+}
+
+// Returns whether the upload is done as far as the next recorded frame is concerned.
+
+static bool upload_is_ready(const UploadContext *upload, uint64_t request_id) {
+    return request_id <= upload->ready_request_id;
+}
+
+// Reclaims the staging memory of the finished batches, oldest first.
+
+static void upload_retire_batches(UploadContext *upload) {
+    uint64_t completed_semaphore_value = 0;
+
+    if (vkGetSemaphoreCounterValue(upload->device, upload->semaphore, &completed_semaphore_value) != VK_SUCCESS) {
+        return;
+    }
+
+    while (upload->batch_count > 0) {
+        UploadBatch *batch = &upload->batches[upload->first_batch_index];
+
+        if (batch->recording || batch->semaphore_value > completed_semaphore_value) {
+            break;
+        }
+
+        upload->staging_tail = batch->staging_end;
+        upload->first_batch_index = (upload->first_batch_index + 1) % UPLOAD_BATCH_COUNT;
+        upload->batch_count--;
+    }
+}
+
+// Returns the batch that is being recorded, starting a new one if needed, or NULL if all batches
+// are still in flight.
+
+static UploadBatch *upload_current_batch(UploadContext *upload) {
+    if (upload->batch_count > 0) {
+        UploadBatch *last_batch = &upload->batches[(upload->first_batch_index + upload->batch_count - 1) % UPLOAD_BATCH_COUNT];
+
+        if (last_batch->recording) {
+            return last_batch;
+        }
+    }
+
+    if (upload->batch_count == UPLOAD_BATCH_COUNT) {
+        return NULL;
+    }
+
+    UploadBatch *batch = &upload->batches[(upload->first_batch_index + upload->batch_count) % UPLOAD_BATCH_COUNT];
+
+    const VkCommandBufferBeginInfo command_buffer_begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = NULL,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = NULL,
+    };
+
+    if (vkBeginCommandBuffer(batch->command_buffer, &command_buffer_begin_info) != VK_SUCCESS) {
+        return NULL;
+    }
+
+    batch->recording = true;
+    batch->wait_stage_mask = 0;
+    batch->last_request_id = 0;
+    upload->batch_count++;
+
+    return batch;
+}
+
+// Reserves up to `size` contiguous bytes of the staging ring, returning the number of bytes that
+// are available (zero if the ring is full).
+
+static VkDeviceSize upload_reserve_staging(UploadContext *upload, VkDeviceSize size, VkDeviceSize granularity, VkDeviceSize *offset) {
+    const VkDeviceSize position = upload->staging_head % upload->staging_size;
+    VkDeviceSize padding = (upload->staging_alignment - position % upload->staging_alignment) % upload->staging_alignment;
+
+    // Chunks never wrap around the end of the ring.
+
+    if (position + padding + granularity > upload->staging_size) {
+        padding = upload->staging_size - position;
+    }
+
+    const VkDeviceSize free_size = upload->staging_size - (upload->staging_head - upload->staging_tail);
+
+    if (free_size <= padding) {
+        return 0;
+    }
+
+    const VkDeviceSize start = (position + padding) % upload->staging_size;
+    VkDeviceSize available_size = upload->staging_size - start < free_size - padding ? upload->staging_size - start : free_size - padding;
+
+    if (available_size > size) {
+        available_size = size;
+    }
+
+    available_size -= available_size % granularity;
+
+    if (available_size > 0) {
+        upload->staging_head += padding + available_size;
+        *offset = start;
+    }
+
+    return available_size;
+}
+
+static bool upload_push_acquire(UploadContext *upload, const UploadAcquire *acquire) {
+    if (upload->acquire_count == upload->acquire_capacity) {
+        const uint32_t acquire_capacity = upload->acquire_capacity == 0 ? 16 : upload->acquire_capacity * 2;
+        UploadAcquire *acquires = realloc(upload->acquires, acquire_capacity * sizeof *acquires);
+
+        if (acquires == NULL) {
+            return false;
+        }
+
+        upload->acquires = acquires;
+        upload->acquire_capacity = acquire_capacity;
+    }
+
+    upload->acquires[upload->acquire_count++] = *acquire;
+    return true;
+}
+
+// Records the barriers after the last chunk of a request. With separate queue families, the
+// barrier on the transfer queue releases the resource and a matching one acquires it later.
+// Resources with concurrent sharing need no barrier there, the semaphore makes the copies visible.
+
+static bool upload_finish_request(UploadContext *upload, UploadBatch *batch, uint32_t batch_index, const UploadRequest *request) {
+    const bool separate_queue_family = upload->queue_family_index != upload->graphics_queue_family_index;
+    const bool transfer_ownership = separate_queue_family && !request->concurrent;
+
+    batch->last_request_id = request->id;
+    batch->wait_stage_mask |= request->dst_stage_mask;
+
+    if (separate_queue_family && request->concurrent) {
+        return true;
+    }
+
+    const VkBufferMemoryBarrier buffer_memory_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = transfer_ownership ? 0 : request->dst_access_mask,
+        .srcQueueFamilyIndex = transfer_ownership ? upload->queue_family_index : VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = transfer_ownership ? upload->graphics_queue_family_index : VK_QUEUE_FAMILY_IGNORED,
+        .buffer = request->buffer,
+        .offset = request->buffer_offset,
+        .size = request->size,
+    };
+
+    const VkImageMemoryBarrier image_memory_barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = transfer_ownership ? 0 : request->dst_access_mask,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .srcQueueFamilyIndex = transfer_ownership ? upload->queue_family_index : VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = transfer_ownership ? upload->graphics_queue_family_index : VK_QUEUE_FAMILY_IGNORED,
+        .image = request->image,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    };
+
+    const bool image = request->image != VK_NULL_HANDLE;
+    const VkPipelineStageFlags dst_stage_mask = transfer_ownership ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : request->dst_stage_mask;
+
+    vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage_mask, 0, 0, NULL, image ? 0 : 1, &buffer_memory_barrier, image ? 1 : 0, &image_memory_barrier);
+
+    if (!transfer_ownership) {
+        return true;
+    }
+
+    // The acquire repeats the release, but its access scope is on the graphics side.
+
+    UploadAcquire acquire = {
+        .batch_index = batch_index,
+        .submitted = false,
+        .dst_stage_mask = request->dst_stage_mask,
+        .buffer_memory_barrier = buffer_memory_barrier,
+        .image_memory_barrier = image_memory_barrier,
+    };
+
+    acquire.buffer_memory_barrier.srcAccessMask = 0;
+    acquire.buffer_memory_barrier.dstAccessMask = request->dst_access_mask;
+    acquire.image_memory_barrier.srcAccessMask = 0;
+    acquire.image_memory_barrier.dstAccessMask = request->dst_access_mask;
+
+    if (!image) {
+        acquire.image_memory_barrier.image = VK_NULL_HANDLE;
+    } else {
+        acquire.buffer_memory_barrier.buffer = VK_NULL_HANDLE;
+    }
+
+    return upload_push_acquire(upload, &acquire);
+}
+
+static VkResult upload_flush(UploadContext *upload) {
+    if (upload->batch_count == 0) {
+        return VK_SUCCESS;
+    }
+
+    const uint32_t batch_index = (upload->first_batch_index + upload->batch_count - 1) % UPLOAD_BATCH_COUNT;
+    UploadBatch *batch = &upload->batches[batch_index];
+
+    if (!batch->recording) {
+        return VK_SUCCESS;
+    }
+
+    VkResult result = vkEndCommandBuffer(batch->command_buffer);
+
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    const uint64_t semaphore_value = upload->submitted_semaphore_value + 1;
+
+    const VkTimelineSemaphoreSubmitInfo timeline_semaphore_submit_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .pNext = NULL,
+        .waitSemaphoreValueCount = 0,
+        .pWaitSemaphoreValues = NULL,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &semaphore_value,
+    };
+
+    const VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timeline_semaphore_submit_info,
+        .waitSemaphoreCount = 0,
+        .pWaitSemaphores = NULL,
+        .pWaitDstStageMask = NULL,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &batch->command_buffer,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &upload->semaphore,
+    };
+
+    result = vkQueueSubmit(upload->queue, 1, &submit_info, VK_NULL_HANDLE);
+
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    batch->recording = false;
+    batch->semaphore_value = semaphore_value;
+    batch->staging_end = upload->staging_head;
+    upload->submitted_semaphore_value = semaphore_value;
+
+    if (batch->wait_stage_mask != 0) {
+        upload->wait_semaphore_value = semaphore_value;
+        upload->wait_stage_mask |= batch->wait_stage_mask;
+    }
+
+    for (uint32_t i = 0; i < upload->acquire_count; i++) {
+        if (upload->acquires[i].batch_index == batch_index) {
+            upload->acquires[i].submitted = true;
+        }
+    }
+
+    if (batch->last_request_id > 0) {
+        upload->submitted_request_id = batch->last_request_id;
+    }
+
+    return VK_SUCCESS;
+}
+
+// Copies the next chunks of the queued requests, up to `budget` bytes, and submits them. Stops
+// early instead of waiting when the staging ring or the batches run out.
+
+static VkResult upload_process(UploadContext *upload, VkDeviceSize budget) {
+    upload_retire_batches(upload);
+
+    uint32_t finished_request_count = 0;
+
+    while (finished_request_count < upload->request_count && budget > 0) {
+        UploadRequest *request = &upload->requests[finished_request_count];
+
+        // Images are copied in whole rows.
+
+        const VkDeviceSize row_size = request->image != VK_NULL_HANDLE ? request->image_extent.width * request->texel_size : 1;
+        const VkDeviceSize remaining_size = request->size - request->uploaded_size;
+
+        VkDeviceSize chunk_size = remaining_size < budget ? remaining_size : budget;
+
+        if (chunk_size < row_size) {
+            chunk_size = row_size;
+        }
+
+        // A batch has to be available before any staging memory is reserved.
+
+        const UploadBatch *last_batch = &upload->batches[(upload->first_batch_index + upload->batch_count + UPLOAD_BATCH_COUNT - 1) % UPLOAD_BATCH_COUNT];
+
+        if (upload->batch_count == UPLOAD_BATCH_COUNT && !last_batch->recording) {
+            break;
+        }
+
+        VkDeviceSize staging_offset = 0;
+        chunk_size = upload_reserve_staging(upload, chunk_size, row_size, &staging_offset);
+
+        if (chunk_size == 0) {
+            break;
+        }
+
+        UploadBatch *batch = upload_current_batch(upload);
+
+        if (batch == NULL) {
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+
+        const uint32_t batch_index = (uint32_t)(batch - upload->batches);
+
+        memcpy((uint8_t *)upload->staging_allocation.mapped_data + staging_offset, request->data + request->uploaded_size, chunk_size);
+
+        if (request->image == VK_NULL_HANDLE) {
+            const VkBufferCopy buffer_copy = {
+                .srcOffset = staging_offset,
+                .dstOffset = request->buffer_offset + request->uploaded_size,
+                .size = chunk_size,
+            };
+
+            vkCmdCopyBuffer(batch->command_buffer, upload->staging_buffer, request->buffer, 1, &buffer_copy);
+        } else {
+            // The previous contents of the image are discarded before the first chunk.
+
+            if (request->uploaded_size == 0) {
+                const VkImageMemoryBarrier image_memory_barrier = {
+                    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                    .pNext = NULL,
+                    .srcAccessMask = 0,
+                    .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                    .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                    .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                    .image = request->image,
+                    .subresourceRange = {
+                        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                        .baseMipLevel = 0,
+                        .levelCount = 1,
+                        .baseArrayLayer = 0,
+                        .layerCount = 1,
+                    },
+                };
+
+                vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &image_memory_barrier);
+            }
+
+            const VkBufferImageCopy buffer_image_copy = {
+                .bufferOffset = staging_offset,
+                .bufferRowLength = 0,
+                .bufferImageHeight = 0,
+                .imageSubresource = {
+                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                    .mipLevel = 0,
+                    .baseArrayLayer = 0,
+                    .layerCount = 1,
+                },
+                .imageOffset = { 0, (int32_t)(request->uploaded_size / row_size), 0 },
+                .imageExtent = { request->image_extent.width, (uint32_t)(chunk_size / row_size), 1 },
+            };
+
+            vkCmdCopyBufferToImage(batch->command_buffer, upload->staging_buffer, request->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &buffer_image_copy);
+        }
+
+        request->uploaded_size += chunk_size;
+        budget = budget > chunk_size ? budget - chunk_size : 0;
+
+        if (request->uploaded_size == request->size) {
+            if (!upload_finish_request(upload, batch, batch_index, request)) {
+                return VK_ERROR_OUT_OF_HOST_MEMORY;
+            }
+
+            finished_request_count++;
+        }
+    }
+
+    // Remove the finished requests, keeping the order of the rest.
+
+    upload->request_count -= finished_request_count;
+    memmove(upload->requests, upload->requests + finished_request_count, upload->request_count * sizeof *upload->requests);
+
+    return upload_flush(upload);
+}
+
+// Records the acquire barriers of the submitted uploads into a graphics command buffer. Returns the
+// stages that have to wait for the timeline semaphore to reach `wait_semaphore_value` in the
+// submissions of the frame, or zero if there is nothing to wait on.
+
+static VkPipelineStageFlags upload_acquire(UploadContext *upload, VkCommandBuffer command_buffer, uint64_t *wait_semaphore_value) {
+    const VkPipelineStageFlags wait_stage_mask = upload->wait_stage_mask;
+
+    *wait_semaphore_value = upload->wait_semaphore_value;
+    upload->wait_stage_mask = 0;
+
+    uint32_t kept_acquire_count = 0;
+
+    for (uint32_t i = 0; i < upload->acquire_count; i++) {
+        const UploadAcquire *acquire = &upload->acquires[i];
+
+        if (!acquire->submitted) {
+            upload->acquires[kept_acquire_count++] = *acquire;
+            continue;
+        }
+
+        const bool image = acquire->image_memory_barrier.image != VK_NULL_HANDLE;
+
+        vkCmdPipelineBarrier(command_buffer, acquire->dst_stage_mask, acquire->dst_stage_mask, 0, 0, NULL, image ? 0 : 1, &acquire->buffer_memory_barrier, image ? 1 : 0, &acquire->image_memory_barrier);
+    }
+
+    upload->acquire_count = kept_acquire_count;
+    upload->ready_request_id = upload->submitted_request_id;
+
+    return wait_stage_mask;
+}
+
+static void upload_context_destroy(UploadContext *upload, MemoryAllocator *allocator) {
+    vkDestroySemaphore(upload->device, upload->semaphore, NULL);
+    vkDestroyCommandPool(upload->device, upload->command_pool, NULL);
+    vkDestroyBuffer(upload->device, upload->staging_buffer, NULL);
+
+    if (upload->staging_allocation.memory != VK_NULL_HANDLE) {
+        memory_free(allocator, &upload->staging_allocation);
+    }
+
+    free(upload->requests);
+    free(upload->acquires);
+}
+
+// The queue of a compute-only queue family, which runs compute work next to the graphics queue and
+// fills the gaps the graphics work leaves (async compute). Every submission signals the next value
+// of a timeline semaphore, which the graphics submissions that use its results wait on. Resources
+// used on both queues are created with concurrent sharing, so they need no ownership transfers.
+
+typedef struct ComputeQueue {
+    VkDevice device;
+    VkQueue queue;
+    uint32_t queue_family_index;
+    VkSemaphore semaphore;
+    uint64_t submitted_semaphore_value;
+} ComputeQueue;
+
+static VkResult compute_queue_create(ComputeQueue *compute, VkDevice device, VkQueue queue, uint32_t queue_family_index) {
+    *compute = (ComputeQueue) { 0 };
+    compute->device = device;
+    compute->queue = queue;
+    compute->queue_family_index = queue_family_index;
+
+    return timeline_semaphore_create(device, &compute->semaphore);
+}
+
+// Submits a command buffer once the given timeline semaphores have reached their values, and
+// returns the value of the compute semaphore that signals its completion.
+
+static VkResult compute_queue_submit(ComputeQueue *compute, VkCommandBuffer command_buffer, uint32_t wait_semaphore_count, const VkSemaphore *wait_semaphores, const uint64_t *wait_semaphore_values, const VkPipelineStageFlags *wait_stage_masks, uint64_t *semaphore_value) {
+    const uint64_t signal_semaphore_value = compute->submitted_semaphore_value + 1;
+
+    const VkTimelineSemaphoreSubmitInfo timeline_semaphore_submit_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .pNext = NULL,
+        .waitSemaphoreValueCount = wait_semaphore_count,
+        .pWaitSemaphoreValues = wait_semaphore_values,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &signal_semaphore_value,
+    };
+
+    const VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timeline_semaphore_submit_info,
+        .waitSemaphoreCount = wait_semaphore_count,
+        .pWaitSemaphores = wait_semaphores,
+        .pWaitDstStageMask = wait_stage_masks,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &command_buffer,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &compute->semaphore,
+    };
+
+    const VkResult result = vkQueueSubmit(compute->queue, 1, &submit_info, VK_NULL_HANDLE);
+
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    compute->submitted_semaphore_value = signal_semaphore_value;
+    *semaphore_value = signal_semaphore_value;
+
+    return VK_SUCCESS;
+}
+
+static void compute_queue_destroy(ComputeQueue *compute) {
+    vkDestroySemaphore(compute->device, compute->semaphore, NULL);
+}
+
+// Command buffers allocated from a transient command pool. The pool is reset as a whole once the
+// GPU is done with its command buffers, which makes all of them available again without freeing or
+// allocating anything. New command buffers are only allocated when more are needed than ever before.
+
+typedef struct CommandBufferPool {
+    VkCommandPool command_pool;
+    VkCommandBufferLevel level;
+    VkCommandBuffer *command_buffers;
+    uint32_t command_buffer_count;
+    uint32_t used_command_buffer_count;
+} CommandBufferPool;
+
+static VkResult command_buffer_pool_reserve(VkDevice device, CommandBufferPool *pool, uint32_t command_buffer_count) {
+    if (command_buffer_count <= pool->command_buffer_count) {
+        return VK_SUCCESS;
+    }
+
+    VkCommandBuffer *command_buffers = realloc(pool->command_buffers, command_buffer_count * sizeof *command_buffers);
+
+    if (command_buffers == NULL) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+
+    pool->command_buffers = command_buffers;
+
+    const VkCommandBufferAllocateInfo command_buffer_allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .pNext = NULL,
+        .commandPool = pool->command_pool,
+        .level = pool->level,
+        .commandBufferCount = command_buffer_count - pool->command_buffer_count,
+    };
+
+    const VkResult result = vkAllocateCommandBuffers(device, &command_buffer_allocate_info, &pool->command_buffers[pool->command_buffer_count]);
+
+    if (result == VK_SUCCESS) {
+        pool->command_buffer_count = command_buffer_count;
+    }
+
+    return result;
+}
+
+// Hands out the next unused command buffer of the pool, allocating more if all are in use.
+
+static VkResult command_buffer_pool_get(VkDevice device, CommandBufferPool *pool, VkCommandBuffer *command_buffer) {
+    if (pool->used_command_buffer_count == pool->command_buffer_count) {
+        const VkResult result = command_buffer_pool_reserve(device, pool, pool->command_buffer_count == 0 ? 1 : pool->command_buffer_count * 2);
+
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+
+    *command_buffer = pool->command_buffers[pool->used_command_buffer_count++];
+    return VK_SUCCESS;
+}
+
+// Makes all command buffers of the pool available again. The GPU must be done with all of them.
+
+static VkResult command_buffer_pool_reset(VkDevice device, CommandBufferPool *pool) {
+    pool->used_command_buffer_count = 0;
+    return vkResetCommandPool(device, pool->command_pool, 0);
+}
+
+// A render graph for the work recorded in a frame. The passes of the frame are declared up front,
+// in the order they are recorded, with the images and buffers they access: the pipeline stages,
+// the access types and (for images) the layout. Right before a pass is recorded, the graph records
+// one barrier with everything the pass has to wait for: earlier writes to what it reads, earlier
+// reads and writes of what it overwrites, and layout transitions. Reads after reads need nothing,
+// and a read only waits for a write once per stage. Passes on another queue are ordered by
+// semaphores instead, so their accesses are not waited for again; resources shared between
+// queues are concurrent buffers, which need no ownership transfers. Images are exclusive to the
+// graphics queue, since moving them to another queue would take a release and acquire pair.
+
+#define RENDER_GRAPH_MAX_RESOURCES 16
+#define RENDER_GRAPH_MAX_PASSES 32
+#define RENDER_GRAPH_MAX_PASS_ACCESSES 8
+
+static const VkAccessFlags render_graph_write_access_mask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+typedef struct RenderGraphAccess {
+    uint32_t resource;
+    VkPipelineStageFlags stage_mask;
+    VkAccessFlags access_mask;
+    VkImageLayout layout;
+} RenderGraphAccess;
+
+typedef struct RenderGraphPass {
+    uint32_t queue;
+    RenderGraphAccess accesses[RENDER_GRAPH_MAX_PASS_ACCESSES];
+    uint32_t access_count;
+} RenderGraphPass;
+
+// An image or buffer accessed by the passes. The images owned by the graph come first and are kept
+// across frames, imported ones are declared again every frame. The state tracks the last write and
+// the reads since then: the stages a later access may have to wait for, and the stages and access
+// types the write was already made visible to.
+
+typedef struct RenderGraphResource {
+    VkImage image;
+    VkImageView view;
+    VkBuffer buffer;
+    VkFormat format;
+    VkExtent2D extent;
+    VkSampleCountFlagBits samples;
+    VkImageUsageFlags usage;
+    VkImageAspectFlags aspect_mask;
+    MemoryAllocation allocation;
+    VkDeviceSize memory_offset;
+    uint32_t aliased_resources;
+    bool accessed;
+    uint32_t queue;
+    VkImageLayout layout;
+    VkPipelineStageFlags write_stage_mask;
+    VkAccessFlags write_access_mask;
+    VkPipelineStageFlags read_stage_mask;
+    VkPipelineStageFlags visible_stage_mask;
+    VkAccessFlags visible_access_mask;
+} RenderGraphResource;
+
+// The images owned by the graph only keep their contents within a frame. They are created the
+// first time passes are declared after they were added, since where they live depends on the
+// passes that use them: images that are never used by the same passes share memory, so the
+// multisampled color image and the depth image of the render pass are reused by the
+// post-processing images, for example. Images that are only used as attachments get lazily
+// allocated memory instead where there is any, tiled GPUs then keep them in tile memory and never
+// allocate physical pages for them.
+
+typedef struct RenderGraph {
+    RenderGraphResource resources[RENDER_GRAPH_MAX_RESOURCES];
+    uint32_t resource_count;
+    uint32_t image_count;
+    bool images_created;
+    MemoryAllocation memory;
+    RenderGraphPass passes[RENDER_GRAPH_MAX_PASSES];
+    uint32_t pass_count;
+} RenderGraph;
+
+// The state of a resource before the first access of a frame. Imported resources may still be
+// written up to the given stages of the frame (the stages waiting for a semaphore, for example),
+// everything else happened before the frame context was reused.
+
+static void render_graph_reset_state(RenderGraphResource *resource, VkPipelineStageFlags available_stage_mask) {
+    resource->accessed = false;
+    resource->queue = 0;
+    resource->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    resource->write_stage_mask = available_stage_mask;
+    resource->write_access_mask = 0;
+    resource->read_stage_mask = 0;
+    resource->visible_stage_mask = 0;
+    resource->visible_access_mask = 0;
+}
+
+// Adds an image owned by the graph, which is created once passes were declared. The images have
+// to be added before any other resource, after the old ones were retired.
+
+static uint32_t render_graph_add_image(RenderGraph *graph, VkFormat format, VkExtent2D extent, VkSampleCountFlagBits samples, VkImageUsageFlags usage, VkImageAspectFlags aspect_mask) {
+    RenderGraphResource *resource = &graph->resources[graph->image_count];
+
+    *resource = (RenderGraphResource) {
+        .image = VK_NULL_HANDLE,
+        .view = VK_NULL_HANDLE,
+        .buffer = VK_NULL_HANDLE,
+        .format = format,
+        .extent = extent,
+        .samples = samples,
+        .usage = usage,
+        .aspect_mask = aspect_mask,
+        .allocation = { 0 },
+        .memory_offset = 0,
+        .aliased_resources = 0,
+    };
+
+    render_graph_reset_state(resource, 0);
+
+    graph->resource_count = graph->image_count + 1;
+    graph->images_created = false;
+    return graph->image_count++;
+}
+
+// Starts declaring the passes of a frame, which drops the imported resources of the last one.
+
+static void render_graph_begin_frame(RenderGraph *graph) {
+    graph->resource_count = graph->image_count;
+    graph->pass_count = 0;
+
+    for (uint32_t i = 0; i < graph->image_count; i++) {
+        render_graph_reset_state(&graph->resources[i], 0);
+    }
+}
+
+// Imports an image or a buffer the graph does not own for the current frame.
+
+static uint32_t render_graph_import(RenderGraph *graph, VkImage image, VkBuffer buffer, VkImageAspectFlags aspect_mask, VkPipelineStageFlags available_stage_mask) {
+    RenderGraphResource *resource = &graph->resources[graph->resource_count];
+
+    *resource = (RenderGraphResource) {
+        .image = image,
+        .view = VK_NULL_HANDLE,
+        .buffer = buffer,
+        .format = VK_FORMAT_UNDEFINED,
+        .extent = { 0, 0 },
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .usage = 0,
+        .aspect_mask = aspect_mask,
+        .allocation = { 0 },
+        .memory_offset = 0,
+        .aliased_resources = 0,
+    };
+
+    render_graph_reset_state(resource, available_stage_mask);
+    return graph->resource_count++;
+}
+
+static uint32_t render_graph_add_pass(RenderGraph *graph, uint32_t queue) {
+    graph->passes[graph->pass_count] = (RenderGraphPass) {
+        .queue = queue,
+        .accesses = { { 0 } },
+        .access_count = 0,
+    };
+
+    return graph->pass_count++;
+}
+
+static void render_graph_access(RenderGraph *graph, uint32_t pass, uint32_t resource, VkPipelineStageFlags stage_mask, VkAccessFlags access_mask, VkImageLayout layout) {
+    RenderGraphPass *graph_pass = &graph->passes[pass];
+
+    assert(graph->resources[resource].image == VK_NULL_HANDLE || graph_pass->queue == 0);
+
+    graph_pass->accesses[graph_pass->access_count++] = (RenderGraphAccess) {
+        .resource = resource,
+        .stage_mask = stage_mask,
+        .access_mask = access_mask,
+        .layout = layout,
+    };
+}
+
+static VkResult render_graph_create_image_view(VkDevice device, RenderGraphResource *resource) {
+    const VkImageViewCreateInfo image_view_create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .image = resource->image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = resource->format,
+        .components = {
+            .r = VK_COMPONENT_SWIZZLE_IDENTITY,
+            .g = VK_COMPONENT_SWIZZLE_IDENTITY,
+            .b = VK_COMPONENT_SWIZZLE_IDENTITY,
+            .a = VK_COMPONENT_SWIZZLE_IDENTITY,
+        },
+        .subresourceRange = {
+            .aspectMask = resource->aspect_mask,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    };
+
+    return vkCreateImageView(device, &image_view_create_info, NULL, &resource->view);
+}
+
+// Creates the images owned by the graph, given the passes of a frame. Every frame has to declare
+// the same passes for them, the memory they share is only safe to share if they are never used by
+// overlapping ranges of passes.
+
+static VkResult render_graph_create_images(RenderGraph *graph, MemoryAllocator *allocator) {
+    VkDevice device = allocator->device;
+
+    // Find the range of passes that use each image. Unused images get all passes, so they never
+    // share memory with anything.
+
+    uint32_t first_passes[RENDER_GRAPH_MAX_RESOURCES];
+    uint32_t last_passes[RENDER_GRAPH_MAX_RESOURCES];
+
+    for (uint32_t i = 0; i < graph->image_count; i++) {
+        first_passes[i] = UINT32_MAX;
+        last_passes[i] = 0;
+    }
+
+    for (uint32_t i = 0; i < graph->pass_count; i++) {
+        for (uint32_t j = 0; j < graph->passes[i].access_count; j++) {
+            const uint32_t resource = graph->passes[i].accesses[j].resource;
+
+            if (resource < graph->image_count) {
+                first_passes[resource] = first_passes[resource] < i ? first_passes[resource] : i;
+                last_passes[resource] = i;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < graph->image_count; i++) {
+        if (first_passes[i] == UINT32_MAX) {
+            first_passes[i] = 0;
+            last_passes[i] = graph->pass_count;
+        }
+    }
+
+    // Create the images, and give the ones only used as attachments lazily allocated memory. Most
+    // desktop GPUs have none, they then share memory with the rest.
+
+    VkMemoryRequirements memory_requirements[RENDER_GRAPH_MAX_RESOURCES];
+    uint32_t shared_images[RENDER_GRAPH_MAX_RESOURCES];
+    uint32_t shared_image_count = 0;
+    uint32_t shared_memory_type_bits = UINT32_MAX;
+
+    for (uint32_t i = 0; i < graph->image_count; i++) {
+        RenderGraphResource *resource = &graph->resources[i];
+        const bool transient = (resource->usage & ~(VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT)) == 0;
+
+        const VkImageCreateInfo image_create_info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = resource->format,
+            .extent = {
+                .width = resource->extent.width,
+                .height = resource->extent.height,
+                .depth = 1,
+            },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = resource->samples,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = transient ? resource->usage | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : resource->usage,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .queueFamilyIndexCount = 0,
+            .pQueueFamilyIndices = NULL,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        };
+
+        VkResult result = vkCreateImage(device, &image_create_info, NULL, &resource->image);
+
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+
+        vkGetImageMemoryRequirements(device, resource->image, &memory_requirements[i]);
+
+        if (transient) {
+            result = memory_allocate(allocator, &memory_requirements[i], VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &resource->allocation);
+
+            if (result == VK_SUCCESS) {
+                result = vkBindImageMemory(device, resource->image, resource->allocation.memory, resource->allocation.offset);
+
+                if (result != VK_SUCCESS) {
+                    return result;
+                }
+
+                continue;
+            } else if (result != VK_ERROR_FEATURE_NOT_PRESENT) {
+                return result;
+            }
+        }
+
+        shared_images[shared_image_count++] = i;
+        shared_memory_type_bits &= memory_requirements[i].memoryTypeBits;
+    }
+
+    // If the images have no memory type in common (no driver does that for these images), each
+    // gets its own memory.
+
+    if (shared_memory_type_bits == 0) {
+        for (uint32_t i = 0; i < shared_image_count; i++) {
+            RenderGraphResource *resource = &graph->resources[shared_images[i]];
+            VkResult result = memory_allocate(allocator, &memory_requirements[shared_images[i]], 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &resource->allocation);
+
+            if (result == VK_SUCCESS) {
+                result = vkBindImageMemory(device, resource->image, resource->allocation.memory, resource->allocation.offset);
+            }
+
+            if (result != VK_SUCCESS) {
+                return result;
+            }
+        }
+
+        shared_image_count = 0;
+    }
+
+    // Place the images in the shared memory, the largest ones first. Each goes at the lowest offset
+    // where it does not overlap an image that is used by an overlapping range of passes.
+
+    for (uint32_t i = 1; i < shared_image_count; i++) {
+        const uint32_t image = shared_images[i];
+        uint32_t j = i;
+
+        for (; j > 0 && memory_requirements[shared_images[j - 1]].size < memory_requirements[image].size; j--) {
+            shared_images[j] = shared_images[j - 1];
+        }
+
+        shared_images[j] = image;
+    }
+
+    VkMemoryRequirements shared_memory_requirements = {
+        .size = 0,
+        .alignment = 1,
+        .memoryTypeBits = shared_memory_type_bits,
+    };
+
+    for (uint32_t i = 0; i < shared_image_count; i++) {
+        const uint32_t image = shared_images[i];
+        const VkDeviceSize size = memory_requirements[image].size;
+        const VkDeviceSize alignment = memory_requirements[image].alignment;
+        VkDeviceSize offset = 0;
+
+        for (uint32_t j = 0; j < i;) {
+            const uint32_t other_image = shared_images[j];
+            const VkDeviceSize other_offset = graph->resources[other_image].memory_offset;
+            const VkDeviceSize other_end = other_offset + memory_requirements[other_image].size;
+            const bool used_together = first_passes[image] <= last_passes[other_image] && first_passes[other_image] <= last_passes[image];
+
+            if (used_together && offset < other_end && other_offset < offset + size) {
+                offset = (other_end + alignment - 1) / alignment * alignment;
+                j = 0;
+            } else {
+                j++;
+            }
+        }
+
+        graph->resources[image].memory_offset = offset;
+
+        if (offset + size > shared_memory_requirements.size) {
+            shared_memory_requirements.size = offset + size;
+        }
+
+        if (alignment > shared_memory_requirements.alignment) {
+            shared_memory_requirements.alignment = alignment;
+        }
+    }
+
+    // The first use of an image that shares memory with images used before waits for their last
+    // uses.
+
+    for (uint32_t i = 0; i < shared_image_count; i++) {
+        RenderGraphResource *resource = &graph->resources[shared_images[i]];
+        const VkDeviceSize end = resource->memory_offset + memory_requirements[shared_images[i]].size;
+
+        for (uint32_t j = 0; j < shared_image_count; j++) {
+            const RenderGraphResource *other_resource = &graph->resources[shared_images[j]];
+            const VkDeviceSize other_end = other_resource->memory_offset + memory_requirements[shared_images[j]].size;
+
+            if (last_passes[shared_images[j]] < first_passes[shared_images[i]] && resource->memory_offset < other_end && other_resource->memory_offset < end) {
+                resource->aliased_resources |= 1u << shared_images[j];
+            }
+        }
+    }
+
+    if (shared_image_count > 0) {
+        VkResult result = memory_allocate(allocator, &shared_memory_requirements, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &graph->memory);
+
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+
+        for (uint32_t i = 0; i < shared_image_count; i++) {
+            const RenderGraphResource *resource = &graph->resources[shared_images[i]];
+            result = vkBindImageMemory(device, resource->image, graph->memory.memory, graph->memory.offset + resource->memory_offset);
+
+            if (result != VK_SUCCESS) {
+                return result;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < graph->image_count; i++) {
+        const VkResult result = render_graph_create_image_view(device, &graph->resources[i]);
+
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+    }
+
+    graph->images_created = true;
+    return VK_SUCCESS;
+}
+
+// Records the barrier before a pass. The passes have to be recorded in the order they were added.
+
+static void render_graph_record_barrier(RenderGraph *graph, VkCommandBuffer command_buffer, uint32_t pass) {
+    const RenderGraphPass *graph_pass = &graph->passes[pass];
+
+    VkPipelineStageFlags src_stage_mask = 0;
+    VkPipelineStageFlags dst_stage_mask = 0;
+
+    VkMemoryBarrier memory_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = 0,
+        .dstAccessMask = 0,
+    };
+
+    bool memory_barrier_needed = false;
+    VkImageMemoryBarrier image_memory_barriers[RENDER_GRAPH_MAX_PASS_ACCESSES];
+    uint32_t image_memory_barrier_count = 0;
+
+    for (uint32_t i = 0; i < graph_pass->access_count; i++) {
+        const RenderGraphAccess *access = &graph_pass->accesses[i];
+        RenderGraphResource *resource = &graph->resources[access->resource];
+
+        // Accesses on another queue were waited for with a semaphore. Only buffers change queues,
+        // but the layout is kept regardless, resetting it would discard the contents of an image.
+
+        if (resource->queue != graph_pass->queue) {
+            const VkImageLayout layout = resource->layout;
+
+            render_graph_reset_state(resource, 0);
+            resource->accessed = true;
+            resource->queue = graph_pass->queue;
+            resource->layout = layout;
+        }
+
+        // A layout transition writes the image, a write waits for all earlier accesses and a read
+        // for the last write, unless it was made visible to the read before.
+
+        const bool transition = resource->image != VK_NULL_HANDLE && access->layout != resource->layout;
+        const bool write = transition || (access->access_mask & render_graph_write_access_mask) != 0;
+
+        VkPipelineStageFlags wait_stage_mask = 0;
+        VkAccessFlags wait_access_mask = 0;
+
+        if (write) {
+            wait_stage_mask = resource->write_stage_mask | resource->read_stage_mask;
+            wait_access_mask = resource->write_access_mask;
+        } else if ((access->stage_mask & ~resource->visible_stage_mask) != 0 || (access->access_mask & ~resource->visible_access_mask) != 0) {
+            wait_stage_mask = resource->write_stage_mask;
+            wait_access_mask = resource->write_access_mask;
+        }
+
+        // Memory shared with images used before is only reused once they are done with it.
+
+        if (!resource->accessed) {
+            for (uint32_t j = 0; j < graph->image_count; j++) {
+                if ((resource->aliased_resources & 1u << j) != 0) {
+                    wait_stage_mask |= graph->resources[j].write_stage_mask | graph->resources[j].read_stage_mask;
+                    wait_access_mask |= graph->resources[j].write_access_mask;
+                }
+            }
+        }
+
+        if (wait_stage_mask != 0 || transition) {
+            src_stage_mask |= wait_stage_mask;
+            dst_stage_mask |= access->stage_mask;
+
+            if (resource->image != VK_NULL_HANDLE) {
+                image_memory_barriers[image_memory_barrier_count++] = (VkImageMemoryBarrier) {
+                    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                    .pNext = NULL,
+                    .srcAccessMask = wait_access_mask,
+                    .dstAccessMask = access->access_mask,
+                    .oldLayout = resource->layout,
+                    .newLayout = access->layout,
+                    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                    .image = resource->image,
+                    .subresourceRange = {
+                        .aspectMask = resource->aspect_mask,
+                        .baseMipLevel = 0,
+                        .levelCount = 1,
+                        .baseArrayLayer = 0,
+                        .layerCount = 1,
+                    },
+                };
+            } else {
+                memory_barrier.srcAccessMask |= wait_access_mask;
+                memory_barrier.dstAccessMask |= access->access_mask;
+                memory_barrier_needed = true;
+            }
+        }
+
+        // A write starts over, a transition without a write is visible to the access that needed
+        // it.
+
+        if (write) {
+            const VkAccessFlags write_access_mask = access->access_mask & render_graph_write_access_mask;
+
+            resource->write_stage_mask = access->stage_mask;
+            resource->write_access_mask = write_access_mask;
+            resource->read_stage_mask = 0;
+            resource->visible_stage_mask = write_access_mask == 0 ? access->stage_mask : 0;
+            resource->visible_access_mask = write_access_mask == 0 ? access->access_mask : 0;
+        } else {
+            resource->read_stage_mask |= access->stage_mask;
+
+            if (wait_stage_mask != 0) {
+                resource->visible_stage_mask |= access->stage_mask;
+                resource->visible_access_mask |= access->access_mask;
+            }
+        }
+
+        if (resource->image != VK_NULL_HANDLE) {
+            resource->layout = access->layout;
+        }
+
+        resource->accessed = true;
+    }
+
+    if (dst_stage_mask != 0) {
+        vkCmdPipelineBarrier(command_buffer, src_stage_mask != 0 ? src_stage_mask : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dst_stage_mask, 0, memory_barrier_needed ? 1 : 0, &memory_barrier, 0, NULL, image_memory_barrier_count, image_memory_barriers);
+    }
+}
+
+static void render_graph_destroy(MemoryAllocator *allocator, RenderGraph *graph) {
+    for (uint32_t i = 0; i < graph->image_count; i++) {
+        vkDestroyImageView(allocator->device, graph->resources[i].view, NULL);
+        vkDestroyImage(allocator->device, graph->resources[i].image, NULL);
+
+        if (graph->resources[i].allocation.memory != VK_NULL_HANDLE) {
+            memory_free(allocator, &graph->resources[i].allocation);
+        }
+    }
+
+    if (graph->memory.memory != VK_NULL_HANDLE) {
+        memory_free(allocator, &graph->memory);
+    }
+
+    *graph = (RenderGraph) { 0 };
+}
+
+// The resources owned by a single frame in flight. A frame context is only reused once the frame
+// timeline semaphore shows that the GPU has finished the frame that used it before, so everything
+// in it can be reset or overwritten without further checks.
+// The scene is rendered into the frame's own scene image and then scaled onto the output image.
+// Post-processing passes alternate between the scene image and the post image, bloom also goes
+// through a half resolution image. These images and the attachments are resources of the frame's
+// render graph, which creates them (and the framebuffer and descriptor sets pointing at them) once
+// the context is reused after they were recreated, since the old ones may still be in use.
+// Every frame culls into its own buffers, so with async compute the culling of a frame runs while
+// the previous frame is still drawing.
+
+typedef struct FrameContext {
+    VkSemaphore image_available_semaphore;
+    CommandBufferPool command_buffer_pool;
+    CommandBufferPool *secondary_command_buffer_pools;
+    CommandBufferPool compute_command_buffer_pool;
+    VkQueryPool timestamp_query_pool;
+    bool timestamps_written;
+    RenderGraph render_graph;
+    uint32_t scene_image;
+    uint32_t color_attachment;
+    uint32_t depth_attachment;
+    uint32_t post_image;
+    uint32_t bloom_image;
+    VkFramebuffer scene_framebuffer;
+    VkDescriptorSet post_descriptor_sets[2];
+    LinearArena transient_arena;
+    VkBuffer visible_instance_buffer;
+    MemoryAllocation visible_instance_buffer_allocation;
+    VkBuffer draw_command_buffer;
+    MemoryAllocation draw_command_buffer_allocation;
+    VkDescriptorSet cull_descriptor_set;
+} FrameContext;
+
+// A vertex as laid out in the vertex buffer. The attributes are interleaved, so a vertex is read
+// from a single cache line.
+
+typedef struct Vertex {
+    float position[2];
+    float color[3];
+} Vertex;
+
+// The per-instance data, read from a second vertex buffer that advances once per instance. It is
+// also read and written by the culling shader, so it is laid out like the std430 struct there
+// (which is padded to a multiple of the 8-byte alignment of its vec2).
+
+typedef struct Instance {
+    float offset[2];
+    float scale;
+    float phase;
+    float depth;
+    float padding;
+} Instance;
+
+// Orders instances front to back, so the nearest ones are drawn first and early depth testing
+// rejects the fragments of everything behind them. This is where a scene with a camera would sort
+// by view space depth.
+
+static int instance_compare_depth(const void *a, const void *b) {
+    const float a_depth = ((const Instance *)a)->depth;
+    const float b_depth = ((const Instance *)b)->depth;
+    return (a_depth > b_depth) - (a_depth < b_depth);
+}
+
+// The layout of the vertex buffers a pipeline reads. Binding `i` of the layout is vertex buffer
+// binding `i`, and attribute `i` is the vertex shader input at location `i`.
+
+#define MAX_VERTEX_BINDINGS 4
+#define MAX_VERTEX_ATTRIBUTES 16
+
+typedef struct VertexBinding {
+    uint32_t stride;
+    VkVertexInputRate input_rate;
+} VertexBinding;
+
+typedef struct VertexAttribute {
+    uint32_t binding;
+    VkFormat format;
+    uint32_t offset;
+} VertexAttribute;
+
+typedef struct VertexLayout {
+    const VertexBinding *bindings;
+    uint32_t binding_count;
+    const VertexAttribute *attributes;
+    uint32_t attribute_count;
+} VertexLayout;
+
+static const VertexBinding mesh_vertex_bindings[] = {
+    {
+        .stride = sizeof(Vertex),
+        .input_rate = VK_VERTEX_INPUT_RATE_VERTEX,
+    },
+    {
+        .stride = sizeof(Instance),
+        .input_rate = VK_VERTEX_INPUT_RATE_INSTANCE,
+    },
+};
+
+static const VertexAttribute mesh_vertex_attributes[] = {
+    {
+        .binding = 0,
+        .format = VK_FORMAT_R32G32_SFLOAT,
+        .offset = offsetof(Vertex, position),
+    },
+    {
+        .binding = 0,
+        .format = VK_FORMAT_R32G32B32_SFLOAT,
+        .offset = offsetof(Vertex, color),
+    },
+    {
+        .binding = 1,
+        .format = VK_FORMAT_R32G32_SFLOAT,
+        .offset = offsetof(Instance, offset),
+    },
+    {
+        .binding = 1,
+        .format = VK_FORMAT_R32_SFLOAT,
+        .offset = offsetof(Instance, scale),
+    },
+    {
+        .binding = 1,
+        .format = VK_FORMAT_R32_SFLOAT,
+        .offset = offsetof(Instance, phase),
+    },
+    {
+        .binding = 1,
+        .format = VK_FORMAT_R32_SFLOAT,
+        .offset = offsetof(Instance, depth),
+    },
+};
+
+static const VertexLayout mesh_vertex_layout = {
+    .bindings = mesh_vertex_bindings,
+    .binding_count = sizeof mesh_vertex_bindings / sizeof *mesh_vertex_bindings,
+    .attributes = mesh_vertex_attributes,
+    .attribute_count = sizeof mesh_vertex_attributes / sizeof *mesh_vertex_attributes,
+};
+
+// The vertex input state of a pipeline, generated from a vertex layout. The create info points
+// into the struct itself, so it must not be copied.
+
+typedef struct VertexInputState {
+    VkVertexInputBindingDescription binding_descriptions[MAX_VERTEX_BINDINGS];
+    VkVertexInputAttributeDescription attribute_descriptions[MAX_VERTEX_ATTRIBUTES];
+    VkPipelineVertexInputStateCreateInfo create_info;
+} VertexInputState;
+
+static bool vertex_input_state_init(VertexInputState *state, const VertexLayout *layout) {
+    if (layout->binding_count > MAX_VERTEX_BINDINGS || layout->attribute_count > MAX_VERTEX_ATTRIBUTES) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < layout->binding_count; i++) {
+        state->binding_descriptions[i] = (VkVertexInputBindingDescription) {
+            .binding = i,
+            .stride = layout->bindings[i].stride,
+            .inputRate = layout->bindings[i].input_rate,
+        };
+    }
+
+    for (uint32_t i = 0; i < layout->attribute_count; i++) {
+        if (layout->attributes[i].binding >= layout->binding_count) {
+            return false;
+        }
+
+        state->attribute_descriptions[i] = (VkVertexInputAttributeDescription) {
+            .location = i,
+            .binding = layout->attributes[i].binding,
+            .format = layout->attributes[i].format,
+            .offset = layout->attributes[i].offset,
+        };
+    }
+
+    state->create_info = (VkPipelineVertexInputStateCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .vertexBindingDescriptionCount = layout->binding_count,
+        .pVertexBindingDescriptions = state->binding_descriptions,
+        .vertexAttributeDescriptionCount = layout->attribute_count,
+        .pVertexAttributeDescriptions = state->attribute_descriptions,
+    };
+
+    return true;
+}
+
+// Creates a buffer in device local memory, which is filled through the upload context. With more
+// than one queue family, the buffer is shared by them (concurrent sharing).
+
+static VkResult device_buffer_create(MemoryAllocator *allocator, VkDeviceSize size, VkBufferUsageFlags usage, uint32_t queue_family_index_count, const uint32_t *queue_family_indices, VkBuffer *buffer, MemoryAllocation *allocation) {
+    const VkBufferCreateInfo buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .size = size,
+        .usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = queue_family_index_count > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = queue_family_index_count > 1 ? queue_family_index_count : 0,
+        .pQueueFamilyIndices = queue_family_index_count > 1 ? queue_family_indices : NULL,
+    };
+
+    VkResult result = vkCreateBuffer(allocator->device, &buffer_create_info, NULL, buffer);
+
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkMemoryRequirements memory_requirements;
+    vkGetBufferMemoryRequirements(allocator->device, *buffer, &memory_requirements);
+
+    result = memory_allocate(allocator, &memory_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, allocation);
+
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    return vkBindBufferMemory(allocator->device, *buffer, allocation->memory, allocation->offset);
+}
+
+// An indexed mesh in device local memory. Meshes with up to 65536 vertices use 16-bit indices,
+// which halves the index bandwidth, larger ones 32-bit indices.
+
+typedef struct Mesh {
+    VkBuffer vertex_buffer;
+    MemoryAllocation vertex_buffer_allocation;
+    VkBuffer index_buffer;
+    MemoryAllocation index_buffer_allocation;
+    VkIndexType index_type;
+    uint32_t index_count;
+    float squared_bounding_radius;
+    uint32_t material_index;
+    uint64_t upload;
+} Mesh;
+
+static VkIndexType mesh_index_type(uint32_t vertex_count) {
+    return vertex_count <= 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+}
+
+// Creates a mesh and queues the upload of its data, which has to stay valid until the upload is
+// ready. The indices have to be of the type returned by `mesh_index_type`.
+
+static VkResult mesh_create(Mesh *mesh, MemoryAllocator *allocator, UploadContext *upload, const Vertex *vertices, uint32_t vertex_count, const void *indices, uint32_t index_count) {
+    *mesh = (Mesh) { 0 };
+    mesh->index_type = mesh_index_type(vertex_count);
+    mesh->index_count = index_count;
+
+    // The mesh is culled with a bounding circle around its origin (the radius is squared, the
+    // culling shader takes the root).
+
+    for (uint32_t i = 0; i < vertex_count; i++) {
+        const float squared_distance = vertices[i].position[0] * vertices[i].position[0] + vertices[i].position[1] * vertices[i].position[1];
+
+        if (squared_distance > mesh->squared_bounding_radius) {
+            mesh->squared_bounding_radius = squared_distance;
+        }
+    }
+
+    const VkDeviceSize vertex_buffer_size = (VkDeviceSize)vertex_count * sizeof *vertices;
+    const VkDeviceSize index_buffer_size = (VkDeviceSize)index_count * (mesh->index_type == VK_INDEX_TYPE_UINT16 ? 2 : 4);
+
+    VkResult result = device_buffer_create(allocator, vertex_buffer_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 0, NULL, &mesh->vertex_buffer, &mesh->vertex_buffer_allocation);
+
+    if (result == VK_SUCCESS) {
+        result = device_buffer_create(allocator, index_buffer_size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, 0, NULL, &mesh->index_buffer, &mesh->index_buffer_allocation);
+    }
+
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    if (!upload_buffer(upload, mesh->vertex_buffer, 0, vertices, vertex_buffer_size, VK_SHARING_MODE_EXCLUSIVE, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, &mesh->upload)
+        || !upload_buffer(upload, mesh->index_buffer, 0, indices, index_buffer_size, VK_SHARING_MODE_EXCLUSIVE, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT, &mesh->upload)) {
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+
+    return VK_SUCCESS;
+}
+
+static void mesh_destroy(Mesh *mesh, MemoryAllocator *allocator) {
+    vkDestroyBuffer(allocator->device, mesh->index_buffer, NULL);
+    vkDestroyBuffer(allocator->device, mesh->vertex_buffer, NULL);
+
+    if (mesh->index_buffer_allocation.memory != VK_NULL_HANDLE) {
+        memory_free(allocator, &mesh->index_buffer_allocation);
+    }
+
+    if (mesh->vertex_buffer_allocation.memory != VK_NULL_HANDLE) {
+        memory_free(allocator, &mesh->vertex_buffer_allocation);
+    }
+}
+
+// A global descriptor set with one large array of storage buffers and one of sampled images, bound
+// once per command buffer. Shaders refer to a resource by its index in the array, so switching
+// materials needs no descriptor set changes, and registering a resource needs no new pipeline.
+// The set is updated after bind, so resources can be added while frames using it are in flight.
+// Indices are never reused.
+
+#define BINDLESS_STORAGE_BUFFER_BINDING 0
+#define BINDLESS_SAMPLED_IMAGE_BINDING 1
+
+typedef struct BindlessHeap {
+    VkDevice device;
+    VkDescriptorSetLayout descriptor_set_layout;
+    VkDescriptorPool descriptor_pool;
+    VkDescriptorSet descriptor_set;
+    uint32_t storage_buffer_capacity;
+    uint32_t storage_buffer_count;
+    uint32_t sampled_image_capacity;
+    uint32_t sampled_image_count;
+} BindlessHeap;
+
+static VkResult bindless_heap_create(BindlessHeap *heap, VkDevice device, uint32_t storage_buffer_capacity, uint32_t sampled_image_capacity) {
+    *heap = (BindlessHeap) { 0 };
+    heap->device = device;
+    heap->storage_buffer_capacity = storage_buffer_capacity;
+    heap->sampled_image_capacity = sampled_image_capacity;
+
+    const VkShaderStageFlags stage_flags = VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_COMPUTE_BIT;
+
+    const VkDescriptorSetLayoutBinding descriptor_set_layout_bindings[] = {
+        {
+            .binding = BINDLESS_STORAGE_BUFFER_BINDING,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = storage_buffer_capacity,
+            .stageFlags = stage_flags,
+            .pImmutableSamplers = NULL,
+        },
+        {
+            .binding = BINDLESS_SAMPLED_IMAGE_BINDING,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = sampled_image_capacity,
+            .stageFlags = stage_flags,
+            .pImmutableSamplers = NULL,
+        },
+    };
+
+    // Unused elements are left unwritten, which is only valid for partially bound bindings.
+
+    const VkDescriptorBindingFlags descriptor_binding_flags[] = {
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT,
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT,
+    };
+
+    const VkDescriptorSetLayoutBindingFlagsCreateInfo descriptor_set_layout_binding_flags_create_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+        .pNext = NULL,
+        .bindingCount = 2,
+        .pBindingFlags = descriptor_binding_flags,
+    };
+
+    const VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = &descriptor_set_layout_binding_flags_create_info,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+        .bindingCount = 2,
+        .pBindings = descriptor_set_layout_bindings,
+    };
+
+    VkResult result = vkCreateDescriptorSetLayout(device, &descriptor_set_layout_create_info, NULL, &heap->descriptor_set_layout);
+
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    const VkDescriptorPoolSize descriptor_pool_sizes[] = {
+        {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = storage_buffer_capacity,
+        },
+        {
+            .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = sampled_image_capacity,
+        },
+    };
+
+    const VkDescriptorPoolCreateInfo descriptor_pool_create_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+        .maxSets = 1,
+        .poolSizeCount = 2,
+        .pPoolSizes = descriptor_pool_sizes,
+    };
+
+    result = vkCreateDescriptorPool(device, &descriptor_pool_create_info, NULL, &heap->descriptor_pool);
+
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+
+    const VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .pNext = NULL,
+        .descriptorPool = heap->descriptor_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &heap->descriptor_set_layout,
+    };
+
+    return vkAllocateDescriptorSets(device, &descriptor_set_allocate_info, &heap->descriptor_set);
+}
+
+// Registers a storage buffer and returns its index in the storage buffer array, or false if the
+// array is full.
+
+static bool bindless_heap_add_storage_buffer(BindlessHeap *heap, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range, uint32_t *index) {
+    if (heap->storage_buffer_count == heap->storage_buffer_capacity) {
+        return false;
+    }
+
+    *index = heap->storage_buffer_count++;
+
+    const VkDescriptorBufferInfo descriptor_buffer_info = {
+        .buffer = buffer,
+        .offset = offset,
+        .range = range,
+    };
+
+    const VkWriteDescriptorSet write_descriptor_set = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .pNext = NULL,
+        .dstSet = heap->descriptor_set,
+        .dstBinding = BINDLESS_STORAGE_BUFFER_BINDING,
+        .dstArrayElement = *index,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .pImageInfo = NULL,
+        .pBufferInfo = &descriptor_buffer_info,
+        .pTexelBufferView = NULL,
+    };
+
+    vkUpdateDescriptorSets(heap->device, 1, &write_descriptor_set, 0, NULL);
+    return true;
+}
+
+// Registers an image view in the shader read only layout, sampled with the given sampler, and
+// returns its index in the sampled image array, or false if the array is full.
+
+static bool bindless_heap_add_sampled_image(BindlessHeap *heap, VkImageView image_view, VkSampler sampler, uint32_t *index) {
+    if (heap->sampled_image_count == heap->sampled_image_capacity) {
+        return false;
+    }
+
+    *index = heap->sampled_image_count++;
+
+    const VkDescriptorImageInfo descriptor_image_info = {
+        .sampler = sampler,
+        .imageView = image_view,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+
+    const VkWriteDescriptorSet write_descriptor_set = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .pNext = NULL,
+        .dstSet = heap->descriptor_set,
+        .dstBinding = BINDLESS_SAMPLED_IMAGE_BINDING,
+        .dstArrayElement = *index,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &descriptor_image_info,
+        .pBufferInfo = NULL,
+        .pTexelBufferView = NULL,
+    };
+
+    vkUpdateDescriptorSets(heap->device, 1, &write_descriptor_set, 0, NULL);
+    return true;
+}
+
+static void bindless_heap_destroy(BindlessHeap *heap) {
+    vkDestroyDescriptorPool(heap->device, heap->descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(heap->device, heap->descriptor_set_layout, NULL);
+}
+
+// The width and height of the checkerboard texture the triangles are drawn with.
+
+#define TEXTURE_SIZE 64
+
+// A material as laid out in the material buffer (matching the std430 struct of the fragment
+// shader). The texture is an index into the sampled image array of the bindless heap.
+
+typedef struct Material {
+    float color[4];
+    uint32_t texture_index;
+    uint32_t padding[3];
+} Material;
+
+// The per-draw data pushed to the shaders (laid out like the push constant block of the shaders).
+// The material buffer is an index into the storage buffer array of the bindless heap.
+
+typedef struct PushConstants {
+    float time;
+    float aspect_ratio;
+    uint32_t material_buffer_index;
+    uint32_t material_index;
+} PushConstants;
+
+// The parameters of the culling shader, written into the transient arena of every frame (laid out
+// like the std140 uniform block of the shader). The instances are culled in groups of `group_size`,
+// and the visible instances of each group are drawn by one indirect draw command. The same shader
+// then compacts the draws of the groups with visible instances and counts them, which is selected
+// with a push constant.
+
+typedef struct CullParameters {
+    float aspect_ratio;
+    float squared_bounding_radius;
+    uint32_t instance_count;
+    uint32_t group_size;
+    uint32_t index_count;
+    uint32_t use_first_instance;
+} CullParameters;
+
+typedef struct CullPushConstants {
+    uint32_t compact_draws;
+} CullPushConstants;
+
+// The push constants of the post-processing passes. The extent is that of the rendered part of the
+// scene image, the strength is configured per pass and the threshold only applies to bloom.
+
+typedef struct PostPushConstants {
+    uint32_t extent[2];
+    float strength;
+    float threshold;
+} PostPushConstants;
+
+// The shaders, compiled to SPIR-V at build time and embedded into the executable. When shader
+// reloading is enabled, the SPIR-V files of the same name in the working directory replace them
+// as they change.
+
+typedef enum ShaderFile {
+    SHADER_FILE_VERTEX,
+    SHADER_FILE_FRAGMENT,
+    SHADER_FILE_CULL,
+    SHADER_FILE_BLOOM_DOWNSAMPLE,
+    SHADER_FILE_BLOOM_UPSAMPLE,
+    SHADER_FILE_TONEMAP,
+    SHADER_FILE_SHARPEN,
+    SHADER_FILE_COUNT,
+} ShaderFile;
+
+static const char *const shader_file_names[SHADER_FILE_COUNT] = {
+    [SHADER_FILE_VERTEX] = "vertex.spv",
+    [SHADER_FILE_FRAGMENT] = "fragment.spv",
+    [SHADER_FILE_CULL] = "cull.spv",
+    [SHADER_FILE_BLOOM_DOWNSAMPLE] = "bloom_downsample.spv",
+    [SHADER_FILE_BLOOM_UPSAMPLE] = "bloom_upsample.spv",
+    [SHADER_FILE_TONEMAP] = "tonemap.spv",
+    [SHADER_FILE_SHARPEN] = "sharpen.spv",
+};
+
+static const uint32_t vertex_shader_code[] =
+#include "vertex.spv.inc"
+;
+
+static const uint32_t fragment_shader_code[] =
+#include "fragment.spv.inc"
+;
+
+static const uint32_t cull_shader_code[] =
+#include "cull.spv.inc"
+;
+
+static const uint32_t bloom_downsample_shader_code[] =
+#include "bloom_downsample.spv.inc"
+;
+
+static const uint32_t bloom_upsample_shader_code[] =
+#include "bloom_upsample.spv.inc"
+;
+
+static const uint32_t tonemap_shader_code[] =
+#include "tonemap.spv.inc"
+;
+
+static const uint32_t sharpen_shader_code[] =
+#include "sharpen.spv.inc"
+;
+
+static const uint32_t *const shader_codes[SHADER_FILE_COUNT] = {
+    [SHADER_FILE_VERTEX] = vertex_shader_code,
+    [SHADER_FILE_FRAGMENT] = fragment_shader_code,
+    [SHADER_FILE_CULL] = cull_shader_code,
+    [SHADER_FILE_BLOOM_DOWNSAMPLE] = bloom_downsample_shader_code,
+    [SHADER_FILE_BLOOM_UPSAMPLE] = bloom_upsample_shader_code,
+    [SHADER_FILE_TONEMAP] = tonemap_shader_code,
+    [SHADER_FILE_SHARPEN] = sharpen_shader_code,
+};
+
+static const size_t shader_code_sizes[SHADER_FILE_COUNT] = {
+    [SHADER_FILE_VERTEX] = sizeof vertex_shader_code,
+    [SHADER_FILE_FRAGMENT] = sizeof fragment_shader_code,
+    [SHADER_FILE_CULL] = sizeof cull_shader_code,
+    [SHADER_FILE_BLOOM_DOWNSAMPLE] = sizeof bloom_downsample_shader_code,
+    [SHADER_FILE_BLOOM_UPSAMPLE] = sizeof bloom_upsample_shader_code,
+    [SHADER_FILE_TONEMAP] = sizeof tonemap_shader_code,
+    [SHADER_FILE_SHARPEN] = sizeof sharpen_shader_code,
+};
+
+// Shader modules by their SPIR-V code. Loading a file whose contents are already known returns the
+// existing module, so saving a shader without changes does not rebuild anything. Entries are found
+// by the hash of the code, and the code itself is kept to compare against, so a hash collision
+// never returns the wrong module. Modules that are no longer used are evicted (see
+// shader_cache_evict).
+
+typedef struct ShaderCacheEntry {
+    uint64_t hash;
+    size_t code_size;
+    uint32_t *code;
+    VkShaderModule module;
+} ShaderCacheEntry;
+
+typedef struct ShaderCache {
+    VkDevice device;
+    ShaderCacheEntry *entries;
+    uint32_t entry_count;
+    uint32_t entry_capacity;
+} ShaderCache;
+
+typedef enum ShaderLoadResult {
+    SHADER_LOAD_SUCCESS,
+    SHADER_LOAD_ERROR_IO,
+    SHADER_LOAD_ERROR_INVALID_SPIRV,
+    SHADER_LOAD_ERROR_VULKAN,
+    SHADER_LOAD_ERROR_OUT_OF_MEMORY,
+} ShaderLoadResult;
+
+static const char *const shader_load_result_descriptions[] = {
+    [SHADER_LOAD_SUCCESS] = "success",
+    [SHADER_LOAD_ERROR_IO] = "the file can not be read",
+    [SHADER_LOAD_ERROR_INVALID_SPIRV] = "the file is not SPIR-V",
+    [SHADER_LOAD_ERROR_VULKAN] = "the shader module can not be created",
+    [SHADER_LOAD_ERROR_OUT_OF_MEMORY] = "the shader cache can not be allocated",
+};
+
+// Returns the shader module for the given SPIR-V code, creating it if the code is new.
+
+static ShaderLoadResult shader_cache_get(ShaderCache *cache, const uint32_t *code, size_t code_size, VkShaderModule *module) {
+    // SPIR-V is a stream of 32-bit words that starts with the magic number.
+
+    if (code_size < 4 || code_size % 4 != 0 || code[0] != 0x07230203) {
+        return SHADER_LOAD_ERROR_INVALID_SPIRV;
+    }
+
+    // FNV-1a over the words.
+
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < code_size / 4; i++) {
+        hash = (hash ^ code[i]) * 1099511628211ull;
+    }
+
+    for (uint32_t i = 0; i < cache->entry_count; i++) {
+        const ShaderCacheEntry *entry = &cache->entries[i];
+
+        if (entry->hash == hash && entry->code_size == code_size && memcmp(entry->code, code, code_size) == 0) {
+            *module = entry->module;
+            return SHADER_LOAD_SUCCESS;
+        }
+    }
+
+    if (cache->entry_count == cache->entry_capacity) {
+        const uint32_t entry_capacity = cache->entry_capacity == 0 ? 8 : cache->entry_capacity * 2;
+        ShaderCacheEntry *entries = realloc(cache->entries, entry_capacity * sizeof *entries);
+
+        if (entries == NULL) {
+            return SHADER_LOAD_ERROR_OUT_OF_MEMORY;
+        }
+
+        cache->entries = entries;
+        cache->entry_capacity = entry_capacity;
+    }
+
+    // The code may be unmapped once the module exists, so the entry keeps a copy.
+
+    uint32_t *code_copy = malloc(code_size);
+
+    if (code_copy == NULL) {
+        return SHADER_LOAD_ERROR_OUT_OF_MEMORY;
+    }
+
+    memcpy(code_copy, code, code_size);
+
+    const VkShaderModuleCreateInfo shader_module_create_info = {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .codeSize = code_size,
+        .pCode = code,
+    };
+
+    if (vkCreateShaderModule(cache->device, &shader_module_create_info, NULL, module) != VK_SUCCESS) {
+        free(code_copy);
+        return SHADER_LOAD_ERROR_VULKAN;
+    }
+
+    cache->entries[cache->entry_count++] = (ShaderCacheEntry) {
+        .hash = hash,
+        .code_size = code_size,
+        .code = code_copy,
+        .module = *module,
+    };
+
+    return SHADER_LOAD_SUCCESS;
+}
+
+// Loads a SPIR-V file into a shader module. The file is mapped and handed to Vulkan directly,
+// without copying it. Mappings start at a page boundary, so the code is 4-byte aligned.
+
+static ShaderLoadResult shader_cache_load(ShaderCache *cache, const char *path, VkShaderModule *module) {
+    const int file = open(path, O_RDONLY);
+
+    if (file < 0) {
+        return SHADER_LOAD_ERROR_IO;
+    }
+
+    struct stat file_status;
+
+    if (fstat(file, &file_status) != 0) {
+        close(file);
+        return SHADER_LOAD_ERROR_IO;
+    }
+
+    const size_t code_size = (size_t)file_status.st_size;
+
+    if (code_size == 0) {
+        close(file);
+        return SHADER_LOAD_ERROR_INVALID_SPIRV;
+    }
+
+    void *code = mmap(NULL, code_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+
+    if (code == MAP_FAILED) {
+        return SHADER_LOAD_ERROR_IO;
+    }
+
+    const ShaderLoadResult result = shader_cache_get(cache, code, code_size, module);
+    munmap(code, code_size);
+    return result;
+}
+
+static void shader_cache_destroy(ShaderCache *cache) {
+    for (uint32_t i = 0; i < cache->entry_count; i++) {
+        vkDestroyShaderModule(cache->device, cache->entries[i].module, NULL);
+        free(cache->entries[i].code);
+    }
+
+    free(cache->entries);
+}
+
+// Watches the working directory for SPIR-V files that are written or moved into place (compilers
+// write in place, editors usually rename). Only supported on Linux, through inotify.
+
+typedef struct ShaderWatcher {
+    int file;
+} ShaderWatcher;
+
+static bool shader_watcher_create(ShaderWatcher *watcher) {
+#ifdef __linux__
+    watcher->file = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (watcher->file < 0) {
+        return false;
+    }
+
+    if (inotify_add_watch(watcher->file, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(watcher->file);
+        watcher->file = -1;
+        return false;
+    }
+
+    return true;
+#else
+    watcher->file = -1;
+    return false;
+#endif
+}
+
+// Returns the shader files that changed since the last poll, as a bit mask. Never blocks.
+
+static uint32_t shader_watcher_poll(ShaderWatcher *watcher) {
+    uint32_t changed_shader_files = 0;
+
+#ifdef __linux__
+    _Alignas(struct inotify_event) char events[4096];
+    ssize_t events_size;
+
+    while ((events_size = read(watcher->file, events, sizeof events)) > 0) {
+        for (ssize_t offset = 0; offset < events_size;) {
+            const struct inotify_event *event = (const struct inotify_event *)(events + offset);
+
+            for (uint32_t i = 0; i < SHADER_FILE_COUNT; i++) {
+                if (event->len > 0 && strcmp(event->name, shader_file_names[i]) == 0) {
+                    changed_shader_files |= 1u << i;
+                }
+            }
+
+            offset += sizeof *event + event->len;
+        }
+    }
+#endif
+
+    return changed_shader_files;
+}
+
+static void shader_watcher_destroy(ShaderWatcher *watcher) {
+    if (watcher->file >= 0) {
+        close(watcher->file);
+    }
+}
+
+// The pipelines that are built from shader files, and the state they are built from. Everything
+// but the shader modules stays the same when a pipeline is rebuilt.
+
+typedef enum PipelineKind {
+    PIPELINE_KIND_GRAPHICS,
+    PIPELINE_KIND_DEPTH_PREPASS,
+    PIPELINE_KIND_CULL,
+    PIPELINE_KIND_BLOOM_DOWNSAMPLE,
+    PIPELINE_KIND_BLOOM_UPSAMPLE,
+    PIPELINE_KIND_TONEMAP,
+    PIPELINE_KIND_SHARPEN,
+    PIPELINE_KIND_COUNT,
+} PipelineKind;
+
+static const uint32_t pipeline_kind_shader_files[PIPELINE_KIND_COUNT] = {
+    [PIPELINE_KIND_GRAPHICS] = 1u << SHADER_FILE_VERTEX | 1u << SHADER_FILE_FRAGMENT,
+    [PIPELINE_KIND_DEPTH_PREPASS] = 1u << SHADER_FILE_VERTEX,
+    [PIPELINE_KIND_CULL] = 1u << SHADER_FILE_CULL,
+    [PIPELINE_KIND_BLOOM_DOWNSAMPLE] = 1u << SHADER_FILE_BLOOM_DOWNSAMPLE,
+    [PIPELINE_KIND_BLOOM_UPSAMPLE] = 1u << SHADER_FILE_BLOOM_UPSAMPLE,
+    [PIPELINE_KIND_TONEMAP] = 1u << SHADER_FILE_TONEMAP,
+    [PIPELINE_KIND_SHARPEN] = 1u << SHADER_FILE_SHARPEN,
+};
+
+static const char *const pipeline_kind_names[PIPELINE_KIND_COUNT] = {
+    [PIPELINE_KIND_GRAPHICS] = "graphics",
+    [PIPELINE_KIND_DEPTH_PREPASS] = "depth pre-pass",
+    [PIPELINE_KIND_CULL] = "culling",
+    [PIPELINE_KIND_BLOOM_DOWNSAMPLE] = "bloom downsampling",
+    [PIPELINE_KIND_BLOOM_UPSAMPLE] = "bloom upsampling",
+    [PIPELINE_KIND_TONEMAP] = "tonemapping",
+    [PIPELINE_KIND_SHARPEN] = "sharpening",
+};
+
+// How the scene uses depth. With a pre-pass, a first subpass writes only depth, and the shading
+// subpass then tests for equal depth without writing, so every pixel is shaded exactly once.
+
+typedef enum DepthMode {
+    DEPTH_MODE_DISABLED,
+    DEPTH_MODE_ENABLED,
+    DEPTH_MODE_PREPASS,
+} DepthMode;
+
+typedef struct PipelineBuildInfo {
+    PipelineKind kind;
+    DepthMode depth_mode;
+    VkSampleCountFlagBits samples;
+    VkDevice device;
+    VkPipelineCache pipeline_cache;
+    VkPipelineLayout layout;
+    VkRenderPass render_pass;
+    uint32_t workgroup_size[2];
+    VkShaderModule shader_modules[SHADER_FILE_COUNT];
+} PipelineBuildInfo;
+
+// Creates the graphics pipeline or the depth pre-pass pipeline, which only runs the vertex shader
+// and writes no color.
+
+static VkResult graphics_pipeline_create(const PipelineBuildInfo *info, VkPipeline *pipeline) {
+    const bool depth_prepass = info->kind == PIPELINE_KIND_DEPTH_PREPASS;
+
+    // Configure the fixed function stages.
+
+    VertexInputState vertex_input_state;
+
+    if (!vertex_input_state_init(&vertex_input_state, &mesh_vertex_layout)) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    const VkPipelineInputAssemblyStateCreateInfo input_assembly_state_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+        .primitiveRestartEnable = VK_FALSE,
+    };
+
+    // The viewport and scissor are set while recording, so the pipeline does not depend on the
+    // swapchain extent and survives swapchain recreation.
+
+    const VkPipelineViewportStateCreateInfo viewport_state_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .viewportCount = 1,
+        .pViewports = NULL,
+        .scissorCount = 1,
+        .pScissors = NULL,
+    };
+
+    const VkPipelineRasterizationStateCreateInfo rasterization_state_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .depthClampEnable = VK_FALSE,
+        .rasterizerDiscardEnable = VK_FALSE,
+        .polygonMode = VK_POLYGON_MODE_FILL,
+        .cullMode = VK_CULL_MODE_BACK_BIT,
+        .frontFace = VK_FRONT_FACE_CLOCKWISE,
+        .depthBiasEnable = VK_FALSE,
+        .depthBiasConstantFactor = 0.0f,
+        .depthBiasClamp = 0.0f,
+        .depthBiasSlopeFactor = 0.0f,
+        .lineWidth = 1.0f,
+    };
+
+    const VkPipelineMultisampleStateCreateInfo multisample_state_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .rasterizationSamples = info->samples,
+        .sampleShadingEnable = VK_FALSE,
+        .minSampleShading = 1.0f,
+        .pSampleMask = NULL,
+        .alphaToCoverageEnable = VK_FALSE,
+        .alphaToOneEnable = VK_FALSE,
+    };
+
+    // With depth, the nearest fragment wins the depth test. After a pre-pass, the shading subpass
+    // only keeps the fragments at exactly the depth the pre-pass left, so every pixel is shaded once.
+
+    const VkPipelineDepthStencilStateCreateInfo depth_stencil_state_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .depthTestEnable = info->depth_mode != DEPTH_MODE_DISABLED ? VK_TRUE : VK_FALSE,
+        .depthWriteEnable = info->depth_mode == DEPTH_MODE_ENABLED || depth_prepass ? VK_TRUE : VK_FALSE,
+        .depthCompareOp = info->depth_mode == DEPTH_MODE_PREPASS && !depth_prepass ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS,
+        .depthBoundsTestEnable = VK_FALSE,
+        .stencilTestEnable = VK_FALSE,
+        .front = { 0 },
+        .back = { 0 },
+        .minDepthBounds = 0.0f,
+        .maxDepthBounds = 1.0f,
+    };
+
+    // The scene is opaque, so nothing is blended.
+
+    const VkPipelineColorBlendAttachmentState color_blend_attachment_state = {
+        .blendEnable = VK_FALSE,
+        .srcColorBlendFactor = VK_BLEND_FACTOR_ONE,
+        .dstColorBlendFactor = VK_BLEND_FACTOR_ZERO,
+        .colorBlendOp = VK_BLEND_OP_ADD,
+        .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+        .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+        .alphaBlendOp = VK_BLEND_OP_ADD,
+        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+    };
+
+    const VkPipelineColorBlendStateCreateInfo color_blend_state_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .logicOpEnable = VK_FALSE,
+        .logicOp = VK_LOGIC_OP_COPY,
+        .attachmentCount = depth_prepass ? 0 : 1,
+        .pAttachments = &color_blend_attachment_state,
+        .blendConstants[0] = 0.0f,
+        .blendConstants[1] = 0.0f,
+        .blendConstants[2] = 0.0f,
+        .blendConstants[3] = 0.0f,
+    };
+
+    const VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+    const VkPipelineDynamicStateCreateInfo dynamic_state_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .dynamicStateCount = sizeof dynamic_states / sizeof *dynamic_states,
+        .pDynamicStates = dynamic_states,
+    };
+
+    // Configure the shader stages.
+
+    const VkPipelineShaderStageCreateInfo vertex_shader_stage_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .stage = VK_SHADER_STAGE_VERTEX_BIT,
+        .module = info->shader_modules[SHADER_FILE_VERTEX],
+        .pName = "main",
+        .pSpecializationInfo = NULL,
+    };
+
+    const VkPipelineShaderStageCreateInfo fragment_shader_stage_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+        .module = info->shader_modules[SHADER_FILE_FRAGMENT],
+        .pName = "main",
+        .pSpecializationInfo = NULL,
+    };
+
+    VkPipelineShaderStageCreateInfo shader_stage_create_infos[] = {vertex_shader_stage_create_info, fragment_shader_stage_create_info};
+
+    // Create the graphics pipeline.
+
+    const VkGraphicsPipelineCreateInfo graphics_pipeline_create_info = {
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .stageCount = depth_prepass ? 1 : 2,
+        .pStages = shader_stage_create_infos,
+        .pVertexInputState = &vertex_input_state.create_info,
+        .pInputAssemblyState = &input_assembly_state_create_info,
+        .pTessellationState = NULL,
+        .pViewportState = &viewport_state_create_info,
+        .pRasterizationState = &rasterization_state_create_info,
+        .pMultisampleState = &multisample_state_create_info,
+        .pDepthStencilState = &depth_stencil_state_create_info,
+        .pColorBlendState = &color_blend_state_create_info,
+        .pDynamicState = &dynamic_state_create_info,
+        .layout = info->layout,
+        .renderPass = info->render_pass,
+        .subpass = info->depth_mode == DEPTH_MODE_PREPASS && !depth_prepass ? 1 : 0,
+        .basePipelineHandle = VK_NULL_HANDLE,
+        .basePipelineIndex = -1,
+    };
+
+    return vkCreateGraphicsPipelines(info->device, info->pipeline_cache, 1, &graphics_pipeline_create_info, NULL, pipeline);
+}
+
+// Creates a compute pipeline from the single shader of its kind. A workgroup size (zero for none)
+// is passed as the specialization constants 0 and 1, which the post-processing shaders use as
+// their local size, so it can be tuned without touching the shaders.
+
+static VkResult compute_pipeline_create(const PipelineBuildInfo *info, VkPipeline *pipeline) {
+    uint32_t shader_file = 0;
+
+    while ((pipeline_kind_shader_files[info->kind] & 1u << shader_file) == 0) {
+        shader_file++;
+    }
+
+    const VkSpecializationMapEntry specialization_map_entries[] = {
+        {
+            .constantID = 0,
+            .offset = 0,
+            .size = sizeof(uint32_t),
+        },
+        {
+            .constantID = 1,
+            .offset = sizeof(uint32_t),
+            .size = sizeof(uint32_t),
+        },
+    };
+
+    const VkSpecializationInfo specialization_info = {
+        .mapEntryCount = sizeof specialization_map_entries / sizeof *specialization_map_entries,
+        .pMapEntries = specialization_map_entries,
+        .dataSize = sizeof info->workgroup_size,
+        .pData = info->workgroup_size,
+    };
+
+    const VkComputePipelineCreateInfo compute_pipeline_create_info = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = info->shader_modules[shader_file],
+            .pName = "main",
+            .pSpecializationInfo = info->workgroup_size[0] > 0 ? &specialization_info : NULL,
+        },
+        .layout = info->layout,
+        .basePipelineHandle = VK_NULL_HANDLE,
+        .basePipelineIndex = -1,
+    };
+
+    return vkCreateComputePipelines(info->device, info->pipeline_cache, 1, &compute_pipeline_create_info, NULL, pipeline);
+}
+
+static VkResult pipeline_create(const PipelineBuildInfo *info, VkPipeline *pipeline) {
+    const bool graphics = info->kind == PIPELINE_KIND_GRAPHICS || info->kind == PIPELINE_KIND_DEPTH_PREPASS;
+    return graphics ? graphics_pipeline_create(info, pipeline) : compute_pipeline_create(info, pipeline);
+}
+
+// The key of a pipeline is everything it is built from. Only the shader modules of the stages the
+// pipeline kind actually uses are part of it.
+
+static uint64_t pipeline_key_hash(const PipelineBuildInfo *info) {
+    const uint64_t fields[] = {
+        (uint64_t)info->kind,
+        (uint64_t)info->depth_mode,
+        (uint64_t)info->samples,
+        (uint64_t)info->layout,
+        (uint64_t)info->render_pass,
+        (uint64_t)info->workgroup_size[0],
+        (uint64_t)info->workgroup_size[1],
+    };
+
+    uint64_t hash = 14695981039346656037ull;
+
+    for (uint32_t i = 0; i < sizeof fields / sizeof *fields; i++) {
+        hash = (hash ^ fields[i]) * 1099511628211ull;
+    }
+
+    for (uint32_t i = 0; i < SHADER_FILE_COUNT; i++) {
+        if ((pipeline_kind_shader_files[info->kind] & 1u << i) != 0) {
+            hash = (hash ^ (uint64_t)info->shader_modules[i]) * 1099511628211ull;
+        }
+    }
+
+    return hash;
+}
+
+static bool pipeline_key_equal(const PipelineBuildInfo *a, const PipelineBuildInfo *b) {
+    if (a->kind != b->kind || a->depth_mode != b->depth_mode || a->samples != b->samples || a->layout != b->layout || a->render_pass != b->render_pass
+        || a->workgroup_size[0] != b->workgroup_size[0] || a->workgroup_size[1] != b->workgroup_size[1]) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < SHADER_FILE_COUNT; i++) {
+        if ((pipeline_kind_shader_files[a->kind] & 1u << i) != 0 && a->shader_modules[i] != b->shader_modules[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Compiles pipelines on a pool of threads against the shared pipeline cache, so compiling never
+// holds up a frame. Every pipeline requested is kept in a map from its key until the compiler is
+// stopped, so switching back to an earlier state is free. Entries are compiled in the order they
+// were requested: the next entry to compile is simply the one after the last one taken. The map
+// is an open-addressing table of entry indices plus one, zero marks an empty slot.
+
+typedef enum PipelineStatus {
+    PIPELINE_STATUS_PENDING,
+    PIPELINE_STATUS_READY,
+    PIPELINE_STATUS_FAILED,
+} PipelineStatus;
+
+typedef struct PipelineEntry {
+    PipelineBuildInfo info;
+    uint64_t hash;
+    PipelineStatus status;
+    VkPipeline pipeline;
+    bool forgotten;
+} PipelineEntry;
+
+typedef struct PipelineCompiler {
+    pthread_mutex_t mutex;
+    pthread_cond_t entry_added_condition;
+    pthread_t *threads;
+    uint32_t thread_count;
+    bool stopping;
+    PipelineEntry *entries;
+    uint32_t entry_count;
+    uint32_t entry_capacity;
+    uint32_t next_entry_index;
+    uint32_t *slots;
+    uint32_t slot_count;
+} PipelineCompiler;
+
+static void *pipeline_compiler_main(void *argument) {
+    PipelineCompiler *compiler = argument;
+
+    pthread_mutex_lock(&compiler->mutex);
+
+    while (true) {
+        while (!compiler->stopping && compiler->next_entry_index == compiler->entry_count) {
+            pthread_cond_wait(&compiler->entry_added_condition, &compiler->mutex);
+        }
+
+        if (compiler->stopping) {
+            break;
+        }
+
+        // The entries may move while the lock is released, so the entry is addressed by index.
+
+        const uint32_t entry_index = compiler->next_entry_index++;
+        const PipelineBuildInfo info = compiler->entries[entry_index].info;
+
+        pthread_mutex_unlock(&compiler->mutex);
+
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        const VkResult result = pipeline_create(&info, &pipeline);
+
+        pthread_mutex_lock(&compiler->mutex);
+
+        compiler->entries[entry_index].status = result == VK_SUCCESS ? PIPELINE_STATUS_READY : PIPELINE_STATUS_FAILED;
+        compiler->entries[entry_index].pipeline = pipeline;
+    }
+
+    pthread_mutex_unlock(&compiler->mutex);
+    return NULL;
+}
+
+static bool pipeline_compiler_start(PipelineCompiler *compiler, uint32_t thread_count) {
+    *compiler = (PipelineCompiler) { 0 };
+
+    if (pthread_mutex_init(&compiler->mutex, NULL) != 0 || pthread_cond_init(&compiler->entry_added_condition, NULL) != 0) {
+        return false;
+    }
+
+    compiler->slot_count = 64;
+    compiler->slots = calloc(compiler->slot_count, sizeof *compiler->slots);
+    compiler->threads = calloc(thread_count, sizeof *compiler->threads);
+
+    if (compiler->slots == NULL || compiler->threads == NULL) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < thread_count; i++) {
+        if (pthread_create(&compiler->threads[i], NULL, pipeline_compiler_main, compiler) != 0) {
+            return false;
+        }
+
+        compiler->thread_count++;
+    }
+
+    return true;
+}
+
+// Inserts an entry index into the table, which must have a free slot.
+
+static void pipeline_compiler_insert_slot(PipelineCompiler *compiler, uint32_t entry_index) {
+    uint32_t slot_index = (uint32_t)compiler->entries[entry_index].hash & (compiler->slot_count - 1);
+
+    while (compiler->slots[slot_index] != 0) {
+        slot_index = (slot_index + 1) & (compiler->slot_count - 1);
+    }
+
+    compiler->slots[slot_index] = entry_index + 1;
+}
+
+// Returns the status of the pipeline for the given state, and the pipeline once it is ready. A
+// state that was never requested before is queued for compilation. Failing to queue it is
+// reported as a failed compilation.
+
+static PipelineStatus pipeline_compiler_get(PipelineCompiler *compiler, const PipelineBuildInfo *info, VkPipeline *pipeline) {
+    const uint64_t hash = pipeline_key_hash(info);
+
+    pthread_mutex_lock(&compiler->mutex);
+
+    for (uint32_t slot_index = (uint32_t)hash & (compiler->slot_count - 1); compiler->slots[slot_index] != 0; slot_index = (slot_index + 1) & (compiler->slot_count - 1)) {
+        const PipelineEntry *entry = &compiler->entries[compiler->slots[slot_index] - 1];
+
+        if (!entry->forgotten && entry->hash == hash && pipeline_key_equal(&entry->info, info)) {
+            const PipelineStatus status = entry->status;
+            *pipeline = entry->pipeline;
+            pthread_mutex_unlock(&compiler->mutex);
+            return status;
+        }
+    }
+
+    // Keep the table at most half full.
+
+    if ((compiler->entry_count + 1) * 2 > compiler->slot_count) {
+        const uint32_t slot_count = compiler->slot_count * 2;
+        uint32_t *slots = calloc(slot_count, sizeof *slots);
+
+        if (slots == NULL) {
+            pthread_mutex_unlock(&compiler->mutex);
+            return PIPELINE_STATUS_FAILED;
+        }
+
+        free(compiler->slots);
+        compiler->slots = slots;
+        compiler->slot_count = slot_count;
+
+        for (uint32_t i = 0; i < compiler->entry_count; i++) {
+            pipeline_compiler_insert_slot(compiler, i);
+        }
+    }
+
+    if (compiler->entry_count == compiler->entry_capacity) {
+        const uint32_t entry_capacity = compiler->entry_capacity == 0 ? 16 : compiler->entry_capacity * 2;
+        PipelineEntry *entries = realloc(compiler->entries, entry_capacity * sizeof *entries);
+
+        if (entries == NULL) {
+            pthread_mutex_unlock(&compiler->mutex);
+            return PIPELINE_STATUS_FAILED;
+        }
+
+        compiler->entries = entries;
+        compiler->entry_capacity = entry_capacity;
+    }
+
+    compiler->entries[compiler->entry_count] = (PipelineEntry) {
+        .info = *info,
+        .hash = hash,
+        .status = PIPELINE_STATUS_PENDING,
+        .pipeline = VK_NULL_HANDLE,
+        .forgotten = false,
+    };
+
+    pipeline_compiler_insert_slot(compiler, compiler->entry_count++);
+    *pipeline = VK_NULL_HANDLE;
+
+    pthread_cond_signal(&compiler->entry_added_condition);
+    pthread_mutex_unlock(&compiler->mutex);
+
+    return PIPELINE_STATUS_PENDING;
+}
+
+// Stops returning the pipelines built from a shader module that is about to be destroyed, since a
+// module created later may get the same handle. The pipelines themselves stay alive until the
+// compiler is stopped, frames may still use them. Returns false while a pipeline that uses the
+// module is waiting to be compiled, the module has to be kept until then.
+
+static bool pipeline_compiler_forget_module(PipelineCompiler *compiler, VkShaderModule module) {
+    bool pending = false;
+
+    pthread_mutex_lock(&compiler->mutex);
+
+    for (uint32_t i = 0; i < compiler->entry_count && !pending; i++) {
+        const PipelineEntry *entry = &compiler->entries[i];
+
+        for (uint32_t j = 0; j < SHADER_FILE_COUNT; j++) {
+            if ((pipeline_kind_shader_files[entry->info.kind] & 1u << j) != 0 && entry->info.shader_modules[j] == module) {
+                pending = pending || entry->status == PIPELINE_STATUS_PENDING;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < compiler->entry_count && !pending; i++) {
+        PipelineEntry *entry = &compiler->entries[i];
+
+        for (uint32_t j = 0; j < SHADER_FILE_COUNT; j++) {
+            if ((pipeline_kind_shader_files[entry->info.kind] & 1u << j) != 0 && entry->info.shader_modules[j] == module) {
+                entry->forgotten = true;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&compiler->mutex);
+    return !pending;
+}
+
+// Destroys the shader modules that are not in `used_modules`, once no pipeline waiting to be
+// compiled uses them, so every reloaded shader does not keep its old module until shutdown.
+
+static void shader_cache_evict(ShaderCache *cache, PipelineCompiler *compiler, const VkShaderModule *used_modules, uint32_t used_module_count) {
+    uint32_t kept_entry_count = 0;
+
+    for (uint32_t i = 0; i < cache->entry_count; i++) {
+        const ShaderCacheEntry entry = cache->entries[i];
+        bool used = false;
+
+        for (uint32_t j = 0; j < used_module_count; j++) {
+            used = used || used_modules[j] == entry.module;
+        }
+
+        if (used || !pipeline_compiler_forget_module(compiler, entry.module)) {
+            cache->entries[kept_entry_count++] = entry;
+            continue;
+        }
+
+        vkDestroyShaderModule(cache->device, entry.module, NULL);
+        free(entry.code);
+    }
+
+    cache->entry_count = kept_entry_count;
+}
+
+// Waits for the compilations in progress, then destroys every pipeline. Pipelines that were never
+// started are dropped.
+
+static void pipeline_compiler_stop(PipelineCompiler *compiler, VkDevice device) {
+    pthread_mutex_lock(&compiler->mutex);
+    compiler->stopping = true;
+    pthread_cond_broadcast(&compiler->entry_added_condition);
+    pthread_mutex_unlock(&compiler->mutex);
+
+    for (uint32_t i = 0; i < compiler->thread_count; i++) {
+        pthread_join(compiler->threads[i], NULL);
+    }
+
+    for (uint32_t i = 0; i < compiler->entry_count; i++) {
+        vkDestroyPipeline(device, compiler->entries[i].pipeline, NULL);
+    }
+
+    free(compiler->entries);
+    free(compiler->slots);
+    free(compiler->threads);
+    pthread_cond_destroy(&compiler->entry_added_condition);
+    pthread_mutex_destroy(&compiler->mutex);
+}
+
+// Everything the indirect draws of a subpass are recorded with.
+
+typedef struct DrawRecording {
+    VkPipeline pipeline;
+    VkPipelineLayout pipeline_layout;
+    VkDescriptorSet descriptor_set;
+    const Mesh *mesh;
+    VkBuffer instance_buffer;
+    VkBuffer draw_command_buffer;
+    uint32_t group_size;
+    bool multi_draw_indirect;
+    bool draw_indirect_count;
+    VkViewport viewport;
+    VkRect2D scissor;
+    PushConstants push_constants;
+    uint32_t draw_count;
+} DrawRecording;
+
+// Records the indirect draws from `first_draw` up to `end_draw` written by the culling shader.
+// Without draws nothing is recorded, there may not even be a pipeline yet. The draw command buffer
+// starts with the number of compacted draws, followed by the draw of every group and then the
+// compacted draws.
+
+static void record_draws(VkCommandBuffer command_buffer, const DrawRecording *recording, uint32_t first_draw, uint32_t end_draw) {
+    if (end_draw <= first_draw) {
+        return;
+    }
+
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, recording->pipeline);
+    vkCmdSetViewport(command_buffer, 0, 1, &recording->viewport);
+    vkCmdSetScissor(command_buffer, 0, 1, &recording->scissor);
+
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, recording->pipeline_layout, 0, 1, &recording->descriptor_set, 0, NULL);
+
+    PushConstants push_constants = recording->push_constants;
+    push_constants.material_index = recording->mesh->material_index;
+
+    vkCmdPushConstants(command_buffer, recording->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof push_constants, &push_constants);
+
+    const VkBuffer vertex_buffers[] = { recording->mesh->vertex_buffer, recording->instance_buffer };
+    const VkDeviceSize vertex_buffer_offsets[] = { 0, 0 };
+    const VkDeviceSize draw_command_size = sizeof(VkDrawIndexedIndirectCommand);
+    const VkDeviceSize draw_commands_offset = sizeof(uint32_t);
+
+    vkCmdBindVertexBuffers(command_buffer, 0, 2, vertex_buffers, vertex_buffer_offsets);
+    vkCmdBindIndexBuffer(command_buffer, recording->mesh->index_buffer, 0, recording->mesh->index_type);
+
+    // With indirect draw counts, only the compacted draws are issued, so groups without visible
+    // instances cost nothing. Without multi-draw indirect (and non-zero first instances in
+    // indirect draws), the commands are drawn one by one, with the instance buffer bound at the
+    // start of the group.
+
+    if (recording->draw_indirect_count) {
+        const VkDeviceSize compacted_draw_commands_offset = draw_commands_offset + recording->draw_count * draw_command_size;
+
+        vkCmdDrawIndexedIndirectCount(command_buffer, recording->draw_command_buffer, compacted_draw_commands_offset + first_draw * draw_command_size, recording->draw_command_buffer, 0, end_draw - first_draw, (uint32_t)draw_command_size);
+    } else if (recording->multi_draw_indirect) {
+        vkCmdDrawIndexedIndirect(command_buffer, recording->draw_command_buffer, draw_commands_offset + first_draw * draw_command_size, end_draw - first_draw, (uint32_t)draw_command_size);
+    } else {
+        for (uint32_t i = first_draw; i < end_draw; i++) {
+            const VkDeviceSize instance_buffer_offset = (VkDeviceSize)i * recording->group_size * sizeof(Instance);
+
+            vkCmdBindVertexBuffers(command_buffer, 1, 1, &recording->instance_buffer, &instance_buffer_offset);
+            vkCmdDrawIndexedIndirect(command_buffer, recording->draw_command_buffer, draw_commands_offset + i * draw_command_size, 1, (uint32_t)draw_command_size);
+        }
+    }
+}
+
+// Without multi-draw indirect, the recording cost grows with the number of draws, so the draws are
+// split into slices, each recorded into its own secondary command buffer by a different thread.
+// Everything a slice needs is in the job, the results are written to the slice's own elements of
+// `command_buffers` and `results`.
+
+typedef struct RecordJob {
+    VkDevice device;
+    VkRenderPass render_pass;
+    uint32_t subpass;
+    VkFramebuffer framebuffer;
+    DrawRecording recording;
+    uint32_t slice_count;
+    CommandBufferPool *command_buffer_pools;
+    VkCommandBuffer *command_buffers;
+    VkResult *results;
+} RecordJob;
+
+// Records one slice of the job into a secondary command buffer.
+
+static void record_slice(const RecordJob *job, uint32_t slice_index) {
+    const uint32_t first_draw = (uint32_t)((uint64_t)job->recording.draw_count * slice_index / job->slice_count);
+    const uint32_t end_draw = (uint32_t)((uint64_t)job->recording.draw_count * (slice_index + 1) / job->slice_count);
+
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    VkResult result = command_buffer_pool_get(job->device, &job->command_buffer_pools[slice_index], &command_buffer);
+
+    if (result != VK_SUCCESS) {
+        job->results[slice_index] = result;
+        return;
+    }
+
+    const VkCommandBufferInheritanceInfo command_buffer_inheritance_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .pNext = NULL,
+        .renderPass = job->render_pass,
+        .subpass = job->subpass,
+        .framebuffer = job->framebuffer,
+        .occlusionQueryEnable = VK_FALSE,
+        .queryFlags = 0,
+        .pipelineStatistics = 0,
+    };
+
+    const VkCommandBufferBeginInfo command_buffer_begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = NULL,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &command_buffer_inheritance_info,
+    };
+
+    result = vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info);
+
+    if (result != VK_SUCCESS) {
+        job->results[slice_index] = result;
+        return;
+    }
+
+    // Secondary command buffers do not inherit any state from the primary one, record_draws binds
+    // everything again.
+
+    record_draws(command_buffer, &job->recording, first_draw, end_draw);
+
+    job->command_buffers[slice_index] = command_buffer;
+    job->results[slice_index] = vkEndCommandBuffer(command_buffer);
+}
+
+// A pool of threads that record slices of a job. The thread submitting a job records slice zero
+// itself, worker `i` records slice `i + 1`, so there is one worker less than there are slices.
+
+typedef struct RecordWorkerPool {
+    pthread_mutex_t mutex;
+    pthread_cond_t job_ready_condition;
+    pthread_cond_t job_done_condition;
+    pthread_t *threads;
+    uint32_t thread_count;
+    uint64_t job_number;
+    uint32_t pending_slice_count;
+    bool stopping;
+    RecordJob job;
+} RecordWorkerPool;
+
+typedef struct RecordWorker {
+    RecordWorkerPool *pool;
+    uint32_t slice_index;
+} RecordWorker;
+
+static void *record_worker_main(void *argument) {
+    const RecordWorker worker = *(const RecordWorker *)argument;
+    RecordWorkerPool *pool = worker.pool;
+    uint64_t job_number = 0;
+
+    free(argument);
+    pthread_mutex_lock(&pool->mutex);
+
+    while (true) {
+        while (!pool->stopping && pool->job_number == job_number) {
+            pthread_cond_wait(&pool->job_ready_condition, &pool->mutex);
+        }
+
+        if (pool->stopping) {
+            break;
+        }
+
+        job_number = pool->job_number;
+
+        // Jobs with few draws are split into fewer slices than there are threads.
+
+        if (worker.slice_index >= pool->job.slice_count) {
+            continue;
+        }
+
+        const RecordJob job = pool->job;
+
+        pthread_mutex_unlock(&pool->mutex);
+        record_slice(&job, worker.slice_index);
+        pthread_mutex_lock(&pool->mutex);
+
+        if (--pool->pending_slice_count == 0) {
+            pthread_cond_signal(&pool->job_done_condition);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+static bool record_worker_pool_start(RecordWorkerPool *pool, uint32_t thread_count) {
+    *pool = (RecordWorkerPool) { 0 };
+
+    if (pthread_mutex_init(&pool->mutex, NULL) != 0) {
+        return false;
+    }
+
+    if (pthread_cond_init(&pool->job_ready_condition, NULL) != 0 || pthread_cond_init(&pool->job_done_condition, NULL) != 0) {
+        return false;
+    }
+
+    pool->threads = calloc(thread_count > 0 ? thread_count : 1, sizeof *pool->threads);
+
+    if (pool->threads == NULL) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < thread_count; i++) {
+        RecordWorker *worker = malloc(sizeof *worker);
+
+        if (worker == NULL) {
+            return false;
+        }
+
+        worker->pool = pool;
+        worker->slice_index = i + 1;
+
+        if (pthread_create(&pool->threads[i], NULL, record_worker_main, worker) != 0) {
+            free(worker);
+            return false;
+        }
+
+        pool->thread_count++;
+    }
+
+    return true;
+}
+
+// Records all slices of the job and waits until every slice is done.
+
+static void record_worker_pool_run(RecordWorkerPool *pool, const RecordJob *job) {
+    if (job->slice_count > 1) {
+        pthread_mutex_lock(&pool->mutex);
+        pool->job = *job;
+        pool->job_number++;
+        pool->pending_slice_count = job->slice_count - 1;
+        pthread_cond_broadcast(&pool->job_ready_condition);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    record_slice(job, 0);
+
+    if (job->slice_count > 1) {
+        pthread_mutex_lock(&pool->mutex);
+
+        while (pool->pending_slice_count > 0) {
+            pthread_cond_wait(&pool->job_done_condition, &pool->mutex);
+        }
+
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+static void record_worker_pool_stop(RecordWorkerPool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->job_ready_condition);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (uint32_t i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    free(pool->threads);
+    pthread_cond_destroy(&pool->job_done_condition);
+    pthread_cond_destroy(&pool->job_ready_condition);
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+// The GPU timestamps written by every frame, in the order of their query indices. They are followed
+// by one timestamp at the end of every post-processing pass.
+
+typedef enum Timestamp {
+    TIMESTAMP_CULL_BEGIN,
+    TIMESTAMP_RENDER_PASS_BEGIN,
+    TIMESTAMP_RENDER_PASS_END,
+    TIMESTAMP_UPSCALE_END,
+    TIMESTAMP_COUNT,
+} Timestamp;
+
+// The timings measured for every frame. CPU metrics cover one phase of the frame loop, GPU metrics
+// the time between two timestamps.
+
+typedef enum Metric {
+    METRIC_CPU_FRAME_WAIT,
+    METRIC_CPU_UPLOAD,
+    METRIC_CPU_ACQUIRE,
+    METRIC_CPU_RECORD,
+    METRIC_CPU_SUBMIT,
+    METRIC_CPU_PRESENT,
+    METRIC_CPU_FRAME,
+    METRIC_GPU_CULL,
+    METRIC_GPU_RENDER_PASS,
+    METRIC_GPU_BLOOM,
+    METRIC_GPU_TONEMAP,
+    METRIC_GPU_SHARPEN,
+    METRIC_GPU_UPSCALE,
+    METRIC_COUNT,
+} Metric;
+
+static const char *const metric_names[METRIC_COUNT] = {
+    [METRIC_CPU_FRAME_WAIT] = "cpu_frame_wait",
+    [METRIC_CPU_UPLOAD] = "cpu_upload",
+    [METRIC_CPU_ACQUIRE] = "cpu_acquire",
+    [METRIC_CPU_RECORD] = "cpu_record",
+    [METRIC_CPU_SUBMIT] = "cpu_submit",
+    [METRIC_CPU_PRESENT] = "cpu_present",
+    [METRIC_CPU_FRAME] = "cpu_frame",
+    [METRIC_GPU_CULL] = "gpu_cull",
+    [METRIC_GPU_RENDER_PASS] = "gpu_render_pass",
+    [METRIC_GPU_BLOOM] = "gpu_bloom",
+    [METRIC_GPU_TONEMAP] = "gpu_tonemap",
+    [METRIC_GPU_SHARPEN] = "gpu_sharpen",
+    [METRIC_GPU_UPSCALE] = "gpu_upscale",
+};
+
+// The passes that can be chained to post-process the HDR scene image, each one a compute shader
+// (two for bloom, which goes through a half resolution image). Each pass has a strength: the bloom
+// intensity, the exposure before tonemapping or the amount of sharpening. The pipeline kind listed
+// is the one writing the result of the pass.
+
+typedef enum PostPass {
+    POST_PASS_BLOOM,
+    POST_PASS_TONEMAP,
+    POST_PASS_SHARPEN,
+    POST_PASS_COUNT,
+} PostPass;
+
+static const char *const post_pass_names[POST_PASS_COUNT] = {
+    [POST_PASS_BLOOM] = "bloom",
+    [POST_PASS_TONEMAP] = "tonemap",
+    [POST_PASS_SHARPEN] = "sharpen",
+};
+
+static const float post_pass_default_strengths[POST_PASS_COUNT] = {
+    [POST_PASS_BLOOM] = 0.5f,
+    [POST_PASS_TONEMAP] = 1.0f,
+    [POST_PASS_SHARPEN] = 0.25f,
+};
+
+static const PipelineKind post_pass_pipeline_kinds[POST_PASS_COUNT] = {
+    [POST_PASS_BLOOM] = PIPELINE_KIND_BLOOM_UPSAMPLE,
+    [POST_PASS_TONEMAP] = PIPELINE_KIND_TONEMAP,
+    [POST_PASS_SHARPEN] = PIPELINE_KIND_SHARPEN,
+};
+
+static const Metric post_pass_metrics[POST_PASS_COUNT] = {
+    [POST_PASS_BLOOM] = METRIC_GPU_BLOOM,
+    [POST_PASS_TONEMAP] = METRIC_GPU_TONEMAP,
+    [POST_PASS_SHARPEN] = METRIC_GPU_SHARPEN,
+};
+
+#define MAX_POST_PASSES 8
+
+typedef struct PostPassConfig {
+    PostPass pass;
+    float strength;
+} PostPassConfig;
+
+// The largest workgroup width and height of the post-processing passes. The shaders size their
+// tiles of texels for it, since arrays sized by the workgroup size need specialization constant
+// expressions that not every compiler handles.
+
+#define MAX_POST_WORKGROUP_SIZE 16
+
+// The shared memory a pass uses for its tile of texels. Bloom keeps half floats in its larger
+// downsampling tile (34x34 texels at 8 bytes), sharpening a vec4 per texel (18x18 texels).
+
+static uint32_t post_pass_shared_memory_size(PostPass pass) {
+    if (pass == POST_PASS_BLOOM) {
+        return (MAX_POST_WORKGROUP_SIZE * 2 + 2) * (MAX_POST_WORKGROUP_SIZE * 2 + 2) * 8;
+    } else if (pass == POST_PASS_SHARPEN) {
+        return (MAX_POST_WORKGROUP_SIZE + 2) * (MAX_POST_WORKGROUP_SIZE + 2) * 16;
+    }
+
+    return 0;
+}
+
+// Percentiles are computed over the most recent samples only, so they follow the current load
+// instead of averaging over the whole run.
+
+#define METRIC_WINDOW_SIZE 1024
+
+typedef struct MetricHistory {
+    double samples[METRIC_WINDOW_SIZE];
+    uint32_t sample_count;
+    uint32_t next_sample;
+    uint64_t total_sample_count;
+} MetricHistory;
+
+typedef struct MetricSummary {
+    uint32_t sample_count;
+    double mean;
+    double p50;
+    double p95;
+    double p99;
+    double max;
+} MetricSummary;
+
+// The selectable present modes. When a mode is not supported by the surface, the modes after it in
+// its fallback list are tried in order. FIFO is the last resort, every surface has to support it.
+
+typedef struct PresentModeOption {
+    const char *name;
+    VkPresentModeKHR present_mode;
+    VkPresentModeKHR fallbacks[2];
+    uint32_t fallback_count;
+} PresentModeOption;
+
+static const PresentModeOption present_mode_options[] = {
+    { "fifo", VK_PRESENT_MODE_FIFO_KHR, { 0 }, 0 },
+    { "fifo_relaxed", VK_PRESENT_MODE_FIFO_RELAXED_KHR, { VK_PRESENT_MODE_FIFO_KHR }, 1 },
+    { "mailbox", VK_PRESENT_MODE_MAILBOX_KHR, { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_KHR }, 2 },
+    { "immediate", VK_PRESENT_MODE_IMMEDIATE_KHR, { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR }, 2 },
+};
+
+static const char *present_mode_name(VkPresentModeKHR present_mode) {
+    for (uint32_t i = 0; i < sizeof present_mode_options / sizeof *present_mode_options; i++) {
+        if (present_mode_options[i].present_mode == present_mode) {
+            return present_mode_options[i].name;
+        }
+    }
+
+    return "unknown";
+}
+
+// A Vulkan object that is destroyed once all frames before `frame_number` have finished on the GPU.
+// Handles are stored as 64-bit integers, like VkDebugUtilsObjectNameInfoEXT does. Memory is
+// retired as an allocation of the memory allocator, with the type VK_OBJECT_TYPE_DEVICE_MEMORY.
+
+typedef struct RetiredObject {
+    VkObjectType type;
+    uint64_t handle;
+    MemoryAllocation allocation;
+    uint64_t frame_number;
+} RetiredObject;
+
+typedef struct RetireQueue {
+    RetiredObject *objects;
+    uint32_t object_count;
+    uint32_t object_capacity;
+} RetireQueue;
+
+static bool retire_queue_push(RetireQueue *queue, const RetiredObject *object) {
+    if (queue->object_count == queue->object_capacity) {
+        const uint32_t object_capacity = queue->object_capacity == 0 ? 64 : queue->object_capacity * 2;
+        RetiredObject *objects = realloc(queue->objects, object_capacity * sizeof *objects);
+
+        if (objects == NULL) {
+            return false;
+        }
+
+        queue->objects = objects;
+        queue->object_capacity = object_capacity;
+    }
+
+    queue->objects[queue->object_count++] = *object;
+    return true;
+}
+
+static bool retire_object(RetireQueue *queue, VkObjectType type, uint64_t handle, uint64_t frame_number) {
+    const RetiredObject object = {
+        .type = type,
+        .handle = handle,
+        .allocation = { 0 },
+        .frame_number = frame_number,
+    };
+
+    return retire_queue_push(queue, &object);
+}
+
+static bool retire_allocation(RetireQueue *queue, const MemoryAllocation *allocation, uint64_t frame_number) {
+    const RetiredObject object = {
+        .type = VK_OBJECT_TYPE_DEVICE_MEMORY,
+        .handle = (uint64_t)allocation->memory,
+        .allocation = *allocation,
+        .frame_number = frame_number,
+    };
+
+    return retire_queue_push(queue, &object);
+}
+
+// Retires the images owned by a render graph along with their memory, they are added again
+// afterwards.
+
+static bool render_graph_retire_images(RetireQueue *queue, RenderGraph *graph, uint64_t frame_number) {
+    if (graph->images_created) {
+        for (uint32_t i = 0; i < graph->image_count; i++) {
+            const RenderGraphResource *resource = &graph->resources[i];
+
+            if (!retire_object(queue, VK_OBJECT_TYPE_IMAGE_VIEW, (uint64_t)resource->view, frame_number)
+                || !retire_object(queue, VK_OBJECT_TYPE_IMAGE, (uint64_t)resource->image, frame_number)
+                || (resource->allocation.memory != VK_NULL_HANDLE && !retire_allocation(queue, &resource->allocation, frame_number))) {
+                return false;
+            }
+        }
+
+        if (graph->memory.memory != VK_NULL_HANDLE && !retire_allocation(queue, &graph->memory, frame_number)) {
+            return false;
+        }
+    }
+
+    graph->resource_count = 0;
+    graph->image_count = 0;
+    graph->images_created = false;
+    graph->memory = (MemoryAllocation) { 0 };
+    return true;
+}
+
+// Destroys the retired objects whose frames have all finished, given the number of frames that
+// have finished so far.
+
+static void destroy_retired_objects(MemoryAllocator *allocator, RetireQueue *queue, uint64_t completed_frame_count) {
+    VkDevice device = allocator->device;
+    uint32_t kept_object_count = 0;
+
+    for (uint32_t i = 0; i < queue->object_count; i++) {
+        const RetiredObject object = queue->objects[i];
+
+        if (object.frame_number > completed_frame_count) {
+            queue->objects[kept_object_count++] = object;
+            continue;
+        }
+
+        switch (object.type) {
+            case VK_OBJECT_TYPE_FRAMEBUFFER:
+                vkDestroyFramebuffer(device, (VkFramebuffer)object.handle, NULL);
+                break;
+            case VK_OBJECT_TYPE_IMAGE_VIEW:
+                vkDestroyImageView(device, (VkImageView)object.handle, NULL);
+                break;
+            case VK_OBJECT_TYPE_IMAGE:
+                vkDestroyImage(device, (VkImage)object.handle, NULL);
+                break;
+            case VK_OBJECT_TYPE_DEVICE_MEMORY:
+                memory_free(allocator, &object.allocation);
+                break;
+            case VK_OBJECT_TYPE_SWAPCHAIN_KHR:
+                vkDestroySwapchainKHR(device, (VkSwapchainKHR)object.handle, NULL);
+                break;
+            case VK_OBJECT_TYPE_SEMAPHORE:
+                vkDestroySemaphore(device, (VkSemaphore)object.handle, NULL);
+                break;
+            default:
+                fprintf(stderr, "warning (vulkan): Leaking a retired object of unsupported type %d.\n", (int)object.type);
+                break;
+        }
+    }
+
+    queue->object_count = kept_object_count;
+}
+
+// Blocks until the frame timeline semaphore has reached `value`, i.e. until the first `value`
+// frames have finished on the GPU.
+
+static VkResult frame_wait(VkDevice device, VkSemaphore frame_semaphore, uint64_t value) {
+    const VkSemaphoreWaitInfo semaphore_wait_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .semaphoreCount = 1,
+        .pSemaphores = &frame_semaphore,
+        .pValues = &value,
+    };
+
+    return vkWaitSemaphores(device, &semaphore_wait_info, UINT64_MAX);
+}
+
+// Returns a monotonic timestamp in milliseconds.
+
+static double time_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1000000.0;
+}
+
+static void metric_add_sample(MetricHistory *history, double sample) {
+    history->samples[history->next_sample] = sample;
+    history->next_sample = (history->next_sample + 1) % METRIC_WINDOW_SIZE;
+    history->total_sample_count++;
+
+    if (history->sample_count < METRIC_WINDOW_SIZE) {
+        history->sample_count++;
+    }
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Summarizes the current window of a metric, using nearest-rank percentiles.
+
+static MetricSummary metric_summarize(const MetricHistory *history) {
+    MetricSummary summary = { 0 };
+
+    if (history->sample_count == 0) {
+        return summary;
+    }
+
+    double sorted_samples[METRIC_WINDOW_SIZE];
+    memcpy(sorted_samples, history->samples, history->sample_count * sizeof *sorted_samples);
+    qsort(sorted_samples, history->sample_count, sizeof *sorted_samples, compare_doubles);
+
+    const uint32_t n = history->sample_count;
+    double sum = 0.0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        sum += sorted_samples[i];
+    }
+
+    summary.sample_count = n;
+    summary.mean = sum / n;
+    summary.p50 = sorted_samples[(n * 50 + 99) / 100 - 1];
+    summary.p95 = sorted_samples[(n * 95 + 99) / 100 - 1];
+    summary.p99 = sorted_samples[(n * 99 + 99) / 100 - 1];
+    summary.max = sorted_samples[n - 1];
+
+    return summary;
+}
+
+// A physical device rated for the renderer. A device is unsuitable if it lacks Vulkan 1.2, one of
+// the required features, the swapchain extension (unless rendering offscreen) or a queue family
+// for graphics and compute that can present. Suitable devices are ranked by type first (discrete,
+// integrated, virtual, CPU), then by their device local memory (16 points per GiB), multi-draw
+// indirect (500) and queue families for async transfers and compute (250 each).
+
+typedef struct PhysicalDeviceCandidate {
+    VkPhysicalDevice physical_device;
+    VkPhysicalDeviceProperties properties;
+    char uuid[2 * VK_UUID_SIZE + 5];
+    VkDeviceSize device_local_size;
+    const char *unsuitable_reason;
+    uint64_t score;
+} PhysicalDeviceCandidate;
+
+static const char *const physical_device_type_names[] = {
+    [VK_PHYSICAL_DEVICE_TYPE_OTHER] = "other",
+    [VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU] = "integrated",
+    [VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU] = "discrete",
+    [VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU] = "virtual",
+    [VK_PHYSICAL_DEVICE_TYPE_CPU] = "cpu",
+};
+
+static void physical_device_candidate_rate(PhysicalDeviceCandidate *candidate, VkPhysicalDevice physical_device, VkSurfaceKHR surface, bool require_swapchain) {
+    *candidate = (PhysicalDeviceCandidate) { 0 };
+    candidate->physical_device = physical_device;
+
+    vkGetPhysicalDeviceProperties(physical_device, &candidate->properties);
+
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+
+    for (uint32_t i = 0; i < memory_properties.memoryHeapCount; i++) {
+        if (memory_properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+            candidate->device_local_size += memory_properties.memoryHeaps[i].size;
+        }
+    }
+
+    // Check the requirements. The ID properties and the Vulkan 1.2 features can only be queried
+    // on devices that support Vulkan 1.1 and 1.2, so older devices have no UUID.
+
+    if (candidate->properties.apiVersion < VK_API_VERSION_1_2) {
+        candidate->unsuitable_reason = "no Vulkan 1.2";
+        return;
+    }
+
+    // The UUID is formatted like 01234567-89ab-cdef-0123-456789abcdef.
+
+    VkPhysicalDeviceIDProperties id_properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES,
+        .pNext = NULL,
+    };
+
+    VkPhysicalDeviceProperties2 properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &id_properties,
+    };
+
+    vkGetPhysicalDeviceProperties2(physical_device, &properties);
+
+    char *uuid = candidate->uuid;
+
+    for (uint32_t i = 0; i < VK_UUID_SIZE; i++) {
+        uuid += sprintf(uuid, "%s%02x", i == 4 || i == 6 || i == 8 || i == 10 ? "-" : "", id_properties.deviceUUID[i]);
+    }
+
+    VkPhysicalDeviceVulkan12Features vulkan_12_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .pNext = NULL,
+    };
+
+    VkPhysicalDeviceFeatures2 features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &vulkan_12_features,
+    };
+
+    vkGetPhysicalDeviceFeatures2(physical_device, &features);
+
+    if (!vulkan_12_features.runtimeDescriptorArray
+        || !vulkan_12_features.descriptorBindingPartiallyBound
+        || !vulkan_12_features.descriptorBindingStorageBufferUpdateAfterBind
+        || !vulkan_12_features.descriptorBindingSampledImageUpdateAfterBind) {
+        candidate->unsuitable_reason = "no descriptor indexing";
+        return;
+    }
+
+    if (!vulkan_12_features.timelineSemaphore) {
+        candidate->unsuitable_reason = "no timeline semaphores";
+        return;
+    }
+
+    if (require_swapchain) {
+        uint32_t extension_count = 0;
+        vkEnumerateDeviceExtensionProperties(physical_device, NULL, &extension_count, NULL);
+
+        VkExtensionProperties *extensions = malloc(extension_count * sizeof *extensions);
+        bool swapchain_supported = false;
+
+        if (extensions != NULL && vkEnumerateDeviceExtensionProperties(physical_device, NULL, &extension_count, extensions) == VK_SUCCESS) {
+            for (uint32_t i = 0; i < extension_count; i++) {
+                swapchain_supported = swapchain_supported || strcmp(extensions[i].extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0;
+            }
+        }
+
+        free(extensions);
+
+        if (!swapchain_supported) {
+            candidate->unsuitable_reason = "no swapchain extension";
+            return;
+        }
+    }
+
+    uint32_t queue_family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, NULL);
+
+    VkQueueFamilyProperties *queue_family_properties = malloc(queue_family_count * sizeof *queue_family_properties);
+
+    if (queue_family_properties == NULL) {
+        candidate->unsuitable_reason = "no queue families";
+        return;
+    }
+
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_family_properties);
+
+    bool graphics_queue_family_found = false;
+    bool transfer_queue_family_found = false;
+    bool compute_queue_family_found = false;
+
+    for (uint32_t i = 0; i < queue_family_count; i++) {
+        const VkQueueFlags queue_flags = queue_family_properties[i].queueFlags;
+        VkBool32 supports_presentation = surface == VK_NULL_HANDLE;
+
+        if (surface != VK_NULL_HANDLE) {
+            vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, i, surface, &supports_presentation);
+        }
+
+        if (supports_presentation && (queue_flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) {
+            graphics_queue_family_found = true;
+        }
+
+        if (queue_flags & VK_QUEUE_TRANSFER_BIT && !(queue_flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            transfer_queue_family_found = true;
+        }
+
+        if (queue_flags & VK_QUEUE_COMPUTE_BIT && !(queue_flags & VK_QUEUE_GRAPHICS_BIT)) {
+            compute_queue_family_found = true;
+        }
+    }
+
+    free(queue_family_properties);
+
+    if (!graphics_queue_family_found) {
+        candidate->unsuitable_reason = surface != VK_NULL_HANDLE ? "no graphics queue that can present" : "no graphics queue";
+        return;
+    }
+
+    // Rate the device.
+
+    static const uint64_t type_scores[] = {
+        [VK_PHYSICAL_DEVICE_TYPE_OTHER] = 0,
+        [VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU] = 500000,
+        [VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU] = 1000000,
+        [VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU] = 250000,
+        [VK_PHYSICAL_DEVICE_TYPE_CPU] = 100000,
+    };
+
+    if ((uint32_t)candidate->properties.deviceType < sizeof type_scores / sizeof *type_scores) {
+        candidate->score += type_scores[candidate->properties.deviceType];
+    }
+
+    candidate->score += candidate->device_local_size >> 26;
+    candidate->score += features.features.multiDrawIndirect && features.features.drawIndirectFirstInstance ? 500 : 0;
+    candidate->score += transfer_queue_family_found ? 250 : 0;
+    candidate->score += compute_queue_family_found ? 250 : 0;
+}
+
+// Returns whether a device is selected by `value`, either its UUID (in any case, with or without
+// dashes) or a part of its name.
+
+static bool physical_device_candidate_matches(const PhysicalDeviceCandidate *candidate, const char *value) {
+    if (strstr(candidate->properties.deviceName, value) != NULL) {
+        return true;
+    }
+
+    const char *uuid = candidate->uuid;
+
+    while (*uuid != '\0' || *value != '\0') {
+        if (*uuid == '-') {
+            uuid++;
+        } else if (*value == '-') {
+            value++;
+        } else {
+            const char character = *value >= 'A' && *value <= 'Z' ? (char)(*value - 'A' + 'a') : *value;
+
+            if (character != *uuid) {
+                return false;
+            }
+
+            uuid++;
+            value++;
+        }
+    }
+
+    return true;
+}
+
+// Parse numeric configuration values. The whole value has to be the number, so "2abc" or "1e6" are
+// rejected instead of being read as far as they go, and so are signs, overflow and values that are
+// not finite.
+
+static bool config_parse_uint(const char *text, uint64_t max_value, uint64_t *value) {
+    if (text[0] < '0' || text[0] > '9') {
+        return false;
+    }
+
+    char *end = NULL;
+    errno = 0;
+
+    const unsigned long long parsed = strtoull(text, &end, 10);
+
+    if (*end != '\0' || errno == ERANGE || parsed > max_value) {
+        return false;
+    }
+
+    *value = parsed;
+    return true;
+}
+
+static bool config_parse_number(const char *text, double *value) {
+    char *end = NULL;
+    const double parsed = strtod(text, &end);
+
+    if (end == text || *end != '\0' || !isfinite(parsed)) {
+        return false;
+    }
+
+    *value = parsed;
+    return true;
+}
+
+// Where the rendered images go. Without a window, frames are either presented to a
+// VK_EXT_headless_surface swapchain or rendered into plain offscreen images.
+
+typedef enum OutputMode {
+    OUTPUT_MODE_WINDOW,
+    OUTPUT_MODE_HEADLESS_SURFACE,
+    OUTPUT_MODE_OFFSCREEN,
+} OutputMode;
+
+int main() {
+
+    const bool ENABLE_VALIDATION = true;
+    const uint32_t MAX_FRAMES_IN_FLIGHT = 8;
+    const uint32_t OUTPUT_WIDTH = 1280;
+    const uint32_t OUTPUT_HEIGHT = 720;
+    const double MIN_RESOLUTION_SCALE = 0.25;
+    const uint32_t MAX_RECORD_THREADS = 16;
+    const uint32_t MAX_PIPELINE_THREADS = 8;
+    const uint32_t DRAW_GROUP_SIZE = 65536;
+    const uint32_t MIN_DRAWS_PER_SLICE = 256;
+    const uint32_t MAX_BINDLESS_STORAGE_BUFFERS = 16384;
+    const uint32_t MAX_BINDLESS_SAMPLED_IMAGES = 16384;
+    const VkDeviceSize TRANSIENT_ARENA_SIZE = (VkDeviceSize)4 << 20;
+    const VkDeviceSize UPLOAD_STAGING_SIZE = (VkDeviceSize)16 << 20;
+    const VkDeviceSize UPLOAD_FRAME_BUDGET = (VkDeviceSize)4 << 20;
+    const float POST_BLOOM_THRESHOLD = 0.8f;
+
+    const char* const validation_layer_names[] = { "VK_LAYER_KHRONOS_validation" };
+    uint32_t validation_layer_count = sizeof validation_layer_names / sizeof * validation_layer_names;
+
+    // Read the configuration from the environment.
+
+    bool enable_validation = ENABLE_VALIDATION;
+    uint32_t frames_in_flight = 2;
+    OutputMode output_mode = OUTPUT_MODE_WINDOW;
+    uint64_t headless_frame_count = 1000;
+    const char *pipeline_cache_path = "pipeline_cache.bin";
+    const char *stats_path = NULL;
+    double stats_interval = 0.0;
+    const PresentModeOption *present_mode_option = &present_mode_options[0];
+    double max_resolution_scale = 1.0;
+    double gpu_budget = 0.0;
+    DepthMode depth_mode = DEPTH_MODE_ENABLED;
+    uint32_t sample_count = 1;
+    uint32_t instance_count = 1;
+    uint32_t record_thread_count = 1;
+    uint32_t pipeline_thread_count = 1;
+    bool enable_shader_reload = false;
+    bool enable_async_compute = true;
+    const char *physical_device_selector = NULL;
+    PostPassConfig post_passes[MAX_POST_PASSES];
+    uint32_t post_pass_count = 0;
+    bool post_bloom = false;
+    uint32_t post_workgroup_size[2] = { 8, 8 };
+
+    {
+        // Validation is expensive and the layers are often not installed on build machines.
+
+        const char *validation_value = getenv("VK_BASE_VALIDATION");
+
+        if (validation_value != NULL) {
+            enable_validation = strcmp(validation_value, "0") != 0;
+        }
+
+        // More frames in flight give the CPU more room to run ahead of the GPU (throughput), fewer
+        // frames keep input closer to the displayed image (latency).
+
+        const char *frames_in_flight_value = getenv("VK_BASE_FRAMES_IN_FLIGHT");
+
+        if (frames_in_flight_value != NULL) {
+            uint64_t value = 0;
+
+            if (!config_parse_uint(frames_in_flight_value, MAX_FRAMES_IN_FLIGHT, &value) || value < 1) {
+                fprintf(stderr, "error (config): The number of frames in flight must be between 1 and %u.\n", MAX_FRAMES_IN_FLIGHT);
+                return 1;
+            }
+
+            frames_in_flight = (uint32_t)value;
+        }
+
+        // Headless rendering runs a fixed number of frames, there is no window to close.
+
+        const char *headless_value = getenv("VK_BASE_HEADLESS");
+
+        if (headless_value != NULL && strcmp(headless_value, "0") != 0) {
+            if (strcmp(headless_value, "surface") == 0) {
+                output_mode = OUTPUT_MODE_HEADLESS_SURFACE;
+            } else if (strcmp(headless_value, "1") == 0 || strcmp(headless_value, "offscreen") == 0) {
+                output_mode = OUTPUT_MODE_OFFSCREEN;
+            } else {
+                fprintf(stderr, "error (config): Unknown headless mode (name: \"%s\"), expected \"offscreen\" or \"surface\".\n", headless_value);
+                return 1;
+            }
+        }
+
+        const char *headless_frame_count_value = getenv("VK_BASE_HEADLESS_FRAMES");
+
+        if (headless_frame_count_value != NULL && !config_parse_uint(headless_frame_count_value, UINT64_MAX, &headless_frame_count)) {
+            fprintf(stderr, "error (config): The number of headless frames must be a whole number.\n");
+            return 1;
+        }
+
+        // An empty path disables the on-disk pipeline cache.
+
+        const char *pipeline_cache_path_value = getenv("VK_BASE_PIPELINE_CACHE");
+
+        if (pipeline_cache_path_value != NULL) {
+            pipeline_cache_path = pipeline_cache_path_value;
+        }
+
+        // FIFO is vsync, MAILBOX replaces queued images for low latency without tearing and IMMEDIATE
+        // presents right away for uncapped throughput.
+
+        const char *present_mode_value = getenv("VK_BASE_PRESENT_MODE");
+
+        if (present_mode_value != NULL) {
+            present_mode_option = NULL;
+
+            for (uint32_t i = 0; i < sizeof present_mode_options / sizeof *present_mode_options; i++) {
+                if (strcmp(present_mode_value, present_mode_options[i].name) == 0) {
+                    present_mode_option = &present_mode_options[i];
+                    break;
+                }
+            }
+
+            if (present_mode_option == NULL) {
+                fprintf(stderr, "error (config): Unknown present mode (name: \"%s\"), expected \"fifo\", \"fifo_relaxed\", \"mailbox\" or \"immediate\".\n", present_mode_value);
+                return 1;
+            }
+        }
+
+        // The scene is rendered at a fraction of the output resolution and scaled up. With a GPU
+        // budget (in milliseconds), the scale is lowered while the GPU takes longer than that and
+        // raised again up to the configured scale once there is room.
+
+        const char *resolution_scale_value = getenv("VK_BASE_RESOLUTION_SCALE");
+
+        if (resolution_scale_value != NULL) {
+            if (!config_parse_number(resolution_scale_value, &max_resolution_scale) || max_resolution_scale < MIN_RESOLUTION_SCALE || max_resolution_scale > 1.0) {
+                fprintf(stderr, "error (config): The resolution scale must be between %.2f and 1.\n", MIN_RESOLUTION_SCALE);
+                return 1;
+            }
+        }
+
+        const char *gpu_budget_value = getenv("VK_BASE_GPU_BUDGET");
+
+        if (gpu_budget_value != NULL && (!config_parse_number(gpu_budget_value, &gpu_budget) || gpu_budget < 0.0)) {
+            fprintf(stderr, "error (config): The GPU budget must be a number of milliseconds.\n");
+            return 1;
+        }
+
+        // A depth pre-pass costs a second pass over the geometry, which only pays off when shading
+        // is expensive and there is a lot of overdraw.
+
+        const char *depth_value = getenv("VK_BASE_DEPTH");
+
+        if (depth_value != NULL) {
+            if (strcmp(depth_value, "0") == 0) {
+                depth_mode = DEPTH_MODE_DISABLED;
+            } else if (strcmp(depth_value, "1") == 0) {
+                depth_mode = DEPTH_MODE_ENABLED;
+            } else if (strcmp(depth_value, "prepass") == 0) {
+                depth_mode = DEPTH_MODE_PREPASS;
+            } else {
+                fprintf(stderr, "error (config): Unknown depth mode (name: \"%s\"), expected \"0\", \"1\" or \"prepass\".\n", depth_value);
+                return 1;
+            }
+        }
+
+        // Multisampling renders into a transient multisampled image, which is resolved into the
+        // scene image at the end of the subpass.
+
+        const char *sample_count_value = getenv("VK_BASE_MSAA");
+
+        if (sample_count_value != NULL) {
+            uint64_t value = 0;
+
+            if (!config_parse_uint(sample_count_value, 8, &value) || (value != 1 && value != 2 && value != 4 && value != 8)) {
+                fprintf(stderr, "error (config): The MSAA sample count must be 1, 2, 4 or 8.\n");
+                return 1;
+            }
+
+            sample_count = (uint32_t)value;
+        }
+
+        const char *instance_count_value = getenv("VK_BASE_INSTANCE_COUNT");
+
+        if (instance_count_value != NULL) {
+            uint64_t value = 0;
+
+            if (!config_parse_uint(instance_count_value, UINT32_MAX, &value) || value < 1) {
+                fprintf(stderr, "error (config): The instance count must be a whole number between 1 and %u.\n", UINT32_MAX);
+                return 1;
+            }
+
+            instance_count = (uint32_t)value;
+        }
+
+        const long online_processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (online_processor_count > 0) {
+            record_thread_count = (uint32_t)online_processor_count < MAX_RECORD_THREADS ? (uint32_t)online_processor_count : MAX_RECORD_THREADS;
+            pipeline_thread_count = (uint32_t)online_processor_count < MAX_PIPELINE_THREADS ? (uint32_t)online_processor_count : MAX_PIPELINE_THREADS;
+        }
+
+        // Without multi-draw indirect, the draws are recorded by one thread per core by default.
+
+        const char *record_thread_count_value = getenv("VK_BASE_RECORD_THREADS");
+
+        if (record_thread_count_value != NULL) {
+            uint64_t value = 0;
+
+            if (!config_parse_uint(record_thread_count_value, MAX_RECORD_THREADS, &value) || value < 1) {
+                fprintf(stderr, "error (config): The number of recording threads must be between 1 and %u.\n", MAX_RECORD_THREADS);
+                return 1;
+            }
+
+            record_thread_count = (uint32_t)value;
+        }
+
+        // Pipelines are compiled in the background, the scene is drawn once its pipelines are ready.
+
+        const char *pipeline_thread_count_value = getenv("VK_BASE_PIPELINE_THREADS");
+
+        if (pipeline_thread_count_value != NULL) {
+            uint64_t value = 0;
+
+            if (!config_parse_uint(pipeline_thread_count_value, MAX_PIPELINE_THREADS, &value) || value < 1) {
+                fprintf(stderr, "error (config): The number of pipeline compilation threads must be between 1 and %u.\n", MAX_PIPELINE_THREADS);
+                return 1;
+            }
+
+            pipeline_thread_count = (uint32_t)value;
+        }
+
+        // Shader files that change while running are reloaded and the pipelines that use them are
+        // rebuilt in the background.
+
+        const char *shader_reload_value = getenv("VK_BASE_SHADER_RELOAD");
+
+        if (shader_reload_value != NULL) {
+            enable_shader_reload = strcmp(shader_reload_value, "0") != 0;
+        }
+
+        // Compute work goes to a compute-only queue family if the device has one, so it overlaps
+        // the graphics work instead of running in between.
+
+        const char *async_compute_value = getenv("VK_BASE_ASYNC_COMPUTE");
+
+        if (async_compute_value != NULL) {
+            enable_async_compute = strcmp(async_compute_value, "0") != 0;
+        }
+
+        // The physical device is chosen automatically, unless it is pinned by (a part of) its name
+        // or its UUID, as printed at startup.
+
+        physical_device_selector = getenv("VK_BASE_DEVICE");
+
+        if (physical_device_selector != NULL && physical_device_selector[0] == '\0') {
+            physical_device_selector = NULL;
+        }
+
+        // The post-processing chain is a comma separated list of passes, each optionally followed by
+        // a colon and its strength ("bloom:0.3,tonemap,sharpen:0.5"). A pass may appear more than
+        // once. Without any passes, the scene is rendered in the output format and blitted as is.
+
+        const char *post_value = getenv("VK_BASE_POST");
+
+        if (post_value != NULL) {
+            const char *entry = post_value;
+
+            while (*entry != '\0') {
+                const size_t entry_length = strcspn(entry, ",");
+                const size_t name_length = strcspn(entry, ",:");
+                uint32_t pass = 0;
+
+                while (pass < POST_PASS_COUNT && (strlen(post_pass_names[pass]) != name_length || strncmp(entry, post_pass_names[pass], name_length) != 0)) {
+                    pass++;
+                }
+
+                if (pass == POST_PASS_COUNT) {
+                    fprintf(stderr, "error (config): Unknown post-processing pass (name: \"%.*s\"), expected \"bloom\", \"tonemap\" or \"sharpen\".\n", (int)name_length, entry);
+                    return 1;
+                }
+
+                if (post_pass_count == MAX_POST_PASSES) {
+                    fprintf(stderr, "error (config): At most %u post-processing passes can be chained.\n", MAX_POST_PASSES);
+                    return 1;
+                }
+
+                // The strength has to span the rest of the entry.
+
+                float strength = post_pass_default_strengths[pass];
+
+                if (name_length < entry_length) {
+                    const char *strength_value = entry + name_length + 1;
+                    char *strength_end = NULL;
+
+                    strength = strtof(strength_value, &strength_end);
+
+                    if (strength_end == strength_value || strength_end != entry + entry_length || !isfinite(strength)) {
+                        fprintf(stderr, "error (config): The strength of a post-processing pass must be a number (value: \"%.*s\").\n", (int)(entry_length - name_length - 1), strength_value);
+                        return 1;
+                    }
+                }
+
+                post_passes[post_pass_count++] = (PostPassConfig) {
+                    .pass = (PostPass)pass,
+                    .strength = strength,
+                };
+
+                post_bloom = post_bloom || pass == POST_PASS_BLOOM;
+                entry += entry_length;
+
+                if (*entry == ',') {
+                    entry++;
+                }
+            }
+        }
+
+        // The post-processing passes run in workgroups of the given width and height, which trade
+        // occupancy against the shared memory of their tiles.
+
+        const char *post_workgroup_value = getenv("VK_BASE_POST_WORKGROUP");
+
+        if (post_workgroup_value != NULL) {
+            const size_t width_length = strcspn(post_workgroup_value, "x");
+            char width_value[16] = { 0 };
+            uint64_t width = 0;
+            uint64_t height = 0;
+
+            if (width_length < sizeof width_value) {
+                memcpy(width_value, post_workgroup_value, width_length);
+            }
+
+            const bool valid = width_length < sizeof width_value && post_workgroup_value[width_length] == 'x'
+                && config_parse_uint(width_value, UINT32_MAX, &width) && config_parse_uint(post_workgroup_value + width_length + 1, UINT32_MAX, &height);
+
+            post_workgroup_size[0] = valid ? (uint32_t)width : 0;
+            post_workgroup_size[1] = valid ? (uint32_t)height : 0;
+
+            if (post_workgroup_size[0] < 1 || post_workgroup_size[1] < 1) {
+                fprintf(stderr, "error (config): The post-processing workgroup size must be given as \"<width>x<height>\", for example \"16x8\".\n");
+                return 1;
+            }
+
+            if (post_workgroup_size[0] > MAX_POST_WORKGROUP_SIZE || post_workgroup_size[1] > MAX_POST_WORKGROUP_SIZE) {
+                fprintf(stderr, "error (config): The post-processing workgroup size can be at most %ux%u.\n", MAX_POST_WORKGROUP_SIZE, MAX_POST_WORKGROUP_SIZE);
+                return 1;
+            }
+        }
+
+        // Frame timings are written to a file at shutdown (JSON if the path ends in ".json", CSV
+        // otherwise) and can be printed periodically while running.
+
+        stats_path = getenv("VK_BASE_STATS");
+
+        const char *stats_interval_value = getenv("VK_BASE_STATS_INTERVAL");
+
+        if (stats_interval_value != NULL && (!config_parse_number(stats_interval_value, &stats_interval) || stats_interval < 0.0)) {
+            fprintf(stderr, "error (config): The stats interval must be a number of seconds.\n");
+            return 1;
+        }
+    }
+
+    // Create a window (using GLFW).
+
+    GLFWwindow* window = NULL;
+
+    if (output_mode == OUTPUT_MODE_WINDOW) {
+        if (!glfwInit()) {
+            fprintf(stderr, "error (glfw): Failed to initialize.\n");
+            return 1;
+        }
+
+        glfwDefaultWindowHints();
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+
+        window = glfwCreateWindow(OUTPUT_WIDTH, OUTPUT_HEIGHT, "Vulkan Base", NULL, NULL);
+
+        if (window == NULL) {
+            fprintf(stderr, "error: (glfw): Failed to create a window.\n");
+            return 1;
+        }
+    }
+
+    // Create an instance.
+
+    VkInstance instance = VK_NULL_HANDLE;
+
+    {
+        // Select layers and extensions.
+
+        const char* const headless_surface_extension_names[] = { VK_KHR_SURFACE_EXTENSION_NAME, VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME };
+
+        uint32_t enabled_extension_count = 0;
+        const char* const* enabled_extension_names = NULL;
+
+        if (output_mode == OUTPUT_MODE_WINDOW) {
+            enabled_extension_names = glfwGetRequiredInstanceExtensions(&enabled_extension_count);
+        } else if (output_mode == OUTPUT_MODE_HEADLESS_SURFACE) {
+            enabled_extension_names = headless_surface_extension_names;
+            enabled_extension_count = sizeof headless_surface_extension_names / sizeof *headless_surface_extension_names;
+        }
+
+        uint32_t enabled_layer_count = enable_validation ? validation_layer_count : 0;
+        const char* const* enabled_layer_names = validation_layer_names;
+
+        // Check layer support.
+
+        {
+            uint32_t instance_layer_count = 0;
+            vkEnumerateInstanceLayerProperties(&instance_layer_count, NULL);
+            VkLayerProperties* instance_layer_properties = malloc(instance_layer_count * sizeof * instance_layer_properties);
+            vkEnumerateInstanceLayerProperties(&instance_layer_count, instance_layer_properties);
+
+            if (instance_layer_properties == NULL) {
+                fprintf(stderr, "error (vulkan): Failed to fetch instance layer properties.\n");
+                return 1;
+            }
+
+            for (uint32_t i = 0; i < enabled_layer_count; i++) {
+                bool layer_available = false;
+
+                for (uint32_t j = 0; j < instance_layer_count; j++) {
+                    if (strcmp(enabled_layer_names[i], instance_layer_properties[j].layerName) == 0) {
+                        layer_available = true;
+                        break;
+                    }
+                }
+
+                if (!layer_available) {
+                    fprintf(stderr, "error (vulkan): Requested instance layer (name: \"%s\") is not available.\n", enabled_layer_names[i]);
+                    return 1;
+                }
+            }
+
+            free(instance_layer_properties);
+        }
+
+        // Check extension support.
+
+        {
+            uint32_t instance_extension_count = 0;
+            vkEnumerateInstanceExtensionProperties(NULL, &instance_extension_count, NULL);
+            VkExtensionProperties* instance_extension_properties = malloc(instance_extension_count * sizeof * instance_extension_properties);
+            vkEnumerateInstanceExtensionProperties(NULL, &instance_extension_count, instance_extension_properties);
+
+            if (instance_extension_properties == NULL) {
+                fprintf(stderr, "error (vulkan): Failed to fetch instance layer properties.\n");
+                return 1;
+            }
+
+            for (uint32_t i = 0; i < enabled_extension_count; i++) {
+                bool extension_available = false;
+
+                for (uint32_t j = 0; j < instance_extension_count; j++) {
+                    if (strcmp(enabled_extension_names[i], instance_extension_properties[j].extensionName) == 0) {
+                        extension_available = true;
+                        break;
+                    }
+                }
+
+                if (!extension_available) {
+                    fprintf(stderr, "error (vulkan): Requested instance extension (name: \"%s\") is not available.\n", enabled_extension_names[i]);
+                    return 1;
+                }
+            }
+
+            free(instance_extension_properties);
+        }
+
+        // Configure the instance.
+
+        const VkApplicationInfo application_info = {
+            .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+            .pNext = NULL,
+            .pApplicationName = "Vulkan Application",
+            .applicationVersion = VK_MAKE_VERSION(0, 1, 0),
+            .pEngineName = "Vulkan Engine",
+            .engineVersion = VK_MAKE_VERSION(0, 1, 0),
+            .apiVersion = VK_API_VERSION_1_2,
+        };
+
+        const VkInstanceCreateInfo instance_create_info = {
+            .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .pApplicationInfo = &application_info,
+            .enabledLayerCount = enabled_layer_count,
+            .ppEnabledLayerNames = enabled_layer_names,
+            .enabledExtensionCount = enabled_extension_count,
+            .ppEnabledExtensionNames = enabled_extension_names,
+        };
+
+        // Create the instance.
+
+        const VkResult result = vkCreateInstance(&instance_create_info, NULL, &instance);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create an instance.\n");
+            return 1;
+        }
+    }
+
+    // Create a surface.
+
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
+
+    if (output_mode == OUTPUT_MODE_WINDOW) {
+        const VkResult result = glfwCreateWindowSurface(instance, window, NULL, &surface);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create a surface.\n");
+            return 1;
+        }
+    } else if (output_mode == OUTPUT_MODE_HEADLESS_SURFACE) {
+        const PFN_vkCreateHeadlessSurfaceEXT create_headless_surface = (PFN_vkCreateHeadlessSurfaceEXT)vkGetInstanceProcAddr(instance, "vkCreateHeadlessSurfaceEXT");
+
+        if (create_headless_surface == NULL) {
+            fprintf(stderr, "error (vulkan): Failed to load vkCreateHeadlessSurfaceEXT.\n");
+            return 1;
+        }
+
+        const VkHeadlessSurfaceCreateInfoEXT headless_surface_create_info = {
+            .sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT,
+            .pNext = NULL,
+            .flags = 0,
+        };
+
+        const VkResult result = create_headless_surface(instance, &headless_surface_create_info, NULL, &surface);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create a headless surface.\n");
+            return 1;
+        }
+    }
+
+    // Choose a physical device.
+
+    VkPhysicalDevice physical_device = VK_NULL_HANDLE;
+
+    {
+        // Fetch (all) physical devices.
+
+        uint32_t physical_device_count = 0;
+        vkEnumeratePhysicalDevices(instance, &physical_device_count, NULL);
+
+        if (physical_device_count < 1) {
+            fprintf(stderr, "error (vulkan): No physical devices are available.\n");
+            return 1;
+        }
+
+        VkPhysicalDevice* physical_devices = malloc(physical_device_count * sizeof * physical_devices);
+        const VkResult result = vkEnumeratePhysicalDevices(instance, &physical_device_count, physical_devices);
+
+        if ((result != VK_SUCCESS && result != VK_INCOMPLETE) || physical_devices == NULL) {
+            fprintf(stderr, "error (vulkan): Failed to fetch physical devices.\n");
+            free(physical_devices);
+            return 1;
+        }
+
+        // Rate every physical device and list them. The suitable device with the highest score
+        // is used, or the first suitable one that matches the selector.
+
+        PhysicalDeviceCandidate *candidates = malloc(physical_device_count * sizeof *candidates);
+
+        if (candidates == NULL) {
+            fprintf(stderr, "error (io): Failed to allocate the physical device candidates.\n");
+            free(physical_devices);
+            return 1;
+        }
+
+        const PhysicalDeviceCandidate *selected_candidate = NULL;
+        bool selector_matched = false;
+
+        printf("physical devices:\n");
+
+        for (uint32_t i = 0; i < physical_device_count; i++) {
+            PhysicalDeviceCandidate *candidate = &candidates[i];
+            physical_device_candidate_rate(candidate, physical_devices[i], surface, output_mode != OUTPUT_MODE_OFFSCREEN);
+
+            const VkPhysicalDeviceType type = candidate->properties.deviceType;
+            const char *type_name = (uint32_t)type < sizeof physical_device_type_names / sizeof *physical_device_type_names ? physical_device_type_names[type] : "unknown";
+
+            printf("  %u: %s (%s, %llu MiB device local, uuid %s): ", i, candidate->properties.deviceName, type_name, (unsigned long long)(candidate->device_local_size >> 20), candidate->uuid[0] != '\0' ? candidate->uuid : "unknown");
+
+            if (candidate->unsuitable_reason != NULL) {
+                printf("unsuitable, %s\n", candidate->unsuitable_reason);
+            } else {
+                printf("score %llu\n", (unsigned long long)candidate->score);
+            }
+
+            const bool matches = physical_device_selector != NULL && physical_device_candidate_matches(candidate, physical_device_selector);
+            selector_matched = selector_matched || matches;
+
+            if (candidate->unsuitable_reason != NULL || (physical_device_selector != NULL && !matches)) {
+                continue;
+            }
+
+            if (selected_candidate == NULL || (physical_device_selector == NULL && candidate->score > selected_candidate->score)) {
+                selected_candidate = candidate;
+            }
+        }
+
+        if (selected_candidate != NULL) {
+            physical_device = selected_candidate->physical_device;
+            printf("using physical device %u (%s)\n", (uint32_t)(selected_candidate - candidates), selected_candidate->properties.deviceName);
+
+            // Software rasterizers are fine for testing, but easy to end up on by accident.
+
+            if (selected_candidate->properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU && physical_device_selector == NULL) {
+                fprintf(stderr, "warning (vulkan): Using a CPU implementation (%s), no suitable GPU was found.\n", selected_candidate->properties.deviceName);
+            }
+        }
+
+        // Clean up.
+
+        free(candidates);
+        free(physical_devices);
+
+        if (physical_device == VK_NULL_HANDLE) {
+            if (physical_device_selector != NULL) {
+                fprintf(stderr, "error (config): No suitable physical device matches \"%s\"%s.\n", physical_device_selector, selector_matched ? " (the matching ones are unsuitable)" : "");
+            } else {
+                fprintf(stderr, "error (vulkan): No physical device is suitable.\n");
+            }
+
+            return 1;
+        }
+    }
+
+    // Find queue families.
+
+    uint32_t graphics_queue_family_index = 0;
+    uint32_t graphics_queue_timestamp_valid_bits = 0;
+    uint32_t transfer_queue_family_index = 0;
+    uint32_t compute_queue_family_index = 0;
+    uint32_t device_queue_family_indices[3];
+    uint32_t device_queue_family_count = 0;
+
+    {
+        // Fetch the properties of all queue families.
+
+        uint32_t queue_family_count = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, NULL);
+
+        if (queue_family_count < 1) {
+            fprintf(stderr, "error (vulkan): No queue families are available.\n");
+            return 1;
+        }
+
+        VkQueueFamilyProperties* queue_family_properties = malloc(queue_family_count * sizeof * queue_family_properties);
+        vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_family_properties);
+
+        if (queue_family_properties == NULL) {
+            fprintf(stderr, "error (vulkan): Failed to fetch queue family properties.\n");
+            return 1;
+        }
+
+        // Find all queue families that are needed.
+
+        bool graphics_queue_family_found = false;
+
+        for (uint32_t i = 0; i < queue_family_count; i++) {
+            // Offscreen rendering never presents, so every graphics queue family will do.
+
+            VkBool32 queue_family_supports_presentation = surface == VK_NULL_HANDLE;
+
+            if (surface != VK_NULL_HANDLE) {
+                vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, i, surface, &queue_family_supports_presentation);
+            }
+
+            // Without a compute-only queue family, the culling shader runs on the graphics queue, so
+            // it has to support compute too.
+
+            const VkQueueFlags required_queue_flags = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
+
+            if (!graphics_queue_family_found && queue_family_supports_presentation && (queue_family_properties[i].queueFlags & required_queue_flags) == required_queue_flags) {
+                graphics_queue_family_index = i;
+                graphics_queue_timestamp_valid_bits = queue_family_properties[i].timestampValidBits;
+                graphics_queue_family_found = true;
+            }
+        }
+
+        if (!graphics_queue_family_found) {
+            fprintf(stderr, "error (vulkan): Failed to find a queue family that supports graphics and compute computation.\n");
+            return 1;
+        }
+
+        // Uploads go to a transfer-only queue family (the copy engine of most discrete GPUs), so
+        // they run next to the rendering. Without one, they share the graphics queue.
+
+        transfer_queue_family_index = graphics_queue_family_index;
+
+        for (uint32_t i = 0; i < queue_family_count; i++) {
+            const VkQueueFlags queue_flags = queue_family_properties[i].queueFlags;
+
+            if (queue_flags & VK_QUEUE_TRANSFER_BIT && !(queue_flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+                transfer_queue_family_index = i;
+                break;
+            }
+        }
+
+        // Async compute goes to a compute-only queue family. Without one, compute work is recorded
+        // into the frame's graphics command buffer.
+
+        compute_queue_family_index = graphics_queue_family_index;
+
+        for (uint32_t i = 0; i < queue_family_count && enable_async_compute; i++) {
+            const VkQueueFlags queue_flags = queue_family_properties[i].queueFlags;
+
+            if (queue_flags & VK_QUEUE_COMPUTE_BIT && !(queue_flags & VK_QUEUE_GRAPHICS_BIT)) {
+                compute_queue_family_index = i;
+                break;
+            }
+        }
+
+        // One queue is created per distinct queue family.
+
+        const uint32_t queue_family_indices[] = { graphics_queue_family_index, transfer_queue_family_index, compute_queue_family_index };
+
+        for (uint32_t i = 0; i < sizeof queue_family_indices / sizeof *queue_family_indices; i++) {
+            bool duplicate = false;
+
+            for (uint32_t j = 0; j < device_queue_family_count; j++) {
+                duplicate = duplicate || device_queue_family_indices[j] == queue_family_indices[i];
+            }
+
+            if (!duplicate) {
+                device_queue_family_indices[device_queue_family_count++] = queue_family_indices[i];
+            }
+        }
+
+        // Clean up.
+
+        free(queue_family_properties);
+    }
+
+    // Create a logical device.
+
+    VkDevice device = VK_NULL_HANDLE;
+    bool multi_draw_indirect = false;
+    bool draw_indirect_count = false;
+
+    {
+        // Configure the queues.
+
+        float queue_priorities[] = { 1.0f };
+
+        VkDeviceQueueCreateInfo queue_create_infos[3];
+        const uint32_t queue_create_info_count = device_queue_family_count;
+
+        for (uint32_t i = 0; i < queue_create_info_count; i++) {
+            queue_create_infos[i] = (VkDeviceQueueCreateInfo) {
+                .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+                .pNext = NULL,
+                .flags = 0,
+                .queueFamilyIndex = device_queue_family_indices[i],
+                .queueCount = 1,
+                .pQueuePriorities = queue_priorities,
+            };
+        }
+
+        // Select physical device features. All indirect draws of a frame are issued with a single
+        // command if the device supports both multi-draw indirect and indirect draws starting at a
+        // non-zero instance. If it also supports indirect draw counts, that command only issues the
+        // draws the culling shader counted.
+
+        VkPhysicalDeviceVulkan12Features supported_vulkan_12_features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+            .pNext = NULL,
+        };
+
+        VkPhysicalDeviceFeatures2 supported_physical_device_features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &supported_vulkan_12_features,
+        };
+
+        vkGetPhysicalDeviceFeatures2(physical_device, &supported_physical_device_features);
+
+        multi_draw_indirect = supported_physical_device_features.features.multiDrawIndirect && supported_physical_device_features.features.drawIndirectFirstInstance;
+        draw_indirect_count = multi_draw_indirect && supported_vulkan_12_features.drawIndirectCount;
+
+        // That command is recorded right into the frame command buffer, so only devices without
+        // multi-draw indirect record on threads.
+
+        if (multi_draw_indirect) {
+            record_thread_count = 1;
+        }
+
+        // The bindless heap needs runtime sized descriptor arrays that are partially bound and
+        // updated after bind, frames and uploads are tracked with timeline semaphores. The support
+        // for both was checked when the physical device was chosen.
+
+        VkPhysicalDeviceVulkan12Features vulkan_12_features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+            .pNext = NULL,
+            .runtimeDescriptorArray = VK_TRUE,
+            .descriptorBindingPartiallyBound = VK_TRUE,
+            .descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE,
+            .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+            .timelineSemaphore = VK_TRUE,
+            .drawIndirectCount = draw_indirect_count,
+        };
+
+        const VkPhysicalDeviceFeatures2 physical_device_features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &vulkan_12_features,
+            .features = {
+                .multiDrawIndirect = multi_draw_indirect,
+                .drawIndirectFirstInstance = multi_draw_indirect,
+            },
+        };
+
+        //  Select layers and extensions. Support for the swapchain extension was checked when the
+        // physical device was chosen.
+
+        const char* const device_extension_names[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+        const uint32_t device_extension_count = output_mode == OUTPUT_MODE_OFFSCREEN ? 0 : sizeof device_extension_names / sizeof * device_extension_names;
+
+        const char* const* enabled_layer_names = validation_layer_names;
+        const uint32_t enabled_layer_count = enable_validation ? validation_layer_count : 0;
+
+        // Configure the device.
+
+        const VkDeviceCreateInfo device_create_info = {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+            .pNext = &physical_device_features,
+            .flags = 0,
+            .queueCreateInfoCount = queue_create_info_count,
+            .pQueueCreateInfos = queue_create_infos,
+            .enabledLayerCount = enabled_layer_count,
+            .ppEnabledLayerNames = enabled_layer_names,
+            .enabledExtensionCount = device_extension_count,
+            .ppEnabledExtensionNames = device_extension_names,
+            .pEnabledFeatures = NULL,
+        };
+
+        const VkResult result = vkCreateDevice(physical_device, &device_create_info, NULL, &device);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create a device.\n");
+            return 1;
+        }
+    }
+
+    // Get queues from the device.
+
+    VkQueue graphics_queue = VK_NULL_HANDLE;
+    VkQueue transfer_queue = VK_NULL_HANDLE;
+    VkQueue compute_queue = VK_NULL_HANDLE;
+
+    {
+        vkGetDeviceQueue(device, graphics_queue_family_index, 0, &graphics_queue);
+        vkGetDeviceQueue(device, transfer_queue_family_index, 0, &transfer_queue);
+        vkGetDeviceQueue(device, compute_queue_family_index, 0, &compute_queue);
+    }
+
+    // Set up async compute if the device has a compute-only queue family.
+
+    const bool async_compute = compute_queue_family_index != graphics_queue_family_index;
+    ComputeQueue compute = { 0 };
+
+    if (async_compute) {
+        const VkResult result = compute_queue_create(&compute, device, compute_queue, compute_queue_family_index);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create the compute queue.\n");
+            return 1;
+        }
+    }
+
+    // Create the memory allocator. All device memory is allocated through it.
+
+    MemoryAllocator memory_allocator;
+
+    {
+        memory_allocator_init(&memory_allocator, device, physical_device);
+    }
+
+    // Create the bindless descriptor heap, as large as the update after bind limits allow.
+
+    BindlessHeap bindless_heap;
+
+    {
+        VkPhysicalDeviceVulkan12Properties vulkan_12_properties = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES,
+            .pNext = NULL,
+        };
+
+        VkPhysicalDeviceProperties2 physical_device_properties = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &vulkan_12_properties,
+        };
+
+        vkGetPhysicalDeviceProperties2(physical_device, &physical_device_properties);
+
+        // Both arrays are visible to every stage and share the per-stage resource limit.
+
+        const uint32_t resource_limit = vulkan_12_properties.maxPerStageUpdateAfterBindResources / 2;
+        uint32_t storage_buffer_capacity = MAX_BINDLESS_STORAGE_BUFFERS;
+        uint32_t sampled_image_capacity = MAX_BINDLESS_SAMPLED_IMAGES;
+
+        if (storage_buffer_capacity > vulkan_12_properties.maxPerStageDescriptorUpdateAfterBindStorageBuffers) {
+            storage_buffer_capacity = vulkan_12_properties.maxPerStageDescriptorUpdateAfterBindStorageBuffers;
+        }
+
+        if (storage_buffer_capacity > resource_limit) {
+            storage_buffer_capacity = resource_limit;
+        }
+
+        if (sampled_image_capacity > vulkan_12_properties.maxPerStageDescriptorUpdateAfterBindSampledImages) {
+            sampled_image_capacity = vulkan_12_properties.maxPerStageDescriptorUpdateAfterBindSampledImages;
+        }
+
+        if (sampled_image_capacity > resource_limit) {
+            sampled_image_capacity = resource_limit;
+        }
+
+        const VkResult result = bindless_heap_create(&bindless_heap, device, storage_buffer_capacity, sampled_image_capacity);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create the bindless descriptor heap.\n");
+            return 1;
+        }
+    }
+
+    // Choose a surface format.
+
+    VkSurfaceFormatKHR surface_format;
+
+    if (surface != VK_NULL_HANDLE) {
+        // Get all available surface formats.
+
+        uint32_t surface_format_count = 0;
+        vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &surface_format_count, NULL);
+
+        if (surface_format_count < 1) {
+            fprintf(stderr, "error (vulkan): No surface formats are available.\n");
+            return 1;
+        }
+
+        VkSurfaceFormatKHR *surface_formats = malloc(surface_format_count * sizeof *surface_formats);
+        const VkResult result = vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &surface_format_count, surface_formats);
+
+        if ((result != VK_SUCCESS && result != VK_INCOMPLETE) || surface_formats == NULL) {
+            fprintf(stderr, "error (vulkan): Failed to fetch surface formats.\n");
+            free(surface_formats);
+            return 1;
+        }
+
+        // Find a surface format.
+
+        surface_format = surface_formats[0];
+
+        for (uint32_t i = 0; i < surface_format_count; i++) {
+
+            // Find an SRGB surface.
+
+            if (surface_formats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR){
+                switch (surface_formats[i].format) {
+                    case VK_FORMAT_B8G8R8A8_SRGB:
+                    case VK_FORMAT_R8G8B8A8_SRGB:
+                    {
+                        surface_format = surface_formats[i];
+                        break;
+                    }
+                };
+            }
+        }
+
+        // Clean up.
+
+        free(surface_formats);
+    } else {
+        // Without a surface, find a color format that can be rendered to and blitted between
+        // images (for the upscaling).
+
+        const VkFormat candidate_formats[] = { VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_R8G8B8A8_SRGB };
+        const uint32_t candidate_format_count = sizeof candidate_formats / sizeof *candidate_formats;
+
+        surface_format.format = VK_FORMAT_UNDEFINED;
+        surface_format.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+
+        for (uint32_t i = 0; i < candidate_format_count; i++) {
+            VkFormatProperties format_properties;
+            vkGetPhysicalDeviceFormatProperties(physical_device, candidate_formats[i], &format_properties);
+
+            const VkFormatFeatureFlags required_features = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+
+            if ((format_properties.optimalTilingFeatures & required_features) == required_features) {
+                surface_format.format = candidate_formats[i];
+                break;
+            }
+        }
+
+        if (surface_format.format == VK_FORMAT_UNDEFINED) {
+            fprintf(stderr, "error (vulkan): No offscreen color formats are available.\n");
+            return 1;
+        }
+    }
+
+    // Choose a present mode.
+
+    VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
+
+    if (surface != VK_NULL_HANDLE) {
+        // Get all available present modes.
+
+        uint32_t present_mode_count = 0;
+        vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &present_mode_count, NULL);
+
+        if (present_mode_count < 1) {
+            fprintf(stderr, "error (vulkan): No presentation modes are available.\n");
+            return 1;
+        }
+
+        VkPresentModeKHR *present_modes = malloc(present_mode_count * sizeof *present_modes);
+        const VkResult result = vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &present_mode_count, present_modes);
+
+        if ((result != VK_SUCCESS && result != VK_INCOMPLETE) || present_modes == NULL) {
+            fprintf(stderr, "error (vulkan): Failed to fetch presentation modes.\n");
+            free(present_modes);
+            return 1;
+        }
+
+        // Use the requested present mode or the first supported fallback. FIFO is required to
+        // be supported, so it is always available as the last resort.
+
+        for (uint32_t i = 0; i <= present_mode_option->fallback_count; i++) {
+            const VkPresentModeKHR candidate_present_mode = i == 0 ? present_mode_option->present_mode : present_mode_option->fallbacks[i - 1];
+            bool candidate_supported = false;
+
+            for (uint32_t j = 0; j < present_mode_count; j++) {
+                if (present_modes[j] == candidate_present_mode) {
+                    candidate_supported = true;
+                    break;
+                }
+            }
+
+            if (candidate_supported) {
+                present_mode = candidate_present_mode;
+                break;
+            }
+        }
+
+        if (present_mode != present_mode_option->present_mode) {
+            fprintf(stderr, "warning (vulkan): Present mode \"%s\" is not supported, using \"%s\" instead.\n", present_mode_option->name, present_mode_name(present_mode));
+        }
+
+        // Clean up.
+
+        free(present_modes);
+    }
+
+    // Choose the scene format and the upscaling filter. With post-processing, the scene is rendered
+    // in HDR and the passes read and write it as a storage image, the blit onto the output image
+    // converts it to the output format. Without, the scene uses the output format.
+
+    const VkFormat scene_format = post_pass_count > 0 ? VK_FORMAT_R16G16B16A16_SFLOAT : surface_format.format;
+    VkFilter upscale_filter = VK_FILTER_NEAREST;
+
+    {
+        // The scene format has to support being rendered to and blitted from, the output format
+        // being blitted to.
+
+        VkFormatProperties scene_format_properties;
+        vkGetPhysicalDeviceFormatProperties(physical_device, scene_format, &scene_format_properties);
+
+        VkFormatProperties output_format_properties;
+        vkGetPhysicalDeviceFormatProperties(physical_device, surface_format.format, &output_format_properties);
+
+        VkFormatFeatureFlags required_scene_features = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_BLIT_SRC_BIT;
+
+        if (post_pass_count > 0) {
+            required_scene_features |= VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT;
+        }
+
+        if ((scene_format_properties.optimalTilingFeatures & required_scene_features) != required_scene_features
+            || !(output_format_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT)) {
+            fprintf(stderr, "error (vulkan): The surface format can not be used for scaled rendering.\n");
+            return 1;
+        }
+
+        // Bilinear filtering hides most of the blockiness of a lower resolution.
+
+        if (scene_format_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) {
+            upscale_filter = VK_FILTER_LINEAR;
+        }
+    }
+
+    // Check the post-processing workgroup size against the device limits, including the shared
+    // memory of the largest tile in the chain.
+
+    if (post_pass_count > 0) {
+        VkPhysicalDeviceProperties physical_device_properties;
+        vkGetPhysicalDeviceProperties(physical_device, &physical_device_properties);
+
+        const VkPhysicalDeviceLimits *limits = &physical_device_properties.limits;
+        uint32_t shared_memory_size = 0;
+
+        for (uint32_t i = 0; i < post_pass_count; i++) {
+            const uint32_t pass_shared_memory_size = post_pass_shared_memory_size(post_passes[i].pass);
+
+            if (pass_shared_memory_size > shared_memory_size) {
+                shared_memory_size = pass_shared_memory_size;
+            }
+        }
+
+        if (post_workgroup_size[0] > limits->maxComputeWorkGroupSize[0] || post_workgroup_size[1] > limits->maxComputeWorkGroupSize[1]
+            || post_workgroup_size[0] * post_workgroup_size[1] > limits->maxComputeWorkGroupInvocations || shared_memory_size > limits->maxComputeSharedMemorySize) {
+            fprintf(stderr, "error (config): A post-processing workgroup of %ux%u exceeds the device limits (%u invocations, %u bytes of shared memory).\n",
+                post_workgroup_size[0], post_workgroup_size[1], limits->maxComputeWorkGroupInvocations, limits->maxComputeSharedMemorySize);
+            return 1;
+        }
+    }
+
+    // Choose the depth format. Every device supports at least one of these as a depth attachment.
+
+    VkFormat depth_format = VK_FORMAT_UNDEFINED;
+
+    if (depth_mode != DEPTH_MODE_DISABLED) {
+        const VkFormat candidate_formats[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM };
+        const uint32_t candidate_format_count = sizeof candidate_formats / sizeof *candidate_formats;
+
+        for (uint32_t i = 0; i < candidate_format_count; i++) {
+            VkFormatProperties format_properties;
+            vkGetPhysicalDeviceFormatProperties(physical_device, candidate_formats[i], &format_properties);
+
+            if (format_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+                depth_format = candidate_formats[i];
+                break;
+            }
+        }
+
+        if (depth_format == VK_FORMAT_UNDEFINED) {
+            fprintf(stderr, "warning (vulkan): No depth formats are available, rendering without depth.\n");
+            depth_mode = DEPTH_MODE_DISABLED;
+        }
+    }
+
+    // Choose the sample count, lowering the requested one until the color and depth attachments
+    // both support it. One sample is always supported.
+
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+
+    {
+        VkPhysicalDeviceProperties physical_device_properties;
+        vkGetPhysicalDeviceProperties(physical_device, &physical_device_properties);
+
+        VkSampleCountFlags supported_samples = physical_device_properties.limits.framebufferColorSampleCounts;
+
+        if (depth_mode != DEPTH_MODE_DISABLED) {
+            supported_samples &= physical_device_properties.limits.framebufferDepthSampleCounts;
+        }
+
+        samples = (VkSampleCountFlagBits)sample_count;
+
+        while (samples > VK_SAMPLE_COUNT_1_BIT && (supported_samples & samples) == 0) {
+            samples = (VkSampleCountFlagBits)(samples >> 1);
+        }
+
+        if ((uint32_t)samples != sample_count) {
+            fprintf(stderr, "warning (vulkan): %ux MSAA is not supported, using %ux.\n", sample_count, (uint32_t)samples);
+        }
+    }
+
+    // Create the offscreen images (instead of a swapchain).
+
+    VkExtent2D image_extent = { 0, 0 };
+
+    uint32_t offscreen_image_count = 0;
+    VkImage *offscreen_images = NULL;
+    MemoryAllocation *offscreen_image_allocations = NULL;
+
+    if (output_mode == OUTPUT_MODE_OFFSCREEN) {
+        image_extent.width = OUTPUT_WIDTH;
+        image_extent.height = OUTPUT_HEIGHT;
+
+        // Create one image per frame in flight, like a swapchain would.
+
+        offscreen_image_count = frames_in_flight;
+        offscreen_images = calloc(offscreen_image_count, sizeof *offscreen_images);
+        offscreen_image_allocations = calloc(offscreen_image_count, sizeof *offscreen_image_allocations);
+
+        if (offscreen_images == NULL || offscreen_image_allocations == NULL) {
+            fprintf(stderr, "error (io): Failed to allocate the offscreen images.\n");
+            return 1;
+        }
+
+        for (uint32_t i = 0; i < offscreen_image_count; i++) {
+            const VkImageCreateInfo image_create_info = {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+                .pNext = NULL,
+                .flags = 0,
+                .imageType = VK_IMAGE_TYPE_2D,
+                .format = surface_format.format,
+                .extent = {
+                    .width = image_extent.width,
+                    .height = image_extent.height,
+                    .depth = 1,
+                },
+                .mipLevels = 1,
+                .arrayLayers = 1,
+                .samples = VK_SAMPLE_COUNT_1_BIT,
+                .tiling = VK_IMAGE_TILING_OPTIMAL,
+                .usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+                .queueFamilyIndexCount = 0,
+                .pQueueFamilyIndices = NULL,
+                .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            };
+
+            VkResult result = vkCreateImage(device, &image_create_info, NULL, &offscreen_images[i]);
+
+            if (result != VK_SUCCESS) {
+                fprintf(stderr, "error (vulkan): Failed to create an offscreen image.\n");
+                return 1;
+            }
+
+            // Allocate memory for the image, preferably device local.
+
+            VkMemoryRequirements memory_requirements;
+            vkGetImageMemoryRequirements(device, offscreen_images[i], &memory_requirements);
+
+            result = memory_allocate(&memory_allocator, &memory_requirements, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &offscreen_image_allocations[i]);
+
+            if (result != VK_SUCCESS) {
+                fprintf(stderr, "error (vulkan): Failed to allocate memory for an offscreen image.\n");
+                return 1;
+            }
+
+            result = vkBindImageMemory(device, offscreen_images[i], offscreen_image_allocations[i].memory, offscreen_image_allocations[i].offset);
+
+            if (result != VK_SUCCESS) {
+                fprintf(stderr, "error (vulkan): Failed to bind the memory of an offscreen image.\n");
+                return 1;
+            }
+        }
+    }
+
+    // Create the render pass.
+
+    VkRenderPass graphics_render_pass = VK_NULL_HANDLE;
+    uint32_t render_pass_attachment_count = 0;
+
+    {
+        // Configure the attachments: the color image, the depth image and, with multisampling, the
+        // scene image the color image is resolved into. The scene image is post-processed or
+        // blitted to the output image afterwards, everything else is only needed during the pass.
+        // The render graph moves the images in and out of the attachment layouts and places the
+        // barriers around the pass, so the attachments stay in the layouts of the subpasses.
+
+        const bool multisampled = samples != VK_SAMPLE_COUNT_1_BIT;
+
+        VkAttachmentDescription attachment_descriptions[3];
+        uint32_t attachment_count = 0;
+
+        attachment_descriptions[attachment_count++] = (VkAttachmentDescription) {
+            .flags = 0,
+            .format = scene_format,
+            .samples = samples,
+            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+            .storeOp = multisampled ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE,
+            .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+            .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        };
+
+        const VkAttachmentReference color_attachment_reference = {
+            .attachment = 0,
+            .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        };
+
+        VkAttachmentReference depth_attachment_reference = {
+            .attachment = VK_ATTACHMENT_UNUSED,
+            .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        };
+
+        if (depth_mode != DEPTH_MODE_DISABLED) {
+            depth_attachment_reference.attachment = attachment_count;
+
+            attachment_descriptions[attachment_count++] = (VkAttachmentDescription) {
+                .flags = 0,
+                .format = depth_format,
+                .samples = samples,
+                .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+                .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+                .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                .initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            };
+        }
+
+        // The resolve happens at the end of the subpass, so the samples never leave the tile.
+
+        VkAttachmentReference resolve_attachment_reference = {
+            .attachment = VK_ATTACHMENT_UNUSED,
+            .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        };
+
+        if (multisampled) {
+            resolve_attachment_reference.attachment = attachment_count;
+
+            attachment_descriptions[attachment_count++] = (VkAttachmentDescription) {
+                .flags = 0,
+                .format = scene_format,
+                .samples = VK_SAMPLE_COUNT_1_BIT,
+                .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+                .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+                .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                .initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            };
+        }
+
+        // With a depth pre-pass, the first subpass only writes depth and the second one shades.
+
+        const VkSubpassDescription subpass_descriptions[] = {
+            {
+                .flags = 0,
+                .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+                .inputAttachmentCount = 0,
+                .pInputAttachments = NULL,
+                .colorAttachmentCount = 0,
+                .pColorAttachments = NULL,
+                .pResolveAttachments = NULL,
+                .pDepthStencilAttachment = &depth_attachment_reference,
+                .preserveAttachmentCount = 0,
+                .pPreserveAttachments = NULL,
+            },
+            {
+                .flags = 0,
+                .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+                .inputAttachmentCount = 0,
+                .pInputAttachments = NULL,
+                .colorAttachmentCount = 1,
+                .pColorAttachments = &color_attachment_reference,
+                .pResolveAttachments = multisampled ? &resolve_attachment_reference : NULL,
+                .pDepthStencilAttachment = depth_mode != DEPTH_MODE_DISABLED ? &depth_attachment_reference : NULL,
+                .preserveAttachmentCount = 0,
+                .pPreserveAttachments = NULL,
+            },
+        };
+
+        const uint32_t first_subpass_description = depth_mode == DEPTH_MODE_PREPASS ? 0 : 1;
+
+        // The depth pre-pass has to be done before shading tests against it. Everything outside
+        // the pass is ordered by the barriers of the render graph.
+
+        const VkPipelineStageFlags fragment_test_stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+
+        const VkSubpassDependency subpass_dependency = {
+            .srcSubpass = 0,
+            .dstSubpass = 1,
+            .srcStageMask = fragment_test_stages,
+            .dstStageMask = fragment_test_stages,
+            .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+            .dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
+        };
+
+        const VkRenderPassCreateInfo render_pass_create_info = {
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .attachmentCount = attachment_count,
+            .pAttachments = attachment_descriptions,
+            .subpassCount = depth_mode == DEPTH_MODE_PREPASS ? 2 : 1,
+            .pSubpasses = &subpass_descriptions[first_subpass_description],
+            .dependencyCount = depth_mode == DEPTH_MODE_PREPASS ? 1 : 0,
+            .pDependencies = depth_mode == DEPTH_MODE_PREPASS ? &subpass_dependency : NULL,
+        };
+
+        // Create the render pass.
+
+        const VkResult result = vkCreateRenderPass(device, &render_pass_create_info, NULL, &graphics_render_pass);
+        render_pass_attachment_count = attachment_count;
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create the render pass.\n");
+            return 1;
+        }
+    }
+
+    // Create the shader modules from the embedded SPIR-V.
+
+    ShaderCache shader_cache = {
+        .device = device,
+        .entries = NULL,
+        .entry_count = 0,
+        .entry_capacity = 0,
+    };
+
+    VkShaderModule shader_modules[SHADER_FILE_COUNT];
+
+    for (uint32_t i = 0; i < SHADER_FILE_COUNT; i++) {
+        const ShaderLoadResult result = shader_cache_get(&shader_cache, shader_codes[i], shader_code_sizes[i], &shader_modules[i]);
+
+        if (result != SHADER_LOAD_SUCCESS) {
+            fprintf(stderr, "error (%s): Failed to create the embedded shader '%s', %s.\n", result == SHADER_LOAD_ERROR_VULKAN ? "vulkan" : "io", shader_file_names[i], shader_load_result_descriptions[result]);
+            return 1;
+        }
+    }
+
+    // Create the pipeline cache.
+
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+
+    {
+        // Load the cache data from the previous run, if there is any.
+
+        size_t pipeline_cache_data_size = 0;
+        uint8_t *pipeline_cache_data = NULL;
+
+        if (pipeline_cache_path[0] != '\0') {
+            FILE *pipeline_cache_file = fopen(pipeline_cache_path, "rb");
+
+            if (pipeline_cache_file != NULL) {
+                fseek(pipeline_cache_file, 0L, SEEK_END);
+                const long pipeline_cache_file_size = ftell(pipeline_cache_file);
+                fseek(pipeline_cache_file, 0L, SEEK_SET);
+
+                if (pipeline_cache_file_size > 0) {
+                    pipeline_cache_data = malloc((size_t)pipeline_cache_file_size);
+
+                    if (pipeline_cache_data != NULL && fread(pipeline_cache_data, (size_t)pipeline_cache_file_size, 1, pipeline_cache_file) == 1) {
+                        pipeline_cache_data_size = (size_t)pipeline_cache_file_size;
+                    }
+                }
+
+                fclose(pipeline_cache_file);
+            }
+        }
+
+        // Only pass the data on if it was written by the same device and driver. Drivers are
+        // supposed to reject foreign data themselves, but not all of them do so gracefully.
+
+        if (pipeline_cache_data_size > 0) {
+            VkPhysicalDeviceProperties physical_device_properties;
+            vkGetPhysicalDeviceProperties(physical_device, &physical_device_properties);
+
+            // The header is laid out as: header size, header version, vendor ID, device ID (all
+            // 32-bit) and the 16 byte pipeline cache UUID.
+
+            uint32_t header[4] = { 0 };
+
+            if (pipeline_cache_data_size >= sizeof header + VK_UUID_SIZE) {
+                memcpy(header, pipeline_cache_data, sizeof header);
+            }
+
+            const bool pipeline_cache_data_valid = header[0] >= sizeof header + VK_UUID_SIZE
+                && header[0] <= pipeline_cache_data_size
+                && header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+                && header[2] == physical_device_properties.vendorID
+                && header[3] == physical_device_properties.deviceID
+                && memcmp(pipeline_cache_data + sizeof header, physical_device_properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+
+            if (!pipeline_cache_data_valid) {
+                fprintf(stderr, "warning (vulkan): Ignoring the pipeline cache (path: \"%s\"), it belongs to a different device or driver.\n", pipeline_cache_path);
+                pipeline_cache_data_size = 0;
+            }
+        }
+
+        // Create the cache.
+
+        const VkPipelineCacheCreateInfo pipeline_cache_create_info = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .initialDataSize = pipeline_cache_data_size,
+            .pInitialData = pipeline_cache_data_size > 0 ? pipeline_cache_data : NULL,
+        };
+
+        const VkResult result = vkCreatePipelineCache(device, &pipeline_cache_create_info, NULL, &pipeline_cache);
+
+        free(pipeline_cache_data);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create the pipeline cache.\n");
+            return 1;
+        }
+    }
+
+    // Start compiling pipelines in the background.
+
+    PipelineCompiler pipeline_compiler;
+
+    if (!pipeline_compiler_start(&pipeline_compiler, pipeline_thread_count)) {
+        fprintf(stderr, "error (io): Failed to start the pipeline compilation threads.\n");
+        return 1;
+    }
+
+    // Create the graphics pipeline layout and queue the pipelines using it. The build info of each
+    // pipeline in use is kept, the frame loop picks the pipeline up once it is compiled and whenever
+    // its shaders change.
+
+    PipelineBuildInfo pipeline_build_infos[PIPELINE_KIND_COUNT];
+    VkPipeline pipelines[PIPELINE_KIND_COUNT] = { VK_NULL_HANDLE };
+    bool active_pipelines[PIPELINE_KIND_COUNT] = { false };
+    bool pending_pipelines[PIPELINE_KIND_COUNT] = { false };
+    VkPipelineLayout graphics_pipeline_layout = VK_NULL_HANDLE;
+
+    {
+        // Create the pipeline layout.
+
+        {
+            const VkPushConstantRange push_constant_range = {
+                .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                .offset = 0,
+                .size = sizeof(PushConstants),
+            };
+
+            const VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+                .pNext = NULL,
+                .flags = 0,
+                .setLayoutCount = 1,
+                .pSetLayouts = &bindless_heap.descriptor_set_layout,
+                .pushConstantRangeCount = 1,
+                .pPushConstantRanges = &push_constant_range,
+            };
+
+            const VkResult result = vkCreatePipelineLayout(device, &pipeline_layout_create_info, NULL, &graphics_pipeline_layout);
+
+            if (result != VK_SUCCESS) {
+                fprintf(stderr, "error (vulkan): Failed to crete a graphics pipeline layout.");
+                return 1;
+            }
+        }
+
+        // Queue the graphics pipeline (and the depth pre-pass pipeline), so they compile while the
+        // rest is set up.
+
+        active_pipelines[PIPELINE_KIND_GRAPHICS] = true;
+        active_pipelines[PIPELINE_KIND_DEPTH_PREPASS] = depth_mode == DEPTH_MODE_PREPASS;
+
+        for (uint32_t i = PIPELINE_KIND_GRAPHICS; i <= PIPELINE_KIND_DEPTH_PREPASS; i++) {
+            if (!active_pipelines[i]) {
+                continue;
+            }
+
+            pipeline_build_infos[i] = (PipelineBuildInfo) {
+                .kind = (PipelineKind)i,
+                .depth_mode = depth_mode,
+                .samples = samples,
+                .device = device,
+                .pipeline_cache = pipeline_cache,
+                .layout = graphics_pipeline_layout,
+                .render_pass = graphics_render_pass,
+                .workgroup_size = { 0, 0 },
+            };
+
+            memcpy(pipeline_build_infos[i].shader_modules, shader_modules, sizeof shader_modules);
+
+            pipeline_compiler_get(&pipeline_compiler, &pipeline_build_infos[i], &pipelines[i]);
+            pending_pipelines[i] = true;
+        }
+    }
+
+    // Create the culling pipeline. It reads all instances and writes the visible ones, together
+    // with the indirect draw commands, into buffers bound through a single descriptor set. The
+    // parameters of the frame are bound with a dynamic offset into the transient buffer.
+
+    VkDescriptorSetLayout cull_descriptor_set_layout = VK_NULL_HANDLE;
+    VkPipelineLayout cull_pipeline_layout = VK_NULL_HANDLE;
+
+    {
+        // Create the descriptor set layout.
+
+        {
+            VkDescriptorSetLayoutBinding descriptor_set_layout_bindings[4];
+
+            for (uint32_t i = 0; i < 4; i++) {
+                descriptor_set_layout_bindings[i] = (VkDescriptorSetLayoutBinding) {
+                    .binding = i,
+                    .descriptorType = i < 3 ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                    .descriptorCount = 1,
+                    .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                    .pImmutableSamplers = NULL,
+                };
+            }
+
+            const VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+                .pNext = NULL,
+                .flags = 0,
+                .bindingCount = 4,
+                .pBindings = descriptor_set_layout_bindings,
+            };
+
+            const VkResult result = vkCreateDescriptorSetLayout(device, &descriptor_set_layout_create_info, NULL, &cull_descriptor_set_layout);
+
+            if (result != VK_SUCCESS) {
+                fprintf(stderr, "error (vulkan): Failed to create the culling descriptor set layout.\n");
+                return 1;
+            }
+        }
+
+        // Create the pipeline layout.
+
+        {
+            const VkPushConstantRange push_constant_range = {
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                .offset = 0,
+                .size = sizeof(CullPushConstants),
+            };
+
+            const VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+                .pNext = NULL,
+                .flags = 0,
+                .setLayoutCount = 1,
+                .pSetLayouts = &cull_descriptor_set_layout,
+                .pushConstantRangeCount = 1,
+                .pPushConstantRanges = &push_constant_range,
+            };
+
+            const VkResult result = vkCreatePipelineLayout(device, &pipeline_layout_create_info, NULL, &cull_pipeline_layout);
+
+            if (result != VK_SUCCESS) {
+                fprintf(stderr, "error (vulkan): Failed to create the culling pipeline layout.\n");
+                return 1;
+            }
+        }
+
+        // Queue the compute pipeline.
+
+        pipeline_build_infos[PIPELINE_KIND_CULL] = (PipelineBuildInfo) {
+            .kind = PIPELINE_KIND_CULL,
+            .depth_mode = DEPTH_MODE_DISABLED,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .device = device,
+            .pipeline_cache = pipeline_cache,
+            .layout = cull_pipeline_layout,
+            .render_pass = VK_NULL_HANDLE,
+            .workgroup_size = { 0, 0 },
+        };
+
+        memcpy(pipeline_build_infos[PIPELINE_KIND_CULL].shader_modules, shader_modules, sizeof shader_modules);
+
+        pipeline_compiler_get(&pipeline_compiler, &pipeline_build_infos[PIPELINE_KIND_CULL], &pipelines[PIPELINE_KIND_CULL]);
+        active_pipelines[PIPELINE_KIND_CULL] = true;
+        pending_pipelines[PIPELINE_KIND_CULL] = true;
+    }
+
+    // Create the post-processing pipelines. Every pass reads a source image and writes a destination
+    // image, bloom goes through the bloom image in between; all three are storage images bound
+    // through a single descriptor set.
+
+    VkDescriptorSetLayout post_descriptor_set_layout = VK_NULL_HANDLE;
+    VkPipelineLayout post_pipeline_layout = VK_NULL_HANDLE;
+
+    if (post_pass_count > 0) {
+        // Create the descriptor set layout.
+
+        {
+            VkDescriptorSetLayoutBinding descriptor_set_layout_bindings[3];
+
+            for (uint32_t i = 0; i < 3; i++) {
+                descriptor_set_layout_bindings[i] = (VkDescriptorSetLayoutBinding) {
+                    .binding = i,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                    .descriptorCount = 1,
+                    .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                    .pImmutableSamplers = NULL,
+                };
+            }
+
+            const VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+                .pNext = NULL,
+                .flags = 0,
+                .bindingCount = 3,
+                .pBindings = descriptor_set_layout_bindings,
+            };
+
+            const VkResult result = vkCreateDescriptorSetLayout(device, &descriptor_set_layout_create_info, NULL, &post_descriptor_set_layout);
+
+            if (result != VK_SUCCESS) {
+                fprintf(stderr, "error (vulkan): Failed to create the post-processing descriptor set layout.\n");
+                return 1;
+            }
+        }
+
+        // Create the pipeline layout.
+
+        {
+            const VkPushConstantRange push_constant_range = {
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                .offset = 0,
+                .size = sizeof(PostPushConstants),
+            };
+
+            const VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+                .pNext = NULL,
+                .flags = 0,
+                .setLayoutCount = 1,
+                .pSetLayouts = &post_descriptor_set_layout,
+                .pushConstantRangeCount = 1,
+                .pPushConstantRanges = &push_constant_range,
+            };
+
+            const VkResult result = vkCreatePipelineLayout(device, &pipeline_layout_create_info, NULL, &post_pipeline_layout);
+
+            if (result != VK_SUCCESS) {
+                fprintf(stderr, "error (vulkan): Failed to create the post-processing pipeline layout.\n");
+                return 1;
+            }
+        }
+
+        // Queue the compute pipelines of the passes in the chain, all with the configured workgroup
+        // size.
+
+        for (uint32_t i = 0; i < post_pass_count; i++) {
+            active_pipelines[post_pass_pipeline_kinds[post_passes[i].pass]] = true;
+        }
+
+        active_pipelines[PIPELINE_KIND_BLOOM_DOWNSAMPLE] = post_bloom;
+
+        for (uint32_t i = PIPELINE_KIND_BLOOM_DOWNSAMPLE; i <= PIPELINE_KIND_SHARPEN; i++) {
+            if (!active_pipelines[i]) {
+                continue;
+            }
+
+            pipeline_build_infos[i] = (PipelineBuildInfo) {
+                .kind = (PipelineKind)i,
+                .depth_mode = DEPTH_MODE_DISABLED,
+                .samples = VK_SAMPLE_COUNT_1_BIT,
+                .device = device,
+                .pipeline_cache = pipeline_cache,
+                .layout = post_pipeline_layout,
+                .render_pass = VK_NULL_HANDLE,
+                .workgroup_size = { post_workgroup_size[0], post_workgroup_size[1] },
+            };
+
+            memcpy(pipeline_build_infos[i].shader_modules, shader_modules, sizeof shader_modules);
+
+            pipeline_compiler_get(&pipeline_compiler, &pipeline_build_infos[i], &pipelines[i]);
+            pending_pipelines[i] = true;
+        }
+    }
+
+    // Create the frame contexts. Frame `n` (counting from zero) signals the value `n + 1` of the
+    // frame timeline semaphore, so its value is the number of frames the GPU has finished. Waiting
+    // for a frame, reading back its results and destroying what it used all key off this value.
+
+    FrameContext *frames = NULL;
+    VkSemaphore frame_semaphore = VK_NULL_HANDLE;
+
+    {
+        frames = calloc(frames_in_flight, sizeof *frames);
+
+        if (frames == NULL) {
+            fprintf(stderr, "error (io): Failed to allocate the frame contexts.\n");
+            return 1;
+        }
+
+        const VkSemaphoreCreateInfo semaphore_create_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+        };
+
+        if (timeline_semaphore_create(device, &frame_semaphore) != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create the frame timeline semaphore.\n");
+            return 1;
+        }
+
+        // The command pool of a frame is reset as a whole once the frame has finished, so the
+        // command buffers recorded from it are short-lived.
+
+        const VkCommandPoolCreateInfo command_pool_create_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .pNext = NULL,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = graphics_queue_family_index,
+        };
+
+        // GPU timings need timestamp support on the graphics queue.
+
+        const VkQueryPoolCreateInfo timestamp_query_pool_create_info = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = TIMESTAMP_COUNT + post_pass_count,
+            .pipelineStatistics = 0,
+        };
+
+        for (uint32_t i = 0; i < frames_in_flight; i++) {
+            FrameContext *frame = &frames[i];
+
+            // Create the synchronization objects.
+
+            {
+                const VkResult result = vkCreateSemaphore(device, &semaphore_create_info, NULL, &frame->image_available_semaphore);
+
+                if (result != VK_SUCCESS) {
+                    fprintf(stderr, "error (vulkan): Failed to create synchronisation objects.\n");
+                    return 1;
+                }
+            }
+
+            // Create the command pool. One primary command buffer is allocated up front, since
+            // every frame needs at least that.
+
+            {
+                frame->command_buffer_pool.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+                const VkResult result = vkCreateCommandPool(device, &command_pool_create_info, NULL, &frame->command_buffer_pool.command_pool);
+
+                if (result != VK_SUCCESS) {
+                    fprintf(stderr, "error (vulkan): Failed to create a frame command pool.\n");
+                    return 1;
+                }
+            }
+
+            {
+                const VkResult result = command_buffer_pool_reserve(device, &frame->command_buffer_pool, 1);
+
+                if (result != VK_SUCCESS) {
+                    fprintf(stderr, "error (vulkan): Failed to allocate a frame command buffer.\n");
+                    return 1;
+                }
+            }
+
+            // Create one command pool for secondary command buffers per recording thread. Command
+            // pools can not be used by multiple threads at once.
+
+            frame->secondary_command_buffer_pools = calloc(record_thread_count, sizeof *frame->secondary_command_buffer_pools);
+
+            if (frame->secondary_command_buffer_pools == NULL) {
+                fprintf(stderr, "error (io): Failed to allocate the secondary command pools.\n");
+                return 1;
+            }
+
+            for (uint32_t j = 0; j < record_thread_count; j++) {
+                frame->secondary_command_buffer_pools[j].level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+
+                const VkResult result = vkCreateCommandPool(device, &command_pool_create_info, NULL, &frame->secondary_command_buffer_pools[j].command_pool);
+
+                if (result != VK_SUCCESS) {
+                    fprintf(stderr, "error (vulkan): Failed to create a secondary command pool.\n");
+                    return 1;
+                }
+            }
+
+            // Create the command pool for the compute queue.
+
+            if (async_compute) {
+                const VkCommandPoolCreateInfo compute_command_pool_create_info = {
+                    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                    .pNext = NULL,
+                    .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+                    .queueFamilyIndex = compute_queue_family_index,
+                };
+
+                frame->compute_command_buffer_pool.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+                const VkResult result = vkCreateCommandPool(device, &compute_command_pool_create_info, NULL, &frame->compute_command_buffer_pool.command_pool);
+
+                if (result != VK_SUCCESS) {
+                    fprintf(stderr, "error (vulkan): Failed to create a compute command pool.\n");
+                    return 1;
+                }
+            }
+
+            // Create the timestamp query pool.
+
+            if (graphics_queue_timestamp_valid_bits > 0) {
+                const VkResult result = vkCreateQueryPool(device, &timestamp_query_pool_create_info, NULL, &frame->timestamp_query_pool);
+
+                if (result != VK_SUCCESS) {
+                    fprintf(stderr, "error (vulkan): Failed to create a timestamp query pool.\n");
+                    return 1;
+                }
+            }
+        }
+    }
+
+    // Create the transient buffer, which is split into one linear arena per frame context. It is
+    // host visible and written directly, device local memory is preferred (resizable BAR). With
+    // async compute, the culling parameters in it are read on the compute queue.
+
+    VkBuffer transient_buffer = VK_NULL_HANDLE;
+    MemoryAllocation transient_buffer_allocation = { 0 };
+    VkDeviceSize uniform_buffer_alignment = 0;
+
+    {
+        VkPhysicalDeviceProperties physical_device_properties;
+        vkGetPhysicalDeviceProperties(physical_device, &physical_device_properties);
+
+        uniform_buffer_alignment = physical_device_properties.limits.minUniformBufferOffsetAlignment;
+
+        const uint32_t shared_queue_family_count = async_compute ? device_queue_family_count : 0;
+
+        const VkBufferCreateInfo buffer_create_info = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .size = TRANSIENT_ARENA_SIZE * frames_in_flight,
+            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+            .sharingMode = shared_queue_family_count > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+            .queueFamilyIndexCount = shared_queue_family_count > 1 ? shared_queue_family_count : 0,
+            .pQueueFamilyIndices = shared_queue_family_count > 1 ? device_queue_family_indices : NULL,
+        };
+
+        VkResult result = vkCreateBuffer(device, &buffer_create_info, NULL, &transient_buffer);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create the transient buffer.\n");
+            return 1;
+        }
+
+        VkMemoryRequirements memory_requirements;
+        vkGetBufferMemoryRequirements(device, transient_buffer, &memory_requirements);
+
+        result = memory_allocate(&memory_allocator, &memory_requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &transient_buffer_allocation);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to allocate memory for the transient buffer.\n");
+            return 1;
+        }
+
+        result = vkBindBufferMemory(device, transient_buffer, transient_buffer_allocation.memory, transient_buffer_allocation.offset);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to bind the memory of the transient buffer.\n");
+            return 1;
+        }
+
+        for (uint32_t i = 0; i < frames_in_flight; i++) {
+            frames[i].transient_arena = (LinearArena) {
+                .buffer = transient_buffer,
+                .offset = TRANSIENT_ARENA_SIZE * i,
+                .size = TRANSIENT_ARENA_SIZE,
+                .head = 0,
+                .peak_head = 0,
+                .mapped_data = (uint8_t *)transient_buffer_allocation.mapped_data + TRANSIENT_ARENA_SIZE * i,
+            };
+        }
+    }
+
+    // Create the upload context, which copies on the transfer queue.
+
+    UploadContext upload_context;
+
+    {
+        VkPhysicalDeviceProperties physical_device_properties;
+        vkGetPhysicalDeviceProperties(physical_device, &physical_device_properties);
+
+        const VkDeviceSize optimal_alignment = physical_device_properties.limits.optimalBufferCopyOffsetAlignment;
+        const VkDeviceSize staging_alignment = optimal_alignment > 16 ? optimal_alignment : 16;
+
+        const VkResult result = upload_context_create(&upload_context, &memory_allocator, transfer_queue, transfer_queue_family_index, graphics_queue_family_index, UPLOAD_STAGING_SIZE, staging_alignment);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create the upload context.\n");
+            return 1;
+        }
+    }
+
+    // Create the checkerboard texture and the material buffer, register both in the bindless heap
+    // and queue their uploads.
+
+    VkImage texture_image = VK_NULL_HANDLE;
+    MemoryAllocation texture_image_allocation = { 0 };
+    VkImageView texture_image_view = VK_NULL_HANDLE;
+    VkSampler texture_sampler = VK_NULL_HANDLE;
+    VkBuffer material_buffer = VK_NULL_HANDLE;
+    MemoryAllocation material_buffer_allocation = { 0 };
+    uint32_t material_buffer_index = 0;
+
+    {
+        const VkImageCreateInfo image_create_info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = VK_FORMAT_R8G8B8A8_UNORM,
+            .extent = {
+                .width = TEXTURE_SIZE,
+                .height = TEXTURE_SIZE,
+                .depth = 1,
+            },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .queueFamilyIndexCount = 0,
+            .pQueueFamilyIndices = NULL,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        };
+
+        VkResult result = vkCreateImage(device, &image_create_info, NULL, &texture_image);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create the texture image.\n");
+            return 1;
+        }
+
+        VkMemoryRequirements memory_requirements;
+        vkGetImageMemoryRequirements(device, texture_image, &memory_requirements);
+
+        result = memory_allocate(&memory_allocator, &memory_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &texture_image_allocation);
+
+        if (result == VK_SUCCESS) {
+            result = vkBindImageMemory(device, texture_image, texture_image_allocation.memory, texture_image_allocation.offset);
+        }
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to allocate memory for the texture image.\n");
+            return 1;
+        }
+
+        const VkImageViewCreateInfo image_view_create_info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .image = texture_image,
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = VK_FORMAT_R8G8B8A8_UNORM,
+            .components = {
+                .r = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .g = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .b = VK_COMPONENT_SWIZZLE_IDENTITY,
+                .a = VK_COMPONENT_SWIZZLE_IDENTITY,
+            },
+            .subresourceRange = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+        };
+
+        result = vkCreateImageView(device, &image_view_create_info, NULL, &texture_image_view);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create the texture image view.\n");
+            return 1;
+        }
+
+        const VkSamplerCreateInfo sampler_create_info = {
+            .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .magFilter = VK_FILTER_NEAREST,
+            .minFilter = VK_FILTER_LINEAR,
+            .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+            .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+            .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+            .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+            .mipLodBias = 0.0f,
+            .anisotropyEnable = VK_FALSE,
+            .maxAnisotropy = 1.0f,
+            .compareEnable = VK_FALSE,
+            .compareOp = VK_COMPARE_OP_ALWAYS,
+            .minLod = 0.0f,
+            .maxLod = 0.0f,
+            .borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
+            .unnormalizedCoordinates = VK_FALSE,
+        };
+
+        result = vkCreateSampler(device, &sampler_create_info, NULL, &texture_sampler);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create the texture sampler.\n");
+            return 1;
+        }
+
+        // The texels and materials are static, so they stay valid until their uploads are ready.
+
+        static uint32_t texels[TEXTURE_SIZE * TEXTURE_SIZE];
+
+        for (uint32_t y = 0; y < TEXTURE_SIZE; y++) {
+            for (uint32_t x = 0; x < TEXTURE_SIZE; x++) {
+                texels[y * TEXTURE_SIZE + x] = (x / 8 + y / 8) % 2 == 0 ? 0xffffffff : 0xffb0b0b0;
+            }
+        }
+
+        static Material materials[1];
+
+        materials[0] = (Material) {
+            .color = { 1.0f, 1.0f, 1.0f, 1.0f },
+            .texture_index = 0,
+        };
+
+        uint64_t texture_upload = 0;
+        uint64_t material_upload = 0;
+
+        if (!bindless_heap_add_sampled_image(&bindless_heap, texture_image_view, texture_sampler, &materials[0].texture_index)
+            || !upload_image(&upload_context, texture_image, (VkExtent2D) { TEXTURE_SIZE, TEXTURE_SIZE }, sizeof *texels, texels, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, &texture_upload)) {
+            fprintf(stderr, "error (vulkan): Failed to register the texture.\n");
+            return 1;
+        }
+
+        result = device_buffer_create(&memory_allocator, sizeof materials, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 0, NULL, &material_buffer, &material_buffer_allocation);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create the material buffer.\n");
+            return 1;
+        }
+
+        if (!bindless_heap_add_storage_buffer(&bindless_heap, material_buffer, 0, VK_WHOLE_SIZE, &material_buffer_index)
+            || !upload_buffer(&upload_context, material_buffer, 0, materials, sizeof materials, VK_SHARING_MODE_EXCLUSIVE, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, &material_upload)) {
+            fprintf(stderr, "error (vulkan): Failed to register the material buffer.\n");
+            return 1;
+        }
+    }
+
+    // Create the triangle mesh and the instance buffer and queue their uploads. Drawing starts once
+    // the uploads are ready.
+
+    static const Vertex mesh_vertices[] = {
+        { { 0.0f, -0.5f }, { 1.0f, 0.0f, 0.0f } },
+        { { 0.5f, 0.5f }, { 0.0f, 1.0f, 0.0f } },
+        { { -0.5f, 0.5f }, { 0.0f, 0.0f, 1.0f } },
+    };
+
+    static const uint16_t mesh_indices[] = { 0, 1, 2 };
+
+    Mesh mesh;
+    VkBuffer instance_buffer = VK_NULL_HANDLE;
+    MemoryAllocation instance_buffer_allocation = { 0 };
+    Instance *instances = NULL;
+    uint64_t scene_upload = 0;
+
+    {
+        VkResult result = mesh_create(&mesh, &memory_allocator, &upload_context, mesh_vertices, sizeof mesh_vertices / sizeof *mesh_vertices, mesh_indices, sizeof mesh_indices / sizeof *mesh_indices);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create the triangle mesh.\n");
+            return 1;
+        }
+
+        mesh.material_index = 0;
+
+        // The instances are laid out on a square grid covering the viewport. Every triangle fills
+        // half of its grid cell, so it never overlaps its neighbours while rotating. Triangles are
+        // nearer the closer they are to the center, and with depth they are drawn front to back.
+
+        instances = malloc((size_t)instance_count * sizeof *instances);
+
+        if (instances == NULL) {
+            fprintf(stderr, "error (io): Failed to allocate the instances.\n");
+            return 1;
+        }
+
+        uint32_t grid_size = 1;
+
+        while ((uint64_t)grid_size * grid_size < instance_count) {
+            grid_size++;
+        }
+
+        const float cell_size = 2.0f / (float)grid_size;
+
+        for (uint32_t i = 0; i < instance_count; i++) {
+            instances[i] = (Instance) {
+                .offset = {
+                    -1.0f + ((float)(i % grid_size) + 0.5f) * cell_size,
+                    -1.0f + ((float)(i / grid_size) + 0.5f) * cell_size,
+                },
+                .scale = cell_size * 0.5f,
+                .phase = (float)(i % grid_size + i / grid_size) * 0.25f,
+                .depth = 0.0f,
+                .padding = 0.0f,
+            };
+
+            const float distance_x = instances[i].offset[0] < 0.0f ? -instances[i].offset[0] : instances[i].offset[0];
+            const float distance_y = instances[i].offset[1] < 0.0f ? -instances[i].offset[1] : instances[i].offset[1];
+            instances[i].depth = (distance_x + distance_y) * 0.5f;
+        }
+
+        if (depth_mode != DEPTH_MODE_DISABLED) {
+            qsort(instances, instance_count, sizeof *instances, instance_compare_depth);
+        }
+
+        // With async compute, the instances are read on the compute queue.
+
+        const VkDeviceSize instance_buffer_size = (VkDeviceSize)instance_count * sizeof *instances;
+        const uint32_t shared_queue_family_count = async_compute ? device_queue_family_count : 0;
+
+        result = device_buffer_create(&memory_allocator, instance_buffer_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, shared_queue_family_count, device_queue_family_indices, &instance_buffer, &instance_buffer_allocation);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create the instance buffer.\n");
+            return 1;
+        }
+
+        const VkSharingMode instance_buffer_sharing_mode = async_compute ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+
+        if (!upload_buffer(&upload_context, instance_buffer, 0, instances, instance_buffer_size, instance_buffer_sharing_mode, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, &scene_upload)) {
+            fprintf(stderr, "error (io): Failed to queue the upload of the instance buffer.\n");
+            return 1;
+        }
+    }
+
+    // Create the buffers the culling shader writes to and bind them, together with the instance
+    // buffer and the parameters in the transient buffer, to its descriptor set. The visible
+    // instances of a group are packed at the start of the group's range, so the buffer is as large
+    // as the instance buffer. Every frame context has its own buffers and descriptor set; with async
+    // compute they are shared by both queues.
 
-    const bool ENABLE_VALIDATION = true;
-    const uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+    const uint32_t draw_count = (instance_count + DRAW_GROUP_SIZE - 1) / DRAW_GROUP_SIZE;
 
-    const char* const validation_layer_names[] = { "VK_LAYER_KHRONOS_validation" };
-    uint32_t validation_layer_count = sizeof validation_layer_names / sizeof * validation_layer_names;
+    VkDescriptorPool cull_descriptor_pool = VK_NULL_HANDLE;
 
-    // Create a window (using GLFW).
+    {
+        const VkDescriptorPoolSize descriptor_pool_sizes[] = {
+            {
+                .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = 3 * frames_in_flight,
+            },
+            {
+                .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                .descriptorCount = frames_in_flight,
+            },
+        };
 
-    GLFWwindow* window = NULL;
+        const VkDescriptorPoolCreateInfo descriptor_pool_create_info = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .maxSets = frames_in_flight,
+            .poolSizeCount = 2,
+            .pPoolSizes = descriptor_pool_sizes,
+        };
 
-    {
-        if (!glfwInit()) {
-            fprintf(stderr, "error (glfw): Failed to initialize.\n");
+        VkResult result = vkCreateDescriptorPool(device, &descriptor_pool_create_info, NULL, &cull_descriptor_pool);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create the culling descriptor pool.\n");
             return 1;
         }
 
-        glfwDefaultWindowHints();
-        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+        const VkDeviceSize instance_buffer_size = (VkDeviceSize)instance_count * sizeof(Instance);
+        const VkDeviceSize draw_command_buffer_size = sizeof(uint32_t) + (VkDeviceSize)(draw_indirect_count ? 2 : 1) * draw_count * sizeof(VkDrawIndexedIndirectCommand);
+        const uint32_t shared_queue_family_count = async_compute ? device_queue_family_count : 0;
 
-        window = glfwCreateWindow(1280, 720, "Vulkan Base", NULL, NULL);
+        for (uint32_t i = 0; i < frames_in_flight; i++) {
+            FrameContext *frame = &frames[i];
 
-        if (window == NULL) {
-            fprintf(stderr, "error: (glfw): Failed to create a window.\n");
+            result = device_buffer_create(&memory_allocator, instance_buffer_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, shared_queue_family_count, device_queue_family_indices,
+                &frame->visible_instance_buffer, &frame->visible_instance_buffer_allocation);
+
+            if (result == VK_SUCCESS) {
+                result = device_buffer_create(&memory_allocator, draw_command_buffer_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, shared_queue_family_count, device_queue_family_indices,
+                    &frame->draw_command_buffer, &frame->draw_command_buffer_allocation);
+            }
+
+            if (result != VK_SUCCESS) {
+                fprintf(stderr, "error (vulkan): Failed to create the culling buffers.\n");
+                return 1;
+            }
+
+            const VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                .pNext = NULL,
+                .descriptorPool = cull_descriptor_pool,
+                .descriptorSetCount = 1,
+                .pSetLayouts = &cull_descriptor_set_layout,
+            };
+
+            result = vkAllocateDescriptorSets(device, &descriptor_set_allocate_info, &frame->cull_descriptor_set);
+
+            if (result != VK_SUCCESS) {
+                fprintf(stderr, "error (vulkan): Failed to allocate the culling descriptor set.\n");
+                return 1;
+            }
+
+            const VkDescriptorBufferInfo descriptor_buffer_infos[] = {
+                {
+                    .buffer = instance_buffer,
+                    .offset = 0,
+                    .range = VK_WHOLE_SIZE,
+                },
+                {
+                    .buffer = frame->visible_instance_buffer,
+                    .offset = 0,
+                    .range = VK_WHOLE_SIZE,
+                },
+                {
+                    .buffer = frame->draw_command_buffer,
+                    .offset = 0,
+                    .range = VK_WHOLE_SIZE,
+                },
+                {
+                    .buffer = transient_buffer,
+                    .offset = 0,
+                    .range = sizeof(CullParameters),
+                },
+            };
+
+            const VkWriteDescriptorSet write_descriptor_sets[] = {
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .pNext = NULL,
+                    .dstSet = frame->cull_descriptor_set,
+                    .dstBinding = 0,
+                    .dstArrayElement = 0,
+                    .descriptorCount = 3,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .pImageInfo = NULL,
+                    .pBufferInfo = descriptor_buffer_infos,
+                    .pTexelBufferView = NULL,
+                },
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .pNext = NULL,
+                    .dstSet = frame->cull_descriptor_set,
+                    .dstBinding = 3,
+                    .dstArrayElement = 0,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                    .pImageInfo = NULL,
+                    .pBufferInfo = &descriptor_buffer_infos[3],
+                    .pTexelBufferView = NULL,
+                },
+            };
+
+            vkUpdateDescriptorSets(device, 2, write_descriptor_sets, 0, NULL);
+        }
+    }
+
+    // Allocate the post-processing descriptor sets, two per frame context: one for the passes that
+    // read the scene image and write the post image, and one for the other way around. They are
+    // written once the images exist.
+
+    VkDescriptorPool post_descriptor_pool = VK_NULL_HANDLE;
+
+    if (post_pass_count > 0) {
+        const VkDescriptorPoolSize descriptor_pool_size = {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = 6 * frames_in_flight,
+        };
+
+        const VkDescriptorPoolCreateInfo descriptor_pool_create_info = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .maxSets = 2 * frames_in_flight,
+            .poolSizeCount = 1,
+            .pPoolSizes = &descriptor_pool_size,
+        };
+
+        VkResult result = vkCreateDescriptorPool(device, &descriptor_pool_create_info, NULL, &post_descriptor_pool);
+
+        if (result != VK_SUCCESS) {
+            fprintf(stderr, "error (vulkan): Failed to create the post-processing descriptor pool.\n");
             return 1;
         }
+
+        const VkDescriptorSetLayout descriptor_set_layouts[] = { post_descriptor_set_layout, post_descriptor_set_layout };
+
+        for (uint32_t i = 0; i < frames_in_flight; i++) {
+            const VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                .pNext = NULL,
+                .descriptorPool = post_descriptor_pool,
+                .descriptorSetCount = 2,
+                .pSetLayouts = descriptor_set_layouts,
+            };
+
+            result = vkAllocateDescriptorSets(device, &descriptor_set_allocate_info, frames[i].post_descriptor_sets);
+
+            if (result != VK_SUCCESS) {
+                fprintf(stderr, "error (vulkan): Failed to allocate the post-processing descriptor sets.\n");
+                return 1;
+            }
+        }
     }
 
-    // Create an instance.
+    // Start the recording threads (the main thread records too).
 
-    VkInstance instance = VK_NULL_HANDLE;
+    RecordWorkerPool record_worker_pool;
+    VkCommandBuffer *secondary_command_buffers = NULL;
+    VkResult *secondary_command_buffer_results = NULL;
 
     {
-        // Select layers and extensions.
+        if (!record_worker_pool_start(&record_worker_pool, record_thread_count - 1)) {
+            fprintf(stderr, "error (io): Failed to start the recording threads.\n");
+            return 1;
+        }
 
-        uint32_t enabled_extension_count = 0;
-        const char* const* enabled_extension_names = glfwGetRequiredInstanceExtensions(&enabled_extension_count);
+        secondary_command_buffers = calloc(record_thread_count, sizeof *secondary_command_buffers);
+        secondary_command_buffer_results = calloc(record_thread_count, sizeof *secondary_command_buffer_results);
 
-        uint32_t enabled_layer_count = ENABLE_VALIDATION ? validation_layer_count : 0;
-        const char* const* enabled_layer_names = validation_layer_names;
+        if (secondary_command_buffers == NULL || secondary_command_buffer_results == NULL) {
+            fprintf(stderr, "error (io): Failed to allocate the secondary command buffer lists.\n");
+            return 1;
+        }
+    }
 
-        // Check layer support.
+    // Watch the shader files, if enabled. Without a watcher the shaders are only loaded once.
 
-        {
-            uint32_t instance_layer_count = 0;
-            vkEnumerateInstanceLayerProperties(&instance_layer_count, NULL);
-            VkLayerProperties* instance_layer_properties = malloc(instance_layer_count * sizeof * instance_layer_properties);
-            vkEnumerateInstanceLayerProperties(&instance_layer_count, instance_layer_properties);
+    ShaderWatcher shader_watcher = { .file = -1 };
 
-            if (instance_layer_properties == NULL) {
-                fprintf(stderr, "error (vulkan): Failed to fetch instance layer properties.\n");
-                return 1;
+    if (enable_shader_reload && !shader_watcher_create(&shader_watcher)) {
+        fprintf(stderr, "warning (io): Failed to watch the shader files, shader reloading is disabled.\n");
+        enable_shader_reload = false;
+    }
+
+    // Set up the frame timings.
+
+    MetricHistory *metric_histories = NULL;
+    double timestamp_period = 0.0;
+    uint64_t timestamp_mask = 0;
+
+    {
+        metric_histories = calloc(METRIC_COUNT, sizeof *metric_histories);
+
+        if (metric_histories == NULL) {
+            fprintf(stderr, "error (io): Failed to allocate the metric histories.\n");
+            return 1;
+        }
+
+        VkPhysicalDeviceProperties physical_device_properties;
+        vkGetPhysicalDeviceProperties(physical_device, &physical_device_properties);
+
+        // Timestamps count ticks of timestampPeriod nanoseconds, only the lower valid bits are set.
+
+        timestamp_period = physical_device_properties.limits.timestampPeriod;
+        timestamp_mask = graphics_queue_timestamp_valid_bits >= 64 ? UINT64_MAX : (UINT64_C(1) << graphics_queue_timestamp_valid_bits) - 1;
+
+        // The dynamic resolution scale follows the GPU timings, without them it stays fixed.
+
+        if (gpu_budget > 0.0 && graphics_queue_timestamp_valid_bits == 0) {
+            fprintf(stderr, "warning (vulkan): The graphics queue does not support timestamps, the GPU budget is ignored.\n");
+            gpu_budget = 0.0;
+        }
+    }
+
+    // Draw and poll events.
+
+    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+    uint32_t image_count = 0;
+    VkImage *images = NULL;
+    uint64_t *image_frame_values = NULL;
+    VkSemaphore *image_finished_semaphores = NULL;
+
+    RetireQueue retire_queue = { 0 };
+
+    uint64_t frame_number = 0;
+    const double start_time = time_now_ms();
+    double last_stats_print_time = start_time;
+    bool swapchain_outdated = true;
+    VkExtent2D window_extent = { 0, 0 };
+    double resolution_scale = max_resolution_scale;
+
+    while (window != NULL ? !glfwWindowShouldClose(window) : frame_number < headless_frame_count) {
+
+        const double frame_begin_time = time_now_ms();
+
+        if (window != NULL) {
+            glfwPollEvents();
+
+            // A minimized window has no area to present to, wait until it is restored.
+
+            int32_t framebuffer_width = 0, framebuffer_height = 0;
+            glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
+
+            if (framebuffer_width == 0 || framebuffer_height == 0) {
+                glfwWaitEvents();
+                continue;
             }
 
-            for (uint32_t i = 0; i < enabled_layer_count; i++) {
-                bool layer_available = false;
+            // Recreate the swapchain right away when the window is resized, instead of waiting
+            // for the presentation engine to report it as outdated.
 
-                for (uint32_t j = 0; j < instance_layer_count; j++) {
-                    if (strcmp(enabled_layer_names[i], instance_layer_properties[j].layerName) == 0) {
-                        layer_available = true;
-                        break;
+            if ((uint32_t)framebuffer_width != window_extent.width || (uint32_t)framebuffer_height != window_extent.height) {
+                window_extent.width = (uint32_t)framebuffer_width;
+                window_extent.height = (uint32_t)framebuffer_height;
+                swapchain_outdated = true;
+            }
+        }
+
+        // Create (or recreate) the swapchain and the scene images, which have the same size. The
+        // old objects may still be in use by frames in flight, so they are retired instead of
+        // destroyed and the GPU is never stalled.
+
+        if (swapchain_outdated) {
+            // Retire the old objects.
+
+            {
+                for (uint32_t i = 0; i < frames_in_flight; i++) {
+                    FrameContext *frame = &frames[i];
+
+                    if (frame->scene_framebuffer != VK_NULL_HANDLE && !retire_object(&retire_queue, VK_OBJECT_TYPE_FRAMEBUFFER, (uint64_t)frame->scene_framebuffer, frame_number)) {
+                        fprintf(stderr, "error (io): Failed to retire a framebuffer.\n");
+                        return 1;
+                    }
+
+                    frame->scene_framebuffer = VK_NULL_HANDLE;
+
+                    if (!render_graph_retire_images(&retire_queue, &frame->render_graph, frame_number)) {
+                        fprintf(stderr, "error (io): Failed to retire the scene images.\n");
+                        return 1;
                     }
                 }
 
-                if (!layer_available) {
-                    fprintf(stderr, "error (vulkan): Requested instance layer (name: \"%s\") is not available.\n", enabled_layer_names[i]);
-                    return 1;
+                // Presents of the old swapchain may still wait on its semaphores.
+
+                for (uint32_t i = 0; i < image_count && image_finished_semaphores != NULL; i++) {
+                    if (!retire_object(&retire_queue, VK_OBJECT_TYPE_SEMAPHORE, (uint64_t)image_finished_semaphores[i], frame_number)) {
+                        fprintf(stderr, "error (io): Failed to retire a semaphore.\n");
+                        return 1;
+                    }
                 }
+
+                free(images);
+                free(image_frame_values);
+                free(image_finished_semaphores);
+
+                images = NULL;
+                image_frame_values = NULL;
+                image_finished_semaphores = NULL;
+                image_count = 0;
             }
 
-            free(instance_layer_properties);
-        }
+            // Create the new swapchain. Passing the old one lets the presentation engine hand over
+            // its images without a gap, the old one is retired afterwards.
 
-        // Check extension support.
+            if (surface != VK_NULL_HANDLE) {
+                const VkSwapchainKHR old_swapchain = swapchain;
 
-        {
-            uint32_t instance_extension_count = 0;
-            vkEnumerateInstanceExtensionProperties(NULL, &instance_extension_count, NULL);
-            VkExtensionProperties* instance_extension_properties = malloc(instance_extension_count * sizeof * instance_extension_properties);
-            vkEnumerateInstanceExtensionProperties(NULL, &instance_extension_count, instance_extension_properties);
+                // Get the capabilities of the surface.
 
-            if (instance_extension_properties == NULL) {
-                fprintf(stderr, "error (vulkan): Failed to fetch instance layer properties.\n");
-                return 1;
-            }
+                VkSurfaceCapabilitiesKHR surface_capabilities;
 
-            for (uint32_t i = 0; i < enabled_extension_count; i++) {
-                bool extension_available = false;
+                {
+                    const VkResult result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface, &surface_capabilities);
 
-                for (uint32_t j = 0; j < instance_extension_count; j++) {
-                    if (strcmp(enabled_extension_names[i], instance_extension_properties[j].extensionName) == 0) {
-                        extension_available = true;
-                        break;
+                    if (result != VK_SUCCESS) {
+                        fprintf(stderr, "error (vulkan): Failed to fetch the surface capabilities.\n");
+                        return 1;
+                    }
+
+                    // The scene is blitted onto the swapchain images instead of rendered into them.
+
+                    if (!(surface_capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
+                        fprintf(stderr, "error (vulkan): The surface does not support transfers to swapchain images.\n");
+                        return 1;
                     }
                 }
 
-                if (!extension_available) {
-                    fprintf(stderr, "error (vulkan): Requested instance extension (name: \"%s\") is not available.\n", enabled_extension_names[i]);
+                // Find a suitable image extent.
+
+                {
+                    image_extent = surface_capabilities.currentExtent;
+
+                    // Check if it is allowed to differ the swapchain resolution from the window resolution.
+
+                    if (image_extent.width == UINT32_MAX && window != NULL) {
+                        int32_t framebuffer_width = 0, framebuffer_height = 0;
+                        glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
+
+                        image_extent.width = framebuffer_width;
+                        image_extent.height = framebuffer_height;
+                    } else if (image_extent.width == UINT32_MAX) {
+                        image_extent.width = OUTPUT_WIDTH;
+                        image_extent.height = OUTPUT_HEIGHT;
+                    }
+
+                    // Clamp the extent between the minimum and maximum extent.
+
+                    if (image_extent.width < surface_capabilities.minImageExtent.width) {
+                        image_extent.width = surface_capabilities.minImageExtent.width;
+                    } else if (image_extent.width > surface_capabilities.maxImageExtent.width) {
+                        image_extent.width = surface_capabilities.maxImageExtent.width;
+                    }
+
+                    if (image_extent.height < surface_capabilities.minImageExtent.height) {
+                        image_extent.height = surface_capabilities.minImageExtent.height;
+                    } else if (image_extent.height > surface_capabilities.maxImageExtent.height) {
+                        image_extent.height = surface_capabilities.maxImageExtent.height;
+                    }
+                }
+
+                // Select an image count. One image more than the minimum lets the application
+                // render while the presentation engine holds the rest. MAILBOX needs at least three
+                // images: one on screen, one queued and one being rendered, otherwise it degrades
+                // to blocking.
+
+                uint32_t min_image_count = surface_capabilities.minImageCount + 1;
+
+                {
+                    if (present_mode == VK_PRESENT_MODE_MAILBOX_KHR && min_image_count < 3) {
+                        min_image_count = 3;
+                    }
+
+                    // Clamp the image count between the minium and maximum image count (a maximum
+                    // of zero means there is no limit, which is common for headless surfaces).
+
+                    if (min_image_count < surface_capabilities.minImageCount) {
+                        min_image_count = surface_capabilities.minImageCount;
+                    } else if (surface_capabilities.maxImageCount > 0 && min_image_count > surface_capabilities.maxImageCount) {
+                        min_image_count = surface_capabilities.maxImageCount;
+                    }
+                }
+
+                // Configure the swapchain.
+
+                const VkSwapchainCreateInfoKHR swapchain_create_info = {
+                    .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+                    .pNext = NULL,
+                    .flags = 0,
+                    .surface = surface,
+                    .minImageCount = min_image_count,
+                    .imageFormat = surface_format.format,
+                    .imageColorSpace = surface_format.colorSpace,
+                    .imageExtent = image_extent,
+                    .imageArrayLayers = 1,
+                    .imageUsage = VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                    .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
+                    .queueFamilyIndexCount = 0,
+                    .pQueueFamilyIndices = NULL,
+                    .preTransform = surface_capabilities.currentTransform,
+                    .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+                    .presentMode = present_mode,
+                    .clipped = VK_TRUE,
+                    .oldSwapchain = old_swapchain,
+                };
+
+                // Create the swapchain.
+
+                const VkResult result = vkCreateSwapchainKHR(device, &swapchain_create_info, NULL, &swapchain);
+
+                if (result != VK_SUCCESS) {
+                    fprintf(stderr, "error (vulkan): Failed to create a swapchain.\n");
+                    return 1;
+                }
+
+                if (old_swapchain != VK_NULL_HANDLE && !retire_object(&retire_queue, VK_OBJECT_TYPE_SWAPCHAIN_KHR, (uint64_t)old_swapchain, frame_number)) {
+                    fprintf(stderr, "error (io): Failed to retire the swapchain.\n");
                     return 1;
                 }
             }
 
-            free(instance_extension_properties);
-        }
+            // Get the swapchain images (or the offscreen images).
 
-        // Configure the instance.
+            {
+                if (swapchain == VK_NULL_HANDLE) {
+                    image_count = offscreen_image_count;
+                    images = malloc(image_count * sizeof *images);
 
-        const VkApplicationInfo application_info = {
-            .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
-            .pNext = NULL,
-            .pApplicationName = "Vulkan Application",
-            .applicationVersion = VK_MAKE_VERSION(0, 1, 0),
-            .pEngineName = "Vulkan Engine",
-            .engineVersion = VK_MAKE_VERSION(0, 1, 0),
-            .apiVersion = VK_API_VERSION_1_0,
-        };
+                    if (images == NULL) {
+                        fprintf(stderr, "error (io): Failed to allocate the image list.\n");
+                        return 1;
+                    }
 
-        const VkInstanceCreateInfo instance_create_info = {
-            .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
-            .pNext = NULL,
-            .flags = 0,
-            .pApplicationInfo = &application_info,
-            .enabledLayerCount = validation_layer_count,
-            .ppEnabledLayerNames = enabled_layer_names,
-            .enabledExtensionCount = enabled_extension_count,
-            .ppEnabledExtensionNames = enabled_extension_names,
-        };
+                    memcpy(images, offscreen_images, image_count * sizeof *images);
+                } else {
+                    vkGetSwapchainImagesKHR(device, swapchain, &image_count, NULL);
 
-        // Create the instance.
+                    if (image_count < 1) {
+                        fprintf(stderr, "error (vulkan): No swapchain images are available.\n");
+                        return 1;
+                    }
 
-        const VkResult result = vkCreateInstance(&instance_create_info, NULL, &instance);
+                    images = malloc(image_count * sizeof *images);
+                    const VkResult result = vkGetSwapchainImagesKHR(device, swapchain, &image_count, images);
 
-        if (result != VK_SUCCESS) {
-            fprintf(stderr, "error (vulkan): Failed to create an instance.\n");
-            return 1;
-        }
-    }
+                    if (result != VK_SUCCESS || images == NULL) {
+                        fprintf(stderr, "error (vulkan): Failed to fetch the swapchain images.\n");
+                        return 1;
+                    }
+                }
+            }
 
-    // Create a surface.
+            // Add the scene images to the render graphs of the frames, which create them when the
+            // frames are next recorded. They have the full output size, a lower resolution scale
+            // only renders into a part of them, so changing the scale never recreates anything.
+            // The post image has the size of the scene image and the bloom image half of it.
 
-    VkSurfaceKHR surface = VK_NULL_HANDLE;
+            for (uint32_t i = 0; i < frames_in_flight; i++) {
+                FrameContext *frame = &frames[i];
+                RenderGraph *graph = &frame->render_graph;
 
-    {
-        const VkResult result = glfwCreateWindowSurface(instance, window, NULL, &surface);
+                const VkExtent2D bloom_extent = {
+                    .width = (image_extent.width + 1) / 2,
+                    .height = (image_extent.height + 1) / 2,
+                };
 
-        if (result != VK_SUCCESS) {
-            fprintf(stderr, "error (vulkan): Failed to create a surface.\n");
-            return 1;
-        }
-    }
+                frame->scene_image = render_graph_add_image(graph, scene_format, image_extent, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | (post_pass_count > 0 ? VK_IMAGE_USAGE_STORAGE_BIT : 0), VK_IMAGE_ASPECT_COLOR_BIT);
+
+                if (samples != VK_SAMPLE_COUNT_1_BIT) {
+                    frame->color_attachment = render_graph_add_image(graph, scene_format, image_extent, samples, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+                }
+
+                if (depth_mode != DEPTH_MODE_DISABLED) {
+                    frame->depth_attachment = render_graph_add_image(graph, depth_format, image_extent, samples, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT);
+                }
+
+                if (post_pass_count > 0) {
+                    frame->post_image = render_graph_add_image(graph, scene_format, image_extent, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+                }
+
+                if (post_bloom) {
+                    frame->bloom_image = render_graph_add_image(graph, scene_format, bloom_extent, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_USAGE_STORAGE_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+                }
+            }
+
+            // Images of the new swapchain are not used by any frame yet. Otherwise an image waits for
+            // the frame timeline value signalled by the last frame that used it.
+
+            {
+                image_frame_values = malloc(image_count * sizeof *image_frame_values);
 
-    // Choose a physical device.
+                if (image_frame_values == NULL) {
+                    fprintf(stderr, "error (io): Failed to allocate the image frame values.\n");
+                    return 1;
+                }
 
-    VkPhysicalDevice physical_device = VK_NULL_HANDLE;
+                for (uint32_t i = 0; i < image_count; i++) {
+                    image_frame_values[i] = 0;
+                }
+            }
 
-    {
-        // Fetch (all) physical devices.
+            // The presentation engine still waits on the semaphore signalled for a present after the
+            // frame has finished, so it belongs to the swapchain image rather than to the frame
+            // context, and is only signalled again once the image has been acquired again.
 
-        uint32_t physical_device_count = 0;
-        vkEnumeratePhysicalDevices(instance, &physical_device_count, NULL);
+            if (swapchain != VK_NULL_HANDLE) {
+                image_finished_semaphores = calloc(image_count, sizeof *image_finished_semaphores);
 
-        if (physical_device_count < 1) {
-            fprintf(stderr, "error (vulkan): No physical devices are available.\n");
-            return 1;
-        }
+                if (image_finished_semaphores == NULL) {
+                    fprintf(stderr, "error (io): Failed to allocate the image semaphores.\n");
+                    return 1;
+                }
 
-        VkPhysicalDevice* physical_devices = malloc(physical_device_count * sizeof * physical_devices);
-        const VkResult result = vkEnumeratePhysicalDevices(instance, &physical_device_count, physical_devices);
+                const VkSemaphoreCreateInfo semaphore_create_info = {
+                    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+                    .pNext = NULL,
+                    .flags = 0,
+                };
 
-        if ((result != VK_SUCCESS && result != VK_INCOMPLETE) || physical_devices == NULL) {
-            fprintf(stderr, "error (vulkan): Failed to fetch physical devices.\n");
-            free(physical_devices);
-            return 1;
+                for (uint32_t i = 0; i < image_count; i++) {
+                    if (vkCreateSemaphore(device, &semaphore_create_info, NULL, &image_finished_semaphores[i]) != VK_SUCCESS) {
+                        fprintf(stderr, "error (vulkan): Failed to create synchronisation objects.\n");
+                        return 1;
+                    }
+                }
+            }
+
+            swapchain_outdated = false;
         }
 
-        // Find the most suitable physical device.
+        // Frames cycle through the frame contexts, so the CPU only blocks when it is a whole
+        // context ahead of the GPU.
 
-        physical_device = physical_devices[0];
+        FrameContext *frame = &frames[frame_number % frames_in_flight];
 
-        for (uint32_t i = 0; i < physical_device_count; i++) {
-            VkPhysicalDeviceProperties physical_device_properties;
-            vkGetPhysicalDeviceProperties(physical_devices[i], &physical_device_properties);
+        {
+            double phase_begin_time = time_now_ms();
 
-            if (physical_device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
-                physical_device = physical_devices[i];
-                break;
+            if (frame_number >= frames_in_flight && frame_wait(device, frame_semaphore, frame_number + 1 - frames_in_flight) != VK_SUCCESS) {
+                fprintf(stderr, "error (vulkan): Failed to wait for a frame.\n");
+                return 1;
             }
-        }
 
-        // Clean up.
+            metric_add_sample(&metric_histories[METRIC_CPU_FRAME_WAIT], time_now_ms() - phase_begin_time);
 
-        free(physical_devices);
-    }
+            // Read back the GPU timestamps of the frame that used this context before. That frame
+            // has finished, so the results are available without waiting.
 
-    // Find queue families.
+            if (frame->timestamps_written) {
+                uint64_t timestamps[TIMESTAMP_COUNT + MAX_POST_PASSES];
+                const uint32_t timestamp_count = TIMESTAMP_COUNT + post_pass_count;
+                const VkResult result = vkGetQueryPoolResults(device, frame->timestamp_query_pool, 0, timestamp_count, timestamp_count * sizeof *timestamps, timestamps, sizeof *timestamps, VK_QUERY_RESULT_64_BIT);
 
-    uint32_t graphics_queue_family_index = 0;
+                // With async compute, the culling runs on the compute queue and overlaps the
+                // graphics work, so it is neither timed nor counted against the GPU budget. A
+                // post-processing pass that appears more than once in the chain is timed as a
+                // whole.
 
-    {
-        // Fetch the properties of all queue families.
+                if (result == VK_SUCCESS) {
+                    const uint64_t cull_ticks = ((timestamps[TIMESTAMP_RENDER_PASS_BEGIN] & timestamp_mask) - (timestamps[TIMESTAMP_CULL_BEGIN] & timestamp_mask)) & timestamp_mask;
+                    const uint64_t render_pass_ticks = ((timestamps[TIMESTAMP_RENDER_PASS_END] & timestamp_mask) - (timestamps[TIMESTAMP_RENDER_PASS_BEGIN] & timestamp_mask)) & timestamp_mask;
+                    const double cull_time = async_compute ? 0.0 : (double)cull_ticks * timestamp_period / 1000000.0;
+                    const double render_pass_time = (double)render_pass_ticks * timestamp_period / 1000000.0;
 
-        uint32_t queue_family_count = 0;
-        vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, NULL);
+                    double post_pass_times[POST_PASS_COUNT] = { 0.0 };
+                    bool post_pass_timed[POST_PASS_COUNT] = { false };
+                    double post_time = 0.0;
+                    uint64_t pass_begin_timestamp = timestamps[TIMESTAMP_RENDER_PASS_END];
 
-        if (queue_family_count < 1) {
-            fprintf(stderr, "error (vulkan): No queue families are available.\n");
-            return 1;
-        }
+                    for (uint32_t i = 0; i < post_pass_count; i++) {
+                        const uint64_t pass_ticks = ((timestamps[TIMESTAMP_COUNT + i] & timestamp_mask) - (pass_begin_timestamp & timestamp_mask)) & timestamp_mask;
+                        const double pass_time = (double)pass_ticks * timestamp_period / 1000000.0;
 
-        VkQueueFamilyProperties* queue_family_properties = malloc(queue_family_count * sizeof * queue_family_properties);
-        vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_family_properties);
+                        post_pass_times[post_passes[i].pass] += pass_time;
+                        post_pass_timed[post_passes[i].pass] = true;
+                        post_time += pass_time;
+                        pass_begin_timestamp = timestamps[TIMESTAMP_COUNT + i];
+                    }
 
-        if (queue_family_properties == NULL) {
-            fprintf(stderr, "error (vulkan): Failed to fetch queue family properties.\n");
-            return 1;
-        }
+                    const uint64_t upscale_ticks = ((timestamps[TIMESTAMP_UPSCALE_END] & timestamp_mask) - (pass_begin_timestamp & timestamp_mask)) & timestamp_mask;
+                    const double upscale_time = (double)upscale_ticks * timestamp_period / 1000000.0;
 
-        // Find all queue families that are needed.
+                    if (!async_compute) {
+                        metric_add_sample(&metric_histories[METRIC_GPU_CULL], cull_time);
+                    }
 
-        bool graphics_queue_family_found = false;
+                    metric_add_sample(&metric_histories[METRIC_GPU_RENDER_PASS], render_pass_time);
 
-        for (uint32_t i = 0; i < queue_family_count; i++) {
-            VkBool32 queue_family_supports_presentation = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, i, surface, &queue_family_supports_presentation);
+                    for (uint32_t i = 0; i < POST_PASS_COUNT; i++) {
+                        if (post_pass_timed[i]) {
+                            metric_add_sample(&metric_histories[post_pass_metrics[i]], post_pass_times[i]);
+                        }
+                    }
 
-            if (!graphics_queue_family_found && queue_family_supports_presentation && queue_family_properties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-                graphics_queue_family_index = i;
-                graphics_queue_family_found = true;
-            }
+                    metric_add_sample(&metric_histories[METRIC_GPU_UPSCALE], upscale_time);
 
-            if (graphics_queue_family_found) {
-                break;
-            }
-        }
+                    // Shed load while the GPU is over budget. The GPU time grows with the number
+                    // of pixels (the square of the scale), so small steps are enough. Between 85%
+                    // and 100% of the budget the scale is left alone, so it settles instead of
+                    // oscillating, even though the measured frame is a few frames old.
 
-        if (!graphics_queue_family_found) {
-            fprintf(stderr, "error (vulkan): Failed to find a queue family that supports graphics computation.\n");
-            return 1;
-        }
+                    if (gpu_budget > 0.0) {
+                        const double gpu_time = cull_time + render_pass_time + post_time + upscale_time;
 
-        // Clean up.
+                        if (gpu_time > gpu_budget) {
+                            resolution_scale *= 0.95;
+                        } else if (gpu_time < gpu_budget * 0.85) {
+                            resolution_scale *= 1.02;
+                        }
 
-        free(queue_family_properties);
-    }
+                        if (resolution_scale < MIN_RESOLUTION_SCALE) {
+                            resolution_scale = MIN_RESOLUTION_SCALE;
+                        } else if (resolution_scale > max_resolution_scale) {
+                            resolution_scale = max_resolution_scale;
+                        }
+                    }
+                }
 
-    // Create a logical device.
+                frame->timestamps_written = false;
+            }
 
-    VkDevice device = VK_NULL_HANDLE;
+            // Destroy the retired objects that are no longer used by any finished frame. The GPU may
+            // be further ahead than the frame that was waited for, so the semaphore is read again.
+            // Then copy the next part of the queued uploads, which never waits for the transfer
+            // queue.
 
-    {
-        // Configure the queues.
+            {
+                uint64_t completed_frame_count = 0;
 
-        float graphics_queue_priorities[] = { 1.0f };
+                if (vkGetSemaphoreCounterValue(device, frame_semaphore, &completed_frame_count) != VK_SUCCESS) {
+                    fprintf(stderr, "error (vulkan): Failed to read the frame timeline semaphore.\n");
+                    return 1;
+                }
 
-        const VkDeviceQueueCreateInfo graphics_queue_create_info = {
-            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            .pNext = NULL,
-            .flags = 0,
-            .queueFamilyIndex = graphics_queue_family_index,
-            .queueCount = 1,
-            .pQueuePriorities = graphics_queue_priorities,
-        };
+                destroy_retired_objects(&memory_allocator, &retire_queue, completed_frame_count);
 
-        // Select physical device features.
+                phase_begin_time = time_now_ms();
 
-        const VkPhysicalDeviceFeatures physical_device_features = { 0 };
+                const VkResult result = upload_process(&upload_context, UPLOAD_FRAME_BUDGET);
 
-        //  Select layers and extensions.
+                if (result != VK_SUCCESS) {
+                    fprintf(stderr, "error (vulkan): Failed to submit the uploads.\n");
+                    return 1;
+                }
 
-        // TODO Check device extension/layer support.
+                metric_add_sample(&metric_histories[METRIC_CPU_UPLOAD], time_now_ms() - phase_begin_time);
+            }
 
-        const char* const device_extension_names[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
-        const uint32_t device_extension_count = sizeof device_extension_names / sizeof * device_extension_names;
+            // Reload the shader files that changed and queue the pipelines that use them. Until a
+            // pipeline is compiled, the previous one keeps being used; the scene is not drawn before
+            // the first one is ready.
 
-        const char* const* enabled_layer_names = validation_layer_names;
-        const uint32_t enabled_layer_count = ENABLE_VALIDATION ? validation_layer_count : 0;
+            if (enable_shader_reload) {
+                const uint32_t changed_shader_files = shader_watcher_poll(&shader_watcher);
 
-        // Configure the device.
+                for (uint32_t i = 0; i < SHADER_FILE_COUNT; i++) {
+                    if ((changed_shader_files & 1u << i) == 0) {
+                        continue;
+                    }
 
-        const VkDeviceCreateInfo device_create_info = {
-            .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-            .pNext = NULL,
-            .flags = 0,
-            .queueCreateInfoCount = 1,
-            .pQueueCreateInfos = &graphics_queue_create_info,
-            .enabledLayerCount = enabled_layer_count,
-            .ppEnabledLayerNames = enabled_layer_names,
-            .enabledExtensionCount = device_extension_count,
-            .ppEnabledExtensionNames = device_extension_names,
-            .pEnabledFeatures = &physical_device_features,
-        };
+                    const ShaderLoadResult result = shader_cache_load(&shader_cache, shader_file_names[i], &shader_modules[i]);
 
-        const VkResult result = vkCreateDevice(physical_device, &device_create_info, NULL, &device);
+                    if (result != SHADER_LOAD_SUCCESS) {
+                        fprintf(stderr, "warning (%s): Failed to reload shader '%s', %s.\n", result == SHADER_LOAD_ERROR_VULKAN ? "vulkan" : "io", shader_file_names[i], shader_load_result_descriptions[result]);
+                        continue;
+                    }
 
-        if (result != VK_SUCCESS) {
-            fprintf(stderr, "error (vulkan): Failed to create a device.\n");
-            return 1;
-        }
-    }
+                    for (uint32_t j = 0; j < PIPELINE_KIND_COUNT; j++) {
+                        if (active_pipelines[j] && (pipeline_kind_shader_files[j] & 1u << i) != 0 && pipeline_build_infos[j].shader_modules[i] != shader_modules[i]) {
+                            pipeline_build_infos[j].shader_modules[i] = shader_modules[i];
+                            pending_pipelines[j] = true;
+                        }
+                    }
+                }
 
-    // Get queues from the device.
+                // Only the current module of every file and the modules of the pipelines that are
+                // requested are still needed, the old ones are evicted once they were compiled.
 
-    VkQueue graphics_queue = VK_NULL_HANDLE;
+                VkShaderModule used_modules[SHADER_FILE_COUNT * (PIPELINE_KIND_COUNT + 1)];
+                uint32_t used_module_count = 0;
 
-    {
-        vkGetDeviceQueue(device, graphics_queue_family_index, 0, &graphics_queue);
-    }
+                for (uint32_t i = 0; i < SHADER_FILE_COUNT; i++) {
+                    used_modules[used_module_count++] = shader_modules[i];
 
-    // Create a swapchain.
+                    for (uint32_t j = 0; j < PIPELINE_KIND_COUNT; j++) {
+                        if (active_pipelines[j] && (pipeline_kind_shader_files[j] & 1u << i) != 0) {
+                            used_modules[used_module_count++] = pipeline_build_infos[j].shader_modules[i];
+                        }
+                    }
+                }
 
-    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
-    VkSurfaceFormatKHR surface_format;
-    VkExtent2D image_extent;
+                shader_cache_evict(&shader_cache, &pipeline_compiler, used_modules, used_module_count);
+            }
 
-    {
-        // Get the capabilities of the surface.
+            for (uint32_t i = 0; i < PIPELINE_KIND_COUNT; i++) {
+                if (!pending_pipelines[i]) {
+                    continue;
+                }
 
-        VkSurfaceCapabilitiesKHR surface_capabilities;
+                VkPipeline pipeline;
+                const PipelineStatus status = pipeline_compiler_get(&pipeline_compiler, &pipeline_build_infos[i], &pipeline);
 
-        {
-            const VkResult result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface, &surface_capabilities);
+                if (status == PIPELINE_STATUS_READY) {
+                    pipelines[i] = pipeline;
+                    pending_pipelines[i] = false;
+                } else if (status == PIPELINE_STATUS_FAILED) {
+                    if (pipelines[i] == VK_NULL_HANDLE) {
+                        fprintf(stderr, "error (vulkan): Failed to compile the %s pipeline.\n", pipeline_kind_names[i]);
+                        return 1;
+                    }
 
-            if (result != VK_SUCCESS) {
-                fprintf(stderr, "error (vulkan): Failed to fetch the surface capabilities.\n");
-                return 1;
+                    fprintf(stderr, "warning (vulkan): Failed to compile the %s pipeline, keeping the old one.\n", pipeline_kind_names[i]);
+                    pending_pipelines[i] = false;
+                }
             }
-        }
 
-        // Find the best surface format.
+            // The transient data of the frame that used this context before is no longer needed.
 
-        {
-            // Get all available surface formats.
+            linear_arena_reset(&frame->transient_arena);
 
-            uint32_t surface_format_count = 0;
-            vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &surface_format_count, NULL);
+            phase_begin_time = time_now_ms();
 
-            if (surface_format_count < 1) {
-                fprintf(stderr, "error (vulkan): No surface formats are available.\n");
-                return 1;
+            // Offscreen images are used round-robin, there is nothing to acquire.
+
+            uint32_t image_index = (uint32_t)(frame_number % image_count);
+            VkResult result = VK_SUCCESS;
+
+            if (swapchain != VK_NULL_HANDLE) {
+                result = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, frame->image_available_semaphore, VK_NULL_HANDLE, &image_index);
             }
 
-            VkSurfaceFormatKHR *surface_formats = malloc(surface_format_count * sizeof *surface_formats);
-            const VkResult result = vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &surface_format_count, surface_formats);
+            // An outdated swapchain can not be presented to anymore, skip the frame and recreate
+            // it. A suboptimal one still works, so the frame is finished first.
 
-            if ((result != VK_SUCCESS && result != VK_INCOMPLETE) || surface_formats == NULL) {
-                fprintf(stderr, "error (vulkan): Failed to fetch surface formats.\n");
-                free(surface_formats);
+            if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+                swapchain_outdated = true;
+                continue;
+            } else if (result == VK_SUBOPTIMAL_KHR) {
+                swapchain_outdated = true;
+            } else if (result != VK_SUCCESS) {
+                fprintf(stderr, "error (vulkan): Failed acquire the next image.\n");
                 return 1;
             }
 
-            // Find a surface format.
+            if (image_frame_values[image_index] > 0 && frame_wait(device, frame_semaphore, image_frame_values[image_index]) != VK_SUCCESS) {
+                fprintf(stderr, "error (vulkan): Failed to wait for a frame.\n");
+                return 1;
+            }
 
-            surface_format = surface_formats[0];
+            image_frame_values[image_index] = frame_number + 1;
 
-            for (uint32_t i = 0; i < surface_format_count; i++) {
+            metric_add_sample(&metric_histories[METRIC_CPU_ACQUIRE], time_now_ms() - phase_begin_time);
 
-                // Find an SRGB surface.
+            // Record the command buffer for drawing. It is recorded again every frame, so the
+            // scene can change from frame to frame. The command pool is reset as a whole instead
+            // of freeing the command buffers one by one, which hands out the same command buffers
+            // again without allocating.
 
-                if (surface_formats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR){
-                    switch (surface_formats[i].format) {
-                        case VK_FORMAT_B8G8R8A8_SRGB:
-                        case VK_FORMAT_R8G8B8A8_SRGB:
-                        {
-                            surface_format = surface_formats[i];
-                            break;
-                        }
-                    };
+            phase_begin_time = time_now_ms();
+
+            VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+            uint64_t upload_wait_semaphore_value = 0;
+            VkPipelineStageFlags upload_wait_stage_mask = 0;
+            uint64_t compute_wait_semaphore_value = 0;
+
+            {
+                result = command_buffer_pool_reset(device, &frame->command_buffer_pool);
+
+                for (uint32_t i = 0; i < record_thread_count && result == VK_SUCCESS; i++) {
+                    result = command_buffer_pool_reset(device, &frame->secondary_command_buffer_pools[i]);
                 }
-            }
 
-            // Clean up.
+                if (async_compute && result == VK_SUCCESS) {
+                    result = command_buffer_pool_reset(device, &frame->compute_command_buffer_pool);
+                }
 
-            free(surface_formats);
-        }
+                if (result == VK_SUCCESS) {
+                    result = command_buffer_pool_get(device, &frame->command_buffer_pool, &command_buffer);
+                }
 
-        // Find the best presentation mode.
+                if (result != VK_SUCCESS) {
+                    fprintf(stderr, "error (vulkan): Failed to get a frame command buffer.\n");
+                    return 1;
+                }
 
-        VkPresentModeKHR present_mode;
+                const VkCommandBufferBeginInfo command_buffer_begin_info = {
+                    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                    .pNext = NULL,
+                    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+                    .pInheritanceInfo = VK_NULL_HANDLE,
+                };
 
-        {
-            // Get all available present modes.
+                result = vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info);
 
-            uint32_t present_mode_count = 0;
-            vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &present_mode_count, NULL);
+                if (result != VK_SUCCESS) {
+                    fprintf(stderr, "error (vulkan): Failed to start command buffer recording.\n");
+                    return 1;
+                }
 
-            if (present_mode_count < 1) {
-                fprintf(stderr, "error (vulkan): No presentation modes are available.\n");
-                return 1;
-            }
+                // Take over the resources whose uploads were submitted since the last frame.
 
-            VkPresentModeKHR *present_modes = malloc(present_mode_count * sizeof *present_modes);
-            const VkResult result = vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &present_mode_count, present_modes);
+                upload_wait_stage_mask = upload_acquire(&upload_context, command_buffer, &upload_wait_semaphore_value);
 
-            if ((result != VK_SUCCESS && result != VK_INCOMPLETE) || present_modes == NULL) {
-                fprintf(stderr, "error (vulkan): Failed to fetch presentation modes.\n");
-                free(present_modes);
-                return 1;
-            }
+                // The scene is rendered into the top left part of the scene image that matches the
+                // resolution scale.
 
-            // Find a present mode.
+                VkExtent2D render_extent = {
+                    .width = (uint32_t)(image_extent.width * resolution_scale + 0.5),
+                    .height = (uint32_t)(image_extent.height * resolution_scale + 0.5),
+                };
 
-            present_mode = VK_PRESENT_MODE_FIFO_KHR; // FIXME Check if this is guaranteed to work.
+                if (render_extent.width < 1) {
+                    render_extent.width = 1;
+                }
 
-            /*
-            for (uint32_t i = 0; i < present_mode_count; i++) {
-                if (present_modes[i] == VK_PRESENT_MODE_MAILBOX_KHR) {
-                    present_mode = present_modes[i];
-                    break;
+                if (render_extent.height < 1) {
+                    render_extent.height = 1;
                 }
-            }
-            */
 
-            // Clean up.
+                // Until the scene is uploaded and its pipelines are compiled, nothing is culled or
+                // drawn. Once uploaded, the CPU copy of the instances is no longer needed.
 
-            free(present_modes);
-        }
+                const bool scene_uploaded = upload_is_ready(&upload_context, scene_upload);
+                bool scene_ready = scene_uploaded;
 
-        // Find a suitable image extent.
+                for (uint32_t i = 0; i < PIPELINE_KIND_COUNT; i++) {
+                    if (active_pipelines[i] && pipelines[i] == VK_NULL_HANDLE) {
+                        scene_ready = false;
+                    }
+                }
 
-        {
-            image_extent = surface_capabilities.currentExtent;;
+                if (scene_uploaded && instances != NULL) {
+                    free(instances);
+                    instances = NULL;
+                }
 
-            // Check if it is allowed to differ the swapchain resolution from the window resolution.
+                // Declare the passes of the frame with the images and buffers they access, in the
+                // order they are recorded below; the render graph places the barriers between them.
+                // The culling only runs once the scene is ready, on the compute queue with async
+                // compute. The post-processing passes are declared even while they are skipped, so
+                // the images are always used by the same passes. The scene image then still holds
+                // the scene, and the blit reads it instead of the result of the last pass.
 
-            if (image_extent.width == UINT32_MAX) {
-                int32_t framebuffer_width = 0, framebuffer_height = 0;
-                glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
+                RenderGraph *graph = &frame->render_graph;
+                render_graph_begin_frame(graph);
 
-                image_extent.width = framebuffer_width;
-                image_extent.height = framebuffer_height;
-            }
+                const uint32_t output_image = render_graph_import(graph, images[image_index], VK_NULL_HANDLE, VK_IMAGE_ASPECT_COLOR_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+                const uint32_t draw_command_buffer = render_graph_import(graph, VK_NULL_HANDLE, frame->draw_command_buffer, 0, 0);
+                const uint32_t visible_instance_buffer = render_graph_import(graph, VK_NULL_HANDLE, frame->visible_instance_buffer, 0, 0);
 
-            // Clamp the extent between the minimum and maximum extent.
+                uint32_t cull_fill_pass = 0;
+                uint32_t cull_pass = 0;
+                uint32_t cull_compact_pass = 0;
 
-            if (image_extent.width < surface_capabilities.minImageExtent.width) {
-                image_extent.width = surface_capabilities.minImageExtent.width;
-            } else if (image_extent.width > surface_capabilities.maxImageExtent.width) {
-                image_extent.width = surface_capabilities.maxImageExtent.width;
-            }
+                if (scene_ready) {
+                    const uint32_t cull_queue = async_compute ? 1 : 0;
 
-            if (image_extent.height < surface_capabilities.minImageExtent.height) {
-                image_extent.height = surface_capabilities.minImageExtent.height;
-            } else if (image_extent.height > surface_capabilities.maxImageExtent.height) {
-                image_extent.height = surface_capabilities.maxImageExtent.height;
-            }
-        }
+                    cull_fill_pass = render_graph_add_pass(graph, cull_queue);
+                    render_graph_access(graph, cull_fill_pass, draw_command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
 
-        // Select an image count.
+                    cull_pass = render_graph_add_pass(graph, cull_queue);
+                    render_graph_access(graph, cull_pass, draw_command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+                    render_graph_access(graph, cull_pass, visible_instance_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
 
-        uint32_t image_count = surface_capabilities.minImageCount + 1;
+                    if (draw_indirect_count) {
+                        cull_compact_pass = render_graph_add_pass(graph, cull_queue);
+                        render_graph_access(graph, cull_compact_pass, draw_command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+                    }
+                }
 
-        {
-            // Clamp the image count between the minium and maximum image count.
+                const uint32_t scene_pass = render_graph_add_pass(graph, 0);
+                render_graph_access(graph, scene_pass, draw_command_buffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+                render_graph_access(graph, scene_pass, visible_instance_buffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+                render_graph_access(graph, scene_pass, frame->scene_image, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 
-            if (image_count < surface_capabilities.minImageCount) {
-                image_count = surface_capabilities.minImageCount;
-            } else if (image_count > surface_capabilities.maxImageCount) {
-                image_count = surface_capabilities.maxImageCount;
-            }
-        }
+                if (samples != VK_SAMPLE_COUNT_1_BIT) {
+                    render_graph_access(graph, scene_pass, frame->color_attachment, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+                }
 
-        // Configure the swapchain.
+                if (depth_mode != DEPTH_MODE_DISABLED) {
+                    render_graph_access(graph, scene_pass, frame->depth_attachment, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+                }
 
-        const VkSwapchainCreateInfoKHR swapchain_create_info = {
-            .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-            .pNext = NULL,
-            .flags = 0,
-            .surface = surface,
-            .minImageCount = image_count,
-            .imageFormat = surface_format.format,
-            .imageColorSpace = surface_format.colorSpace,
-            .imageExtent = image_extent,
-            .imageArrayLayers = 1,
-            .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-            .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
-            .queueFamilyIndexCount = 0,
-            .pQueueFamilyIndices = NULL,
-            .preTransform = surface_capabilities.currentTransform,
-            .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-            .presentMode = present_mode,
-            .clipped = VK_TRUE,
-            .oldSwapchain = VK_NULL_HANDLE,
-        };
+                // The post-processing passes alternate between the scene image and the post image,
+                // bloom first filters the source into the bloom image in a pass of its own.
 
-        // Create the swapchain.
+                uint32_t post_graph_passes[MAX_POST_PASSES];
+                uint32_t blit_source_image = frame->scene_image;
 
-        const VkResult result = vkCreateSwapchainKHR(device, &swapchain_create_info, NULL, &swapchain);
+                for (uint32_t i = 0; i < post_pass_count; i++) {
+                    const uint32_t source_image = i % 2 == 0 ? frame->scene_image : frame->post_image;
+                    const uint32_t destination_image = i % 2 == 0 ? frame->post_image : frame->scene_image;
 
-        if (result != VK_SUCCESS) {
-            fprintf(stderr, "error (vulkan): Failed to create a swapchain.\n");
-            return 1;
-        }
-    }
+                    if (post_passes[i].pass == POST_PASS_BLOOM) {
+                        const uint32_t downsample_pass = render_graph_add_pass(graph, 0);
+                        render_graph_access(graph, downsample_pass, source_image, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
+                        render_graph_access(graph, downsample_pass, frame->bloom_image, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL);
+                    }
 
-    // Create the image views.
+                    post_graph_passes[i] = render_graph_add_pass(graph, 0);
+                    render_graph_access(graph, post_graph_passes[i], source_image, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
+                    render_graph_access(graph, post_graph_passes[i], destination_image, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL);
 
-    uint32_t image_view_count = 0;
-    VkImageView *image_views = NULL;
+                    if (post_passes[i].pass == POST_PASS_BLOOM) {
+                        render_graph_access(graph, post_graph_passes[i], frame->bloom_image, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
+                    }
 
-    {
-        // Get the swapchain images.
+                    if (scene_ready) {
+                        blit_source_image = destination_image;
+                    }
+                }
 
-        uint32_t image_count = 0;
-        VkImage *images = NULL;
+                // The blit overwrites the output image completely, which is then handed over to the
+                // presentation engine (offscreen images are kept ready to be read back).
 
-        {
-            vkGetSwapchainImagesKHR(device, swapchain, &image_count, NULL);
+                const uint32_t blit_pass = render_graph_add_pass(graph, 0);
+                render_graph_access(graph, blit_pass, blit_source_image, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+                render_graph_access(graph, blit_pass, output_image, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
-            if (image_count < 1) {
-                fprintf(stderr, "error (vulkan): No swapchain images are available.\n");
-                return 1;
-            }
+                const uint32_t present_pass = render_graph_add_pass(graph, 0);
+                render_graph_access(graph, present_pass, output_image, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, swapchain != VK_NULL_HANDLE ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
 
-            images = malloc(image_count * sizeof *images);
-            const VkResult result = vkGetSwapchainImagesKHR(device, swapchain, &image_count, images);
+                // Create the images of the graph if they were added since this context was last
+                // used, with the framebuffer and the post-processing descriptor sets pointing at
+                // them. The frame that used the old ones has finished, so the sets can be written.
+                // Without bloom, the bloom image binding is left empty.
 
-            if (result != VK_SUCCESS || images == NULL) {
-                fprintf(stderr, "error (vulkan): Failed to fetch the swapchain images.\n");
-                free(images);
-                return 1;
-            }
-        }
+                if (!graph->images_created) {
+                    result = render_graph_create_images(graph, &memory_allocator);
 
-        // Configure and create the image views.
+                    if (result != VK_SUCCESS) {
+                        fprintf(stderr, "error (vulkan): Failed to create the scene images.\n");
+                        return 1;
+                    }
 
-        image_view_count = image_count;
-        image_views = malloc(image_count * sizeof *image_views);
+                    // The framebuffer lists the images in the order of the render pass.
 
-        for (uint32_t i = 0; i < image_count; i++) {
-            const VkImageViewCreateInfo image_view_create_info = {
-                .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-                .pNext = NULL,
-                .flags = 0,
-                .image = images[i],
-                .viewType = VK_IMAGE_VIEW_TYPE_2D,
-                .format = surface_format.format,
-                .components = {
-                    .r = VK_COMPONENT_SWIZZLE_IDENTITY,
-                    .g = VK_COMPONENT_SWIZZLE_IDENTITY,
-                    .b = VK_COMPONENT_SWIZZLE_IDENTITY,
-                    .a = VK_COMPONENT_SWIZZLE_IDENTITY,
-                },
-                .subresourceRange = {
-                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                    .baseMipLevel = 0,
-                    .levelCount = 1,
-                    .baseArrayLayer = 0,
-                    .layerCount = 1,
-                },
-            };
+                    VkImageView attachments[3];
+                    uint32_t attachment_count = 0;
 
-            const VkResult result = vkCreateImageView(device, &image_view_create_info, NULL, &image_views[i]);
+                    if (samples != VK_SAMPLE_COUNT_1_BIT) {
+                        attachments[attachment_count++] = graph->resources[frame->color_attachment].view;
+                    } else {
+                        attachments[attachment_count++] = graph->resources[frame->scene_image].view;
+                    }
 
-            if (result != VK_SUCCESS) {
-                fprintf(stderr, "error (vulkan): Failed to create an image view.\n");
-                free(image_views);
-                free(images);
-                return 1;
-            }
-        }
+                    if (depth_mode != DEPTH_MODE_DISABLED) {
+                        attachments[attachment_count++] = graph->resources[frame->depth_attachment].view;
+                    }
 
-        // Clean up.
+                    if (samples != VK_SAMPLE_COUNT_1_BIT) {
+                        attachments[attachment_count++] = graph->resources[frame->scene_image].view;
+                    }
 
-        free(images);
-    }
+                    const VkFramebufferCreateInfo framebuffer_create_info = {
+                        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+                        .pNext = NULL,
+                        .flags = 0,
+                        .renderPass = graphics_render_pass,
+                        .attachmentCount = attachment_count,
+                        .pAttachments = attachments,
+                        .width = image_extent.width,
+                        .height = image_extent.height,
+                        .layers = 1,
+                    };
 
-    // Create the render pass.
+                    result = vkCreateFramebuffer(device, &framebuffer_create_info, NULL, &frame->scene_framebuffer);
 
-    VkRenderPass graphics_render_pass = VK_NULL_HANDLE;
+                    if (result != VK_SUCCESS) {
+                        fprintf(stderr, "error (vulkan): Failed to create a framebuffer.\n");
+                        return 1;
+                    }
 
-    {
-        // Configure the color attachment (for the framebuffers).
+                    if (post_pass_count > 0) {
+                        const VkImageView scene_image_view = graph->resources[frame->scene_image].view;
+                        const VkImageView post_image_view = graph->resources[frame->post_image].view;
+                        const VkImageView bloom_image_view = post_bloom ? graph->resources[frame->bloom_image].view : VK_NULL_HANDLE;
 
-        const VkAttachmentDescription color_attachment_description = {
-            .flags = 0,
-            .format = surface_format.format,
-            .samples = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-            .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-            .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-        };
+                        const VkImageView image_views[] = {
+                            scene_image_view, post_image_view, bloom_image_view,
+                            post_image_view, scene_image_view, bloom_image_view,
+                        };
 
-        const VkAttachmentReference color_attachment_reference = {
-            .attachment = 0,
-            .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        };
+                        VkDescriptorImageInfo descriptor_image_infos[6];
 
-        const VkSubpassDescription subpass_description = {
-            .flags = 0,
-            .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-            .inputAttachmentCount = 0,
-            .pInputAttachments = NULL,
-            .colorAttachmentCount = 1,
-            .pColorAttachments = &color_attachment_reference,
-            .pResolveAttachments = NULL,
-            .pDepthStencilAttachment = NULL,
-            .preserveAttachmentCount = VK_FALSE,
-            .pPreserveAttachments = NULL,
-        };
+                        for (uint32_t i = 0; i < 6; i++) {
+                            descriptor_image_infos[i] = (VkDescriptorImageInfo) {
+                                .sampler = VK_NULL_HANDLE,
+                                .imageView = image_views[i],
+                                .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+                            };
+                        }
 
-        const VkSubpassDependency subpass_dependency = {
-            .srcSubpass = VK_SUBPASS_EXTERNAL,
-            .dstSubpass = 0,
-            .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-            .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-            .srcAccessMask = 0,
-            .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-            .dependencyFlags = 0,
-        };
+                        VkWriteDescriptorSet write_descriptor_sets[2];
+
+                        for (uint32_t i = 0; i < 2; i++) {
+                            write_descriptor_sets[i] = (VkWriteDescriptorSet) {
+                                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                .pNext = NULL,
+                                .dstSet = frame->post_descriptor_sets[i],
+                                .dstBinding = 0,
+                                .dstArrayElement = 0,
+                                .descriptorCount = post_bloom ? 3 : 2,
+                                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                .pImageInfo = &descriptor_image_infos[3 * i],
+                                .pBufferInfo = NULL,
+                                .pTexelBufferView = NULL,
+                            };
+                        }
 
-        const VkRenderPassCreateInfo render_pass_create_info = {
-            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-            .pNext = NULL,
-            .flags = 0,
-            .attachmentCount = 1,
-            .pAttachments = &color_attachment_description,
-            .subpassCount = 1,
-            .pSubpasses = &subpass_description,
-            .dependencyCount = 1,
-            .pDependencies = &subpass_dependency,
-        };
+                        vkUpdateDescriptorSets(device, 2, write_descriptor_sets, 0, NULL);
+                    }
+                }
+
+                // The color image is always the first attachment and the depth image (if any) the
+                // second one. A resolve target is never cleared.
+
+                const VkClearValue clear_values[] = {
+                    { .color = {{ 0.0f, 0.0f, 0.0f, 1.0f }} },
+                    { .depthStencil = { 1.0f, 0 } },
+                    { .color = {{ 0.0f, 0.0f, 0.0f, 1.0f }} },
+                };
+
+                const VkRenderPassBeginInfo render_pass_begin_info = {
+                    .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+                    .pNext = NULL,
+                    .renderPass = graphics_render_pass,
+                    .framebuffer = frame->scene_framebuffer,
+                    .renderArea = {
+                        .offset = {
+                            .x = 0,
+                            .y = 0,
+                        },
+                        .extent = render_extent,
+                    },
+                    .clearValueCount = render_pass_attachment_count,
+                    .pClearValues = clear_values,
+                };
+
+                if (frame->timestamp_query_pool != VK_NULL_HANDLE) {
+                    vkCmdResetQueryPool(command_buffer, frame->timestamp_query_pool, 0, TIMESTAMP_COUNT + post_pass_count);
+                    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame->timestamp_query_pool, TIMESTAMP_CULL_BEGIN);
+                }
 
-        // Create the render pass.
+                // Cull the instances on the GPU, which writes the indirect draw commands. The frame
+                // culls into its own buffers, which the last frame that used them is done drawing
+                // from. With async compute, the culling is submitted to the compute queue right
+                // away, so it runs while the previous frame is still drawing, and only the indirect
+                // draws of this frame wait for it.
 
-        const VkResult result = vkCreateRenderPass(device, &render_pass_create_info, NULL, &graphics_render_pass);
+                if (scene_ready) {
+                    VkCommandBuffer cull_command_buffer = command_buffer;
 
-        if (result != VK_SUCCESS) {
-            fprintf(stderr, "error (vulkan): Failed to create the render pass.\n");
-            return 1;
-        }
-    }
+                    if (async_compute) {
+                        result = command_buffer_pool_get(device, &frame->compute_command_buffer_pool, &cull_command_buffer);
 
-    // Create the shader modules.
+                        if (result == VK_SUCCESS) {
+                            result = vkBeginCommandBuffer(cull_command_buffer, &command_buffer_begin_info);
+                        }
 
-    VkShaderModule vertex_shader_module = VK_NULL_HANDLE;
-    VkShaderModule fragment_shader_module = VK_NULL_HANDLE;
+                        if (result != VK_SUCCESS) {
+                            fprintf(stderr, "error (vulkan): Failed to start compute command buffer recording.\n");
+                            return 1;
+                        }
+                    }
 
-    {
-        // Create the vertex shader module.
+                    render_graph_record_barrier(graph, cull_command_buffer, cull_fill_pass);
+                    vkCmdFillBuffer(cull_command_buffer, frame->draw_command_buffer, 0, VK_WHOLE_SIZE, 0);
+                    render_graph_record_barrier(graph, cull_command_buffer, cull_pass);
 
-        {
-            // Open the vertex shader module file and read the bytes.
+                    // The parameters are written into the frame's transient arena, the GPU sees host
+                    // writes made before the submission.
 
-            FILE *vertex_shader_module_file = fopen("vertex.spv", "rb");
+                    VkDeviceSize cull_parameters_offset = 0;
+                    void *cull_parameters_data = NULL;
 
-            if (vertex_shader_module_file == NULL) {
-                fprintf(stderr, "error (io): Failed to open vertex shader file.\n");
-                return 1;
-            }
+                    if (!linear_arena_allocate(&frame->transient_arena, sizeof(CullParameters), uniform_buffer_alignment, &cull_parameters_offset, &cull_parameters_data)) {
+                        fprintf(stderr, "error (io): Failed to allocate the culling parameters from the transient arena.\n");
+                        return 1;
+                    }
 
-            fseek(vertex_shader_module_file, 0L, SEEK_END);
-            const uint64_t vertex_shader_module_file_size = ftell(vertex_shader_module_file);
-            fseek(vertex_shader_module_file, 0L, SEEK_SET);
-            char *vertex_shader_module_file_buffer = malloc(vertex_shader_module_file_size * (sizeof *vertex_shader_module_file_buffer));
-            fread(vertex_shader_module_file_buffer, vertex_shader_module_file_size, 1, vertex_shader_module_file);
+                    *(CullParameters *)cull_parameters_data = (CullParameters) {
+                        .aspect_ratio = (float)render_extent.width / (float)render_extent.height,
+                        .squared_bounding_radius = mesh.squared_bounding_radius,
+                        .instance_count = instance_count,
+                        .group_size = DRAW_GROUP_SIZE,
+                        .index_count = mesh.index_count,
+                        .use_first_instance = multi_draw_indirect,
+                    };
 
-            // Create the vertex shader module.
+                    const uint32_t cull_parameters_dynamic_offset = (uint32_t)cull_parameters_offset;
 
-            const VkShaderModuleCreateInfo vertex_shader_module_create_info = {
-                .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-                .pNext = NULL,
-                .flags = 0,
-                .codeSize = vertex_shader_module_file_size,
-                .pCode = (uint32_t *)vertex_shader_module_file_buffer,
-            };
+                    CullPushConstants cull_push_constants = {
+                        .compact_draws = 0,
+                    };
 
-            const VkResult result = vkCreateShaderModule(device, &vertex_shader_module_create_info, NULL, &vertex_shader_module);
+                    vkCmdBindPipeline(cull_command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[PIPELINE_KIND_CULL]);
+                    vkCmdBindDescriptorSets(cull_command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline_layout, 0, 1, &frame->cull_descriptor_set, 1, &cull_parameters_dynamic_offset);
+                    vkCmdPushConstants(cull_command_buffer, cull_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof cull_push_constants, &cull_push_constants);
+                    vkCmdDispatch(cull_command_buffer, (instance_count + 63) / 64, 1, 1);
 
-            if (result != VK_SUCCESS) {
-                fprintf(stderr, "error (vulkan): Failed to create vertex shader module.\n");
-                fclose(vertex_shader_module_file);
-                free(vertex_shader_module_file_buffer);
-                return 1;
-            }
+                    // With indirect draw counts, the draws of the groups with visible instances are
+                    // then compacted, one invocation per group.
 
-            // Clean up.
+                    if (draw_indirect_count) {
+                        cull_push_constants.compact_draws = 1;
 
-            fclose(vertex_shader_module_file);
-            free(vertex_shader_module_file_buffer);
-        }
+                        render_graph_record_barrier(graph, cull_command_buffer, cull_compact_pass);
+                        vkCmdPushConstants(cull_command_buffer, cull_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof cull_push_constants, &cull_push_constants);
+                        vkCmdDispatch(cull_command_buffer, (draw_count + 63) / 64, 1, 1);
+                    }
 
-        // Create the fragment shader module
+                    if (async_compute) {
+                        // The instances are read once all submitted uploads are done, waiting for
+                        // a value that has already been reached costs nothing.
 
-        {
-            // Open the fragment shader module file and read the bytes.
+                        const VkPipelineStageFlags upload_wait_compute_stage_mask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+                        const uint32_t compute_wait_semaphore_count = upload_wait_semaphore_value > 0 ? 1 : 0;
 
-            FILE *fragment_shader_module_file = fopen("fragment.spv", "rb");
+                        result = vkEndCommandBuffer(cull_command_buffer);
 
-            if (fragment_shader_module_file == NULL) {
-                fprintf(stderr, "error (io): Failed to open fragment shader file.\n");
-                return 1;
-            }
+                        if (result == VK_SUCCESS) {
+                            result = compute_queue_submit(&compute, cull_command_buffer, compute_wait_semaphore_count, &upload_context.semaphore, &upload_wait_semaphore_value, &upload_wait_compute_stage_mask, &compute_wait_semaphore_value);
+                        }
 
-            fseek(fragment_shader_module_file, 0L, SEEK_END);
-            const uint64_t fragment_shader_module_file_size = ftell(fragment_shader_module_file);
-            fseek(fragment_shader_module_file, 0L, SEEK_SET);
-            char *fragment_shader_module_file_buffer = malloc(fragment_shader_module_file_size * (sizeof *fragment_shader_module_file_buffer));
-            fread(fragment_shader_module_file_buffer, fragment_shader_module_file_size, 1, fragment_shader_module_file);
+                        if (result != VK_SUCCESS) {
+                            fprintf(stderr, "error (vulkan): Failed to submit the culling to the compute queue.\n");
+                            return 1;
+                        }
+                    }
+                }
 
-            // Create the fragment shader module.
+                render_graph_record_barrier(graph, command_buffer, scene_pass);
 
-            const VkShaderModuleCreateInfo fragment_shader_module_create_info = {
-                .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-                .pNext = NULL,
-                .flags = 0,
-                .codeSize = fragment_shader_module_file_size,
-                .pCode = (uint32_t *)fragment_shader_module_file_buffer,
-            };
+                if (frame->timestamp_query_pool != VK_NULL_HANDLE) {
+                    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, frame->timestamp_query_pool, TIMESTAMP_RENDER_PASS_BEGIN);
+                }
 
-            const VkResult result = vkCreateShaderModule(device, &fragment_shader_module_create_info, NULL, &fragment_shader_module);
+                // With multi-draw indirect, the draws of a subpass are a single command recorded
+                // right into the frame command buffer. Otherwise they are recorded into secondary
+                // command buffers on the recording threads.
+
+                const VkSubpassContents subpass_contents = multi_draw_indirect ? VK_SUBPASS_CONTENTS_INLINE : VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS;
+
+                vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, subpass_contents);
+
+                const VkViewport viewport = {
+                    .x = 0.0f,
+                    .y = 0.0f,
+                    .width = (float)render_extent.width,
+                    .height = (float)render_extent.height,
+                    .minDepth = 0.0f,
+                    .maxDepth = 1.0f,
+                };
+
+                const VkRect2D scissor = {
+                    .offset = {
+                        .x = 0,
+                        .y = 0,
+                    },
+                    .extent = render_extent,
+                };
+
+                // Animate the triangles, keeping their shape independent of the aspect ratio. The
+                // culling shader writes at most one indirect draw per group of instances. With a
+                // depth pre-pass, the same draws are recorded for both subpasses.
+
+                DrawRecording draw_recording = {
+                    .pipeline = VK_NULL_HANDLE,
+                    .pipeline_layout = graphics_pipeline_layout,
+                    .descriptor_set = bindless_heap.descriptor_set,
+                    .mesh = &mesh,
+                    .instance_buffer = frame->visible_instance_buffer,
+                    .draw_command_buffer = frame->draw_command_buffer,
+                    .group_size = DRAW_GROUP_SIZE,
+                    .multi_draw_indirect = multi_draw_indirect,
+                    .draw_indirect_count = draw_indirect_count,
+                    .viewport = viewport,
+                    .scissor = scissor,
+                    .push_constants = {
+                        .time = (float)((frame_begin_time - start_time) / 1000.0),
+                        .aspect_ratio = (float)render_extent.width / (float)render_extent.height,
+                        .material_buffer_index = material_buffer_index,
+                        .material_index = 0,
+                    },
+                    .draw_count = scene_ready ? draw_count : 0,
+                };
+
+                // Waking a thread costs about as much as recording a few hundred draws one by one,
+                // so every slice gets at least MIN_DRAWS_PER_SLICE draws. There is always a slice,
+                // even an empty one, since the subpass only takes secondary command buffers.
+
+                uint32_t slice_count = (draw_recording.draw_count + MIN_DRAWS_PER_SLICE - 1) / MIN_DRAWS_PER_SLICE;
+
+                if (slice_count > record_thread_count) {
+                    slice_count = record_thread_count;
+                }
 
-            if (result != VK_SUCCESS) {
-                fprintf(stderr, "error (vulkan): Failed to create fragment shader module.\n");
-                fclose(fragment_shader_module_file);
-                free(fragment_shader_module_file_buffer);
-                return 1;
-            }
+                if (slice_count < 1) {
+                    slice_count = 1;
+                }
 
-            // Clean up.
+                RecordJob record_job = {
+                    .device = device,
+                    .render_pass = graphics_render_pass,
+                    .subpass = 0,
+                    .framebuffer = frame->scene_framebuffer,
+                    .recording = draw_recording,
+                    .slice_count = slice_count,
+                    .command_buffer_pools = frame->secondary_command_buffer_pools,
+                    .command_buffers = secondary_command_buffers,
+                    .results = secondary_command_buffer_results,
+                };
+
+                const uint32_t subpass_count = depth_mode == DEPTH_MODE_PREPASS ? 2 : 1;
+
+                for (uint32_t subpass = 0; subpass < subpass_count; subpass++) {
+                    if (subpass > 0) {
+                        vkCmdNextSubpass(command_buffer, subpass_contents);
+                    }
 
-            fclose(fragment_shader_module_file);
-            free(fragment_shader_module_file_buffer);
-        }
-    }
+                    draw_recording.pipeline = subpass + 1 < subpass_count ? pipelines[PIPELINE_KIND_DEPTH_PREPASS] : pipelines[PIPELINE_KIND_GRAPHICS];
 
-    // Create the graphics pipeline.
+                    if (multi_draw_indirect) {
+                        record_draws(command_buffer, &draw_recording, 0, draw_recording.draw_count);
+                        continue;
+                    }
 
-    VkPipelineLayout graphics_pipeline_layout = VK_NULL_HANDLE;
-    VkPipeline graphics_pipeline = VK_NULL_HANDLE;
+                    record_job.subpass = subpass;
+                    record_job.recording = draw_recording;
+                    record_worker_pool_run(&record_worker_pool, &record_job);
 
-    {
-        // Create the pipeline layout.
+                    for (uint32_t i = 0; i < slice_count; i++) {
+                        if (secondary_command_buffer_results[i] != VK_SUCCESS) {
+                            fprintf(stderr, "error (vulkan): Failed to record a secondary command buffer.\n");
+                            return 1;
+                        }
+                    }
 
-        {
-            const VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
-                .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-                .pNext = NULL,
-                .flags = 0,
-                .setLayoutCount = 0,
-                .pSetLayouts = NULL,
-                .pushConstantRangeCount = 0,
-                .pPushConstantRanges = NULL,
-            };
+                    vkCmdExecuteCommands(command_buffer, slice_count, secondary_command_buffers);
+                }
 
-            const VkResult result = vkCreatePipelineLayout(device, &pipeline_layout_create_info, NULL, &graphics_pipeline_layout);
+                vkCmdEndRenderPass(command_buffer);
 
-            if (result != VK_SUCCESS) {
-                fprintf(stderr, "error (vulkan): Failed to crete a graphics pipeline layout.");
-                return 1;
-            }
-        }
+                if (frame->timestamp_query_pool != VK_NULL_HANDLE) {
+                    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->timestamp_query_pool, TIMESTAMP_RENDER_PASS_END);
+                }
 
-        // Configure the fixed function stages.
+                // Run the post-processing passes over the rendered part of the scene. Until the scene
+                // is ready the passes are skipped, but their timestamps are still written, so the
+                // query results are always complete.
 
-        const VkPipelineVertexInputStateCreateInfo vertex_input_state_create_info = {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-            .pNext = NULL,
-            .flags = 0,
-            .vertexBindingDescriptionCount = 0,
-            .pVertexBindingDescriptions = NULL,
-            .vertexAttributeDescriptionCount = 0,
-            .pVertexAttributeDescriptions = NULL,
-        };
+                if (post_pass_count > 0) {
+                    const uint32_t group_count_x = (render_extent.width + post_workgroup_size[0] - 1) / post_workgroup_size[0];
+                    const uint32_t group_count_y = (render_extent.height + post_workgroup_size[1] - 1) / post_workgroup_size[1];
 
-        const VkPipelineInputAssemblyStateCreateInfo input_assembly_state_create_info = {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-            .pNext = NULL,
-            .flags = 0,
-            .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
-            .primitiveRestartEnable = VK_FALSE,
-        };
+                    for (uint32_t i = 0; i < post_pass_count; i++) {
+                        if (scene_ready) {
+                            const PostPushConstants post_push_constants = {
+                                .extent = { render_extent.width, render_extent.height },
+                                .strength = post_passes[i].strength,
+                                .threshold = POST_BLOOM_THRESHOLD,
+                            };
 
-        const VkViewport viewport = {
-            .x = 0.0f,
-            .y = 0.0f,
-            .width = (float)image_extent.width,
-            .height = (float)image_extent.height,
-            .minDepth = 0.0f,
-            .maxDepth = 1.0f,
-        };
+                            vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, post_pipeline_layout, 0, 1, &frame->post_descriptor_sets[i % 2], 0, NULL);
+                            vkCmdPushConstants(command_buffer, post_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof post_push_constants, &post_push_constants);
+                        }
 
-        const VkRect2D scissor = {
-            .offset = {
-                .x = 0,
-                .y = 0,
-            },
-            .extent = image_extent,
-        };
+                        // Bloom first filters the bright parts into the bloom image, one invocation
+                        // per bloom texel, and then adds them back onto the scene.
 
-        const VkPipelineViewportStateCreateInfo viewport_state_create_info = {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-            .pNext = NULL,
-            .flags = 0,
-            .viewportCount = 1,
-            .pViewports = &viewport,
-            .scissorCount = 1,
-            .pScissors = &scissor,
-        };
+                        if (post_passes[i].pass == POST_PASS_BLOOM) {
+                            render_graph_record_barrier(graph, command_buffer, post_graph_passes[i] - 1);
 
-        const VkPipelineRasterizationStateCreateInfo rasterization_state_create_info = {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-            .pNext = NULL,
-            .flags = 0,
-            .depthClampEnable = VK_FALSE,
-            .rasterizerDiscardEnable = VK_FALSE,
-            .polygonMode = VK_POLYGON_MODE_FILL,
-            .cullMode = VK_CULL_MODE_BACK_BIT,
-            .frontFace = VK_FRONT_FACE_CLOCKWISE,
-            .depthBiasEnable = VK_FALSE,
-            .depthBiasConstantFactor = 0.0f,
-            .depthBiasClamp = 0.0f,
-            .depthBiasSlopeFactor = 0.0f,
-            .lineWidth = 1.0f,
-        };
+                            if (scene_ready) {
+                                const uint32_t bloom_width = (render_extent.width + 1) / 2;
+                                const uint32_t bloom_height = (render_extent.height + 1) / 2;
 
-        const VkPipelineMultisampleStateCreateInfo multisample_state_create_info = {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-            .pNext = NULL,
-            .flags = 0,
-            .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
-            .sampleShadingEnable = VK_FALSE,
-            .minSampleShading = 1.0f,
-            .pSampleMask = NULL,
-            .alphaToCoverageEnable = VK_FALSE,
-            .alphaToOneEnable = VK_FALSE,
-        };
+                                vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[PIPELINE_KIND_BLOOM_DOWNSAMPLE]);
+                                vkCmdDispatch(command_buffer, (bloom_width + post_workgroup_size[0] - 1) / post_workgroup_size[0], (bloom_height + post_workgroup_size[1] - 1) / post_workgroup_size[1], 1);
+                            }
+                        }
 
-        const VkPipelineColorBlendAttachmentState color_blend_attachment_state = {
-            .blendEnable = VK_TRUE,
-            .srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
-            .dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
-            .colorBlendOp = VK_BLEND_OP_ADD,
-            .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
-            .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
-            .alphaBlendOp = VK_BLEND_OP_ADD,
-            .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
-        };
+                        render_graph_record_barrier(graph, command_buffer, post_graph_passes[i]);
 
-        const VkPipelineColorBlendStateCreateInfo color_blend_state_create_info = {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-            .pNext = NULL,
-            .flags = 0,
-            .logicOpEnable = VK_FALSE,
-            .logicOp = VK_LOGIC_OP_COPY,
-            .attachmentCount = 1,
-            .pAttachments = &color_blend_attachment_state,
-            .blendConstants[0] = 0.0f,
-            .blendConstants[1] = 0.0f,
-            .blendConstants[2] = 0.0f,
-            .blendConstants[3] = 0.0f,
-        };
+                        if (scene_ready) {
+                            vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[post_pass_pipeline_kinds[post_passes[i].pass]]);
+                            vkCmdDispatch(command_buffer, group_count_x, group_count_y, 1);
+                        }
 
-        // Configure the shader stages.
+                        if (frame->timestamp_query_pool != VK_NULL_HANDLE) {
+                            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->timestamp_query_pool, TIMESTAMP_COUNT + i);
+                        }
+                    }
+                }
 
-        const VkPipelineShaderStageCreateInfo vertex_shader_stage_create_info = {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-            .pNext = NULL,
-            .flags = 0,
-            .stage = VK_SHADER_STAGE_VERTEX_BIT,
-            .module = vertex_shader_module,
-            .pName = "main",
-            .pSpecializationInfo = NULL,
-        };
+                // Scale the scene onto the output image.
+
+                render_graph_record_barrier(graph, command_buffer, blit_pass);
+
+                const VkImageBlit image_blit = {
+                    .srcSubresource = {
+                        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                        .mipLevel = 0,
+                        .baseArrayLayer = 0,
+                        .layerCount = 1,
+                    },
+                    .srcOffsets = {
+                        { 0, 0, 0 },
+                        { (int32_t)render_extent.width, (int32_t)render_extent.height, 1 },
+                    },
+                    .dstSubresource = {
+                        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                        .mipLevel = 0,
+                        .baseArrayLayer = 0,
+                        .layerCount = 1,
+                    },
+                    .dstOffsets = {
+                        { 0, 0, 0 },
+                        { (int32_t)image_extent.width, (int32_t)image_extent.height, 1 },
+                    },
+                };
+
+                vkCmdBlitImage(command_buffer, graph->resources[blit_source_image].image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, images[image_index], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &image_blit, upscale_filter);
+                render_graph_record_barrier(graph, command_buffer, present_pass);
+
+                if (frame->timestamp_query_pool != VK_NULL_HANDLE) {
+                    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->timestamp_query_pool, TIMESTAMP_UPSCALE_END);
+                    frame->timestamps_written = true;
+                }
 
-        const VkPipelineShaderStageCreateInfo fragment_shader_stage_create_info = {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-            .pNext = NULL,
-            .flags = 0,
-            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-            .module = fragment_shader_module,
-            .pName = "main",
-            .pSpecializationInfo = NULL,
-        };
+                result = vkEndCommandBuffer(command_buffer);
 
-        VkPipelineShaderStageCreateInfo shader_stage_create_infos[] = {vertex_shader_stage_create_info, fragment_shader_stage_create_info};
+                if (result != VK_SUCCESS) {
+                    fprintf(stderr, "error (vulkan): Failed to finish command buffer recording.\n");
+                    return 1;
+                }
+            }
 
-        // Create the graphics pipeline.
+            metric_add_sample(&metric_histories[METRIC_CPU_RECORD], time_now_ms() - phase_begin_time);
 
-        const VkGraphicsPipelineCreateInfo graphics_pipeline_create_info = {
-            .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-            .pNext = NULL,
-            .flags = 0,
-            .stageCount = 2,
-            .pStages = shader_stage_create_infos,
-            .pVertexInputState = &vertex_input_state_create_info,
-            .pInputAssemblyState = &input_assembly_state_create_info,
-            .pTessellationState = NULL,
-            .pViewportState = &viewport_state_create_info,
-            .pRasterizationState = &rasterization_state_create_info,
-            .pMultisampleState = &multisample_state_create_info,
-            .pDepthStencilState = NULL,
-            .pColorBlendState = &color_blend_state_create_info,
-            .pDynamicState = NULL,
-            .layout = graphics_pipeline_layout,
-            .renderPass = graphics_render_pass,
-            .subpass = 0,
-            .basePipelineHandle = VK_NULL_HANDLE,
-            .basePipelineIndex = -1,
-        };
+            // Submit the command buffer.
 
-        const VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, NULL, &graphics_pipeline);
+            phase_begin_time = time_now_ms();
 
-        if (result != VK_SUCCESS) {
-            fprintf(stderr, "error (vulkan): Failed to create the graphics pipeline.\n");
-            return 1;
-        }
+            // Only the blit touches the output image, the scene can be rendered before the image
+            // is acquired. The uploads and the async culling are waited on by the stages that use
+            // them. The values of the binary semaphores are ignored.
 
-        // Clean up.
+            VkSemaphore wait_semaphores[3];
+            VkPipelineStageFlags wait_stages[3];
+            uint64_t wait_semaphore_values[3];
+            uint32_t wait_semaphore_count = 0;
 
-        vkDestroyShaderModule(device, fragment_shader_module, NULL);
-        vkDestroyShaderModule(device, vertex_shader_module, NULL);
-    }
+            if (swapchain != VK_NULL_HANDLE) {
+                wait_semaphores[wait_semaphore_count] = frame->image_available_semaphore;
+                wait_stages[wait_semaphore_count] = VK_PIPELINE_STAGE_TRANSFER_BIT;
+                wait_semaphore_values[wait_semaphore_count] = 0;
+                wait_semaphore_count++;
+            }
 
-    // Create the framebuffers.
+            if (upload_wait_stage_mask != 0) {
+                wait_semaphores[wait_semaphore_count] = upload_context.semaphore;
+                wait_stages[wait_semaphore_count] = upload_wait_stage_mask;
+                wait_semaphore_values[wait_semaphore_count] = upload_wait_semaphore_value;
+                wait_semaphore_count++;
+            }
 
-    VkFramebuffer *framebuffers = NULL;
+            if (compute_wait_semaphore_value > 0) {
+                wait_semaphores[wait_semaphore_count] = compute.semaphore;
+                wait_stages[wait_semaphore_count] = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+                wait_semaphore_values[wait_semaphore_count] = compute_wait_semaphore_value;
+                wait_semaphore_count++;
+            }
 
-    {
-        framebuffers = malloc(image_view_count * sizeof *framebuffers);
+            const VkSemaphore signal_semaphores[] = { frame_semaphore, swapchain != VK_NULL_HANDLE ? image_finished_semaphores[image_index] : VK_NULL_HANDLE };
+            const uint64_t signal_semaphore_values[] = { frame_number + 1, 0 };
 
-        for (uint32_t i = 0; i < image_view_count; i++) {
-            VkImageView attachments[] = {
-                image_views[i]
+            const VkTimelineSemaphoreSubmitInfo timeline_semaphore_submit_info = {
+                .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+                .pNext = NULL,
+                .waitSemaphoreValueCount = wait_semaphore_count,
+                .pWaitSemaphoreValues = wait_semaphore_values,
+                .signalSemaphoreValueCount = swapchain != VK_NULL_HANDLE ? 2 : 1,
+                .pSignalSemaphoreValues = signal_semaphore_values,
             };
 
-            const VkFramebufferCreateInfo framebuffer_create_info = {
-                .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-                .pNext = NULL,
-                .flags = 0,
-                .renderPass = graphics_render_pass,
-                .attachmentCount = 1,
-                .pAttachments = attachments,
-                .width = image_extent.width,
-                .height = image_extent.height,
-                .layers = 1,
+            const VkSubmitInfo submit_info = {
+                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                .pNext = &timeline_semaphore_submit_info,
+                .waitSemaphoreCount = wait_semaphore_count,
+                .pWaitSemaphores = wait_semaphores,
+                .pWaitDstStageMask = wait_stages,
+                .commandBufferCount = 1,
+                .pCommandBuffers = &command_buffer,
+                .signalSemaphoreCount = swapchain != VK_NULL_HANDLE ? 2 : 1,
+                .pSignalSemaphores = signal_semaphores,
             };
 
-            const VkResult result = vkCreateFramebuffer(device, &framebuffer_create_info, NULL, &framebuffers[i]);
+            result = vkQueueSubmit(graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
 
             if (result != VK_SUCCESS) {
-                fprintf(stderr, "error (vulkan): Failed to create a framebuffer.");
-                free(framebuffers);
+                fprintf(stderr, "error (vulkan): Failed to submit command buffers to the graphics queue.\n");
                 return 1;
             }
-        }
-    }
 
-    // Create a command pool.
+            metric_add_sample(&metric_histories[METRIC_CPU_SUBMIT], time_now_ms() - phase_begin_time);
 
-    VkCommandPool command_pool = VK_NULL_HANDLE;
+            // Present the image (offscreen images are simply left in place).
 
-    {
-        const VkCommandPoolCreateInfo command_pool_create_info = {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-            .pNext = NULL,
-            .flags = 0,
-            .queueFamilyIndex = graphics_queue_family_index,
-        };
+            phase_begin_time = time_now_ms();
 
-        const VkResult result = vkCreateCommandPool(device, &command_pool_create_info, NULL,  &command_pool);
+            if (swapchain != VK_NULL_HANDLE) {
+                const VkPresentInfoKHR present_info = {
+                    .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+                    .pNext = NULL,
+                    .waitSemaphoreCount = 1,
+                    .pWaitSemaphores = &image_finished_semaphores[image_index],
+                    .swapchainCount = 1,
+                    .pSwapchains = &swapchain,
+                    .pImageIndices = &image_index,
+                    .pResults = NULL,
+                };
 
-        if (result != VK_SUCCESS) {
-            fprintf(stderr, "error (vulkan): Failed to create the command pool.\n");
-            return 1;
-        }
-    }
+                result = vkQueuePresentKHR(graphics_queue, &present_info);
 
-    // Allocate and record the command buffers.
+                if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+                    swapchain_outdated = true;
+                } else if (result != VK_SUCCESS) {
+                    fprintf(stderr, "error (vulkan): Failed to present an image.\n");
+                    return 1;
+                }
+            }
 
-    VkCommandBuffer *command_buffers = NULL;
+            metric_add_sample(&metric_histories[METRIC_CPU_PRESENT], time_now_ms() - phase_begin_time);
+        }
 
-    {
-        // Allocate the command buffers
+        const double frame_end_time = time_now_ms();
+        metric_add_sample(&metric_histories[METRIC_CPU_FRAME], frame_end_time - frame_begin_time);
 
-        {
-            command_buffers = malloc(image_view_count * sizeof *command_buffers);
+        // Print the rolling percentiles.
 
-            const VkCommandBufferAllocateInfo command_buffer_allocate_info = {
-                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-                .pNext = NULL,
-                .commandPool = command_pool,
-                .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-                .commandBufferCount = image_view_count,
-            };
+        if (stats_interval > 0.0 && frame_end_time - last_stats_print_time >= stats_interval * 1000.0) {
+            printf("frame %llu (scale %.2f):", (unsigned long long)frame_number, resolution_scale);
 
-            const VkResult result = vkAllocateCommandBuffers(device, &command_buffer_allocate_info, command_buffers);
+            for (uint32_t i = 0; i < METRIC_COUNT; i++) {
+                const MetricSummary summary = metric_summarize(&metric_histories[i]);
 
-            if (result != VK_SUCCESS || command_buffers == NULL) {
-                fprintf(stderr, "error (vulkan): Failed to allocate the command buffers.\n");
-                free(command_buffers);
-                return 1;
+                if (summary.sample_count > 0) {
+                    printf(" %s %.3f/%.3f/%.3f", metric_names[i], summary.p50, summary.p95, summary.p99);
+                }
             }
-        }
 
-        // Record the command buffers for drawing.
-
-        {
-            const VkCommandBufferBeginInfo command_buffer_begin_info = {
-                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-                .pNext = NULL,
-                .flags = 0,
-                .pInheritanceInfo = VK_NULL_HANDLE,
-            };
+            printf(" (ms, p50/p95/p99)\n");
 
-            for (uint32_t i = 0; i < image_view_count; i++) {
+            const MemoryStats memory_stats = memory_allocator_stats(&memory_allocator);
+            double internal_fragmentation, external_fragmentation;
+            memory_stats_fragmentation(&memory_stats, &internal_fragmentation, &external_fragmentation);
 
-                // Set up.
+            printf("memory: %u blocks (%u dedicated), %u allocations, %.1f/%.1f MiB used, fragmentation %.1f%% internal/%.1f%% external\n",
+                memory_stats.block_count, memory_stats.dedicated_block_count, memory_stats.allocation_count, (double)memory_stats.used_size / 1048576.0,
+                (double)memory_stats.reserved_size / 1048576.0, internal_fragmentation * 100.0, external_fragmentation * 100.0);
 
-                {
-                    const VkResult result = vkBeginCommandBuffer(command_buffers[i], &command_buffer_begin_info);
+            last_stats_print_time = frame_end_time;
+        }
 
-                    if (result != VK_SUCCESS) {
-                        fprintf(stderr, "error (vulkan): Failed to start command buffer recording.\n");
-                        return 1;
-                    }
+        frame_number++;
+    }
 
-                    const VkClearValue clear_value = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+    if (enable_shader_reload) {
+        shader_watcher_destroy(&shader_watcher);
+    }
 
-                    const VkRenderPassBeginInfo render_pass_begin_info = {
-                        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-                        .pNext = NULL,
-                        .renderPass = graphics_render_pass,
-                        .framebuffer = framebuffers[i],
-                        .renderArea = {
-                            .offset = {
-                                .x = 0,
-                                .y = 0,
-                            },
-                            .extent = image_extent,
-                        },
-                        .clearValueCount = 1,
-                        .pClearValues = &clear_value,
-                    };
+    vkDeviceWaitIdle(device);
+    destroy_retired_objects(&memory_allocator, &retire_queue, UINT64_MAX);
+    free(retire_queue.objects);
 
-                    vkCmdBeginRenderPass(command_buffers[i], &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-                }
+    record_worker_pool_stop(&record_worker_pool);
+    free(secondary_command_buffers);
+    free(secondary_command_buffer_results);
 
-                // Record draw commands.
+    // Export the frame timings.
 
-                {
-                    vkCmdBindPipeline(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline);
-                    vkCmdDraw(command_buffers[i], 3, 1, 0, 0);
-                }
+    if (stats_path != NULL && stats_path[0] != '\0') {
+        FILE *stats_file = fopen(stats_path, "w");
 
-                // Finish recording.
+        if (stats_file == NULL) {
+            fprintf(stderr, "warning (io): Failed to open the stats file (path: \"%s\").\n", stats_path);
+        } else {
+            const size_t stats_path_length = strlen(stats_path);
+            const bool json = stats_path_length >= 5 && strcmp(stats_path + stats_path_length - 5, ".json") == 0;
 
-                {
-                    vkCmdEndRenderPass(command_buffers[i]);
+            if (json) {
+                fprintf(stats_file, "{\n    \"frames\": %llu,\n    \"window_size\": %u,\n    \"metrics\": {", (unsigned long long)frame_number, METRIC_WINDOW_SIZE);
+            } else {
+                fprintf(stats_file, "metric,total_samples,window_samples,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n");
+            }
 
-                    const VkResult result = vkEndCommandBuffer(command_buffers[i]);
+            for (uint32_t i = 0; i < METRIC_COUNT; i++) {
+                const MetricSummary summary = metric_summarize(&metric_histories[i]);
+                const unsigned long long total_sample_count = (unsigned long long)metric_histories[i].total_sample_count;
 
-                    if (result != VK_SUCCESS) {
-                        fprintf(stderr, "error (vulkan): Failed to finish command buffer recording.\n");
-                        return 1;
-                    }
+                if (json) {
+                    fprintf(stats_file, "%s\n        \"%s\": { \"total_samples\": %llu, \"window_samples\": %u, \"mean_ms\": %.6f, \"p50_ms\": %.6f, \"p95_ms\": %.6f, \"p99_ms\": %.6f, \"max_ms\": %.6f }",
+                        i == 0 ? "" : ",", metric_names[i], total_sample_count, summary.sample_count, summary.mean, summary.p50, summary.p95, summary.p99, summary.max);
+                } else {
+                    fprintf(stats_file, "%s,%llu,%u,%.6f,%.6f,%.6f,%.6f,%.6f\n",
+                        metric_names[i], total_sample_count, summary.sample_count, summary.mean, summary.p50, summary.p95, summary.p99, summary.max);
                 }
             }
-        }
-    }
-
-    // Create semaphores and fences for synchronization.
 
-    VkSemaphore *image_available_semaphores = NULL;
-    VkSemaphore *image_finished_semaphores = NULL;
-    VkFence *in_flight_fences = NULL;
-    VkFence *in_flight_image_fences = NULL;
-
-    {
-        image_available_semaphores = malloc(MAX_FRAMES_IN_FLIGHT * sizeof *image_available_semaphores);
-        image_finished_semaphores = malloc(MAX_FRAMES_IN_FLIGHT * sizeof *image_finished_semaphores);
-        in_flight_fences = malloc(MAX_FRAMES_IN_FLIGHT * sizeof *in_flight_fences);
-        in_flight_image_fences = malloc(image_view_count * sizeof *in_flight_image_fences);
+            // The memory usage is a snapshot at shutdown, it does not fit the CSV rows of metrics.
 
-        const VkSemaphoreCreateInfo semaphore_create_info = {
-            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-            .pNext = NULL,
-            .flags = 0,
-        };
+            if (json) {
+                const MemoryStats memory_stats = memory_allocator_stats(&memory_allocator);
+                double internal_fragmentation, external_fragmentation;
+                memory_stats_fragmentation(&memory_stats, &internal_fragmentation, &external_fragmentation);
 
-        const VkFenceCreateInfo fence_create_info = {
-            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-            .pNext = NULL,
-            .flags = VK_FENCE_CREATE_SIGNALED_BIT,
-        };
+                VkDeviceSize transient_peak_size = 0;
 
-        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            const VkResult result = vkCreateSemaphore(device, &semaphore_create_info, NULL, &image_available_semaphores[i])
-                & vkCreateSemaphore(device, &semaphore_create_info, NULL, &image_finished_semaphores[i])
-                & vkCreateFence(device, &fence_create_info, NULL, &in_flight_fences[i]);
+                for (uint32_t i = 0; i < frames_in_flight; i++) {
+                    if (frames[i].transient_arena.peak_head > transient_peak_size) {
+                        transient_peak_size = frames[i].transient_arena.peak_head;
+                    }
+                }
 
-            if (result != VK_SUCCESS) {
-                fprintf(stderr, "error (vulkan): Failed to create synchronisation objects.\n");
-                return 1;
+                fprintf(stats_file, "\n    },\n    \"memory\": { \"blocks\": %u, \"dedicated_blocks\": %u, \"allocations\": %u, \"reserved_bytes\": %llu, \"used_bytes\": %llu, \"requested_bytes\": %llu, "
+                    "\"largest_free_bytes\": %llu, \"internal_fragmentation\": %.6f, \"external_fragmentation\": %.6f, \"transient_peak_bytes\": %llu }\n}\n",
+                    memory_stats.block_count, memory_stats.dedicated_block_count, memory_stats.allocation_count, (unsigned long long)memory_stats.reserved_size,
+                    (unsigned long long)memory_stats.used_size, (unsigned long long)memory_stats.requested_size, (unsigned long long)memory_stats.largest_free_size,
+                    internal_fragmentation, external_fragmentation, (unsigned long long)transient_peak_size);
             }
-        }
 
-        for (uint32_t i = 0; i < image_view_count; i++) {
-            in_flight_image_fences[i] = VK_NULL_HANDLE;
+            if (fclose(stats_file) != 0) {
+                fprintf(stderr, "warning (io): Failed to write the stats file (path: \"%s\").\n", stats_path);
+            }
         }
     }
 
-    // Draw and poll events.
+    // Clean up.
 
-    while (!glfwWindowShouldClose(window)) {
+    {
+        {
+            for (uint32_t i = 0; i < frames_in_flight; i++) {
+                vkDestroyCommandPool(device, frames[i].command_buffer_pool.command_pool, NULL);
+                free(frames[i].command_buffer_pool.command_buffers);
 
-        glfwPollEvents();
+                for (uint32_t j = 0; j < record_thread_count; j++) {
+                    vkDestroyCommandPool(device, frames[i].secondary_command_buffer_pools[j].command_pool, NULL);
+                    free(frames[i].secondary_command_buffer_pools[j].command_buffers);
+                }
 
-        uint32_t current_frame = 0;
+                free(frames[i].secondary_command_buffer_pools);
 
-        {
-            vkWaitForFences(device, 1, &in_flight_fences[current_frame], VK_TRUE, UINT64_MAX);
+                if (async_compute) {
+                    vkDestroyCommandPool(device, frames[i].compute_command_buffer_pool.command_pool, NULL);
+                    free(frames[i].compute_command_buffer_pool.command_buffers);
+                }
 
-            uint32_t image_index = 0;
-            VkResult result = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, image_available_semaphores[current_frame], VK_NULL_HANDLE, &image_index);
+                vkDestroyBuffer(device, frames[i].draw_command_buffer, NULL);
+                memory_free(&memory_allocator, &frames[i].draw_command_buffer_allocation);
+                vkDestroyBuffer(device, frames[i].visible_instance_buffer, NULL);
+                memory_free(&memory_allocator, &frames[i].visible_instance_buffer_allocation);
 
-            if (result != VK_SUCCESS) {
-                fprintf(stderr, "error (vulkan): Failed acquire the next image.\n");
-                return 1;
-            }
+                if (frames[i].timestamp_query_pool != VK_NULL_HANDLE) {
+                    vkDestroyQueryPool(device, frames[i].timestamp_query_pool, NULL);
+                }
 
-            if (in_flight_image_fences[image_index] != VK_NULL_HANDLE) {
-                vkWaitForFences(device, 1, &in_flight_image_fences[image_index], VK_TRUE, UINT64_MAX);
+                vkDestroySemaphore(device, frames[i].image_available_semaphore, NULL);
+
+                vkDestroyFramebuffer(device, frames[i].scene_framebuffer, NULL);
+                render_graph_destroy(&memory_allocator, &frames[i].render_graph);
             }
 
-            in_flight_image_fences[image_index] = in_flight_fences[current_frame];
+            free(frames);
+            vkDestroySemaphore(device, frame_semaphore, NULL);
+            for (uint32_t i = 0; i < image_count && image_finished_semaphores != NULL; i++) {
+                vkDestroySemaphore(device, image_finished_semaphores[i], NULL);
+            }
 
-            const VkSemaphore wait_semaphores[] = {image_available_semaphores[current_frame]};
-            const VkSemaphore signal_semaphores[] = {image_finished_semaphores[current_frame]};
-            const VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+            free(image_frame_values);
+            free(image_finished_semaphores);
+            free(metric_histories);
+        }
 
-            const VkSubmitInfo submit_info = {
-                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-                .pNext = NULL,
-                .waitSemaphoreCount = 1,
-                .pWaitSemaphores = wait_semaphores,
-                .pWaitDstStageMask = wait_stages,
-                .commandBufferCount = 1,
-                .pCommandBuffers = &command_buffers[image_index],
-                .signalSemaphoreCount = 1,
-                .pSignalSemaphores = signal_semaphores,
-            };
+        pipeline_compiler_stop(&pipeline_compiler, device);
+        vkDestroyPipelineLayout(device, post_pipeline_layout, NULL);
+        vkDestroyDescriptorSetLayout(device, post_descriptor_set_layout, NULL);
+        vkDestroyPipelineLayout(device, cull_pipeline_layout, NULL);
+        vkDestroyDescriptorSetLayout(device, cull_descriptor_set_layout, NULL);
+        vkDestroyPipelineLayout(device, graphics_pipeline_layout, NULL);
+        shader_cache_destroy(&shader_cache);
 
-            vkResetFences(device, 1, &in_flight_fences[current_frame]);
+        // Write the pipeline cache back for the next run. The data goes to a temporary file first,
+        // so a crash halfway through never leaves a truncated cache behind.
 
-            result = vkQueueSubmit(graphics_queue, 1, &submit_info, in_flight_fences[current_frame]);
+        {
+            size_t pipeline_cache_data_size = 0;
+            uint8_t *pipeline_cache_data = NULL;
 
-            if (result != VK_SUCCESS) {
-                fprintf(stderr, "error (vulkan): Failed to submit command buffers to the graphics queue.\n");
-                return 1;
+            if (pipeline_cache_path[0] != '\0' && vkGetPipelineCacheData(device, pipeline_cache, &pipeline_cache_data_size, NULL) == VK_SUCCESS && pipeline_cache_data_size > 0) {
+                pipeline_cache_data = malloc(pipeline_cache_data_size);
             }
 
-            const VkPresentInfoKHR present_info = {
-                .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-                .pNext = NULL,
-                .waitSemaphoreCount = 1,
-                .pWaitSemaphores = signal_semaphores,
-                .swapchainCount = 1,
-                .pSwapchains = &swapchain,
-                .pImageIndices = &image_index,
-                .pResults = NULL,
-            };
+            if (pipeline_cache_data != NULL && vkGetPipelineCacheData(device, pipeline_cache, &pipeline_cache_data_size, pipeline_cache_data) == VK_SUCCESS) {
+                const size_t temporary_path_size = strlen(pipeline_cache_path) + sizeof ".tmp";
+                char *temporary_path = malloc(temporary_path_size);
+                FILE *pipeline_cache_file = NULL;
 
-            vkQueuePresentKHR(graphics_queue, &present_info);
-            current_frame = (current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
-        }
-    }
+                if (temporary_path != NULL) {
+                    snprintf(temporary_path, temporary_path_size, "%s.tmp", pipeline_cache_path);
+                    pipeline_cache_file = fopen(temporary_path, "wb");
+                }
 
-    vkDeviceWaitIdle(device);
+                if (pipeline_cache_file != NULL) {
+                    const bool written = fwrite(pipeline_cache_data, pipeline_cache_data_size, 1, pipeline_cache_file) == 1;
 
-    // Clean up.
+                    if (fclose(pipeline_cache_file) != 0 || !written || rename(temporary_path, pipeline_cache_path) != 0) {
+                        fprintf(stderr, "warning (io): Failed to write the pipeline cache (path: \"%s\").\n", pipeline_cache_path);
+                        remove(temporary_path);
+                    }
+                } else {
+                    fprintf(stderr, "warning (io): Failed to open the pipeline cache for writing (path: \"%s\").\n", pipeline_cache_path);
+                }
 
-    {
-        {
-            for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-                vkDestroySemaphore(device, image_finished_semaphores[i], NULL);
-                vkDestroySemaphore(device, image_available_semaphores[i], NULL);
-                vkDestroyFence(device, in_flight_fences[i], NULL);
+                free(temporary_path);
             }
 
-            free(image_finished_semaphores);
-            free(image_available_semaphores);
-            free(in_flight_fences);
-            free(in_flight_image_fences);
+            free(pipeline_cache_data);
         }
 
-        vkDestroyCommandPool(device, command_pool, NULL);
-        free(command_buffers);
+        vkDestroyPipelineCache(device, pipeline_cache, NULL);
+        vkDestroyRenderPass(device, graphics_render_pass, NULL);
 
-        {
-            for (uint32_t i = 0; i < image_view_count; i++) {
-                vkDestroyFramebuffer(device, framebuffers[i], NULL);
-            }
+        free(images);
 
-            free(framebuffers);
+        if (swapchain != VK_NULL_HANDLE) {
+            vkDestroySwapchainKHR(device, swapchain, NULL);
         }
 
-        vkDestroyPipeline(device, graphics_pipeline, NULL);
-        vkDestroyPipelineLayout(device, graphics_pipeline_layout, NULL);
-        vkDestroyRenderPass(device, graphics_render_pass, NULL);
-
         {
-            for (uint32_t i = 0; i < image_view_count; i++) {
-                vkDestroyImageView(device, image_views[i], NULL);
+            for (uint32_t i = 0; i < offscreen_image_count; i++) {
+                vkDestroyImage(device, offscreen_images[i], NULL);
+                memory_free(&memory_allocator, &offscreen_image_allocations[i]);
             }
 
-            free(image_views);
+            free(offscreen_images);
+            free(offscreen_image_allocations);
+        }
+
+        vkDestroyBuffer(device, transient_buffer, NULL);
+        memory_free(&memory_allocator, &transient_buffer_allocation);
+        vkDestroyDescriptorPool(device, post_descriptor_pool, NULL);
+        vkDestroyDescriptorPool(device, cull_descriptor_pool, NULL);
+        vkDestroyBuffer(device, material_buffer, NULL);
+        memory_free(&memory_allocator, &material_buffer_allocation);
+        vkDestroySampler(device, texture_sampler, NULL);
+        vkDestroyImageView(device, texture_image_view, NULL);
+        vkDestroyImage(device, texture_image, NULL);
+        memory_free(&memory_allocator, &texture_image_allocation);
+        vkDestroyBuffer(device, instance_buffer, NULL);
+        memory_free(&memory_allocator, &instance_buffer_allocation);
+        mesh_destroy(&mesh, &memory_allocator);
+        free(instances);
+        upload_context_destroy(&upload_context, &memory_allocator);
+
+        if (async_compute) {
+            compute_queue_destroy(&compute);
         }
 
-        vkDestroySwapchainKHR(device, swapchain, NULL);
+        bindless_heap_destroy(&bindless_heap);
+        memory_allocator_destroy(&memory_allocator);
 
         vkDestroyDevice(device, NULL);
-        vkDestroySurfaceKHR(instance, surface, NULL);
+
+        if (surface != VK_NULL_HANDLE) {
+            vkDestroySurfaceKHR(instance, surface, NULL);
+        }
+
         vkDestroyInstance(instance, NULL);
 
-        glfwDestroyWindow(window);
-        glfwTerminate();
+        if (window != NULL) {
+            glfwDestroyWindow(window);
+            glfwTerminate();
+        }
     }
 }
@@ -0,0 +1,69 @@
+#version 450
+
+// The workgroup size is chosen when the pipeline is created. Every invocation writes one texel of
+// the half resolution bloom image.
+
+layout(local_size_x_id = 0, local_size_y_id = 1) in;
+
+layout(push_constant) uniform PushConstants {
+    uvec2 extent;
+    float strength;
+    float threshold;
+} pushConstants;
+
+layout(binding = 0, rgba16f) uniform readonly image2D sourceImage;
+layout(binding = 2, rgba16f) uniform writeonly image2D bloomImage;
+
+// The source texels the workgroup filters, twice its size plus a border of one texel. Neighbouring
+// invocations share most of their 16 texels, so they are loaded into shared memory once. The tile
+// is sized for the largest workgroup (16x16) and packed to half floats, like the images, which
+// keeps it at 9 KiB.
+
+const uint maxWorkgroupSize = 16u;
+
+shared uvec2 tile[(maxWorkgroupSize * 2u + 2u) * (maxWorkgroupSize * 2u + 2u)];
+
+// Keeps the part of a color above the threshold, without changing its hue.
+
+vec3 brightPart(vec3 color) {
+    float brightness = max(max(color.r, color.g), color.b);
+    return color * (max(brightness - pushConstants.threshold, 0.0) / max(brightness, 0.0001));
+}
+
+void main() {
+    uint tileWidth = gl_WorkGroupSize.x * 2u + 2u;
+    uint tileHeight = gl_WorkGroupSize.y * 2u + 2u;
+    ivec2 lastSourcePosition = ivec2(pushConstants.extent) - 1;
+    ivec2 tileOrigin = ivec2(gl_WorkGroupID.xy * gl_WorkGroupSize.xy * 2u) - 1;
+
+    for (uint i = gl_LocalInvocationIndex; i < tileWidth * tileHeight; i += gl_WorkGroupSize.x * gl_WorkGroupSize.y) {
+        vec4 color = imageLoad(sourceImage, clamp(tileOrigin + ivec2(i % tileWidth, i / tileWidth), ivec2(0), lastSourcePosition));
+        vec3 bright = brightPart(color.rgb);
+        tile[i] = uvec2(packHalf2x16(bright.rg), packHalf2x16(vec2(bright.b, 0.0)));
+    }
+
+    barrier();
+
+    ivec2 position = ivec2(gl_GlobalInvocationID.xy);
+
+    if (any(greaterThan(position, lastSourcePosition / 2))) {
+        return;
+    }
+
+    // Filter the 4x4 source texels around the texel with a tent (weights 1, 3, 3, 1 on both axes),
+    // which avoids the blockiness of a plain 2x2 average.
+
+    const float weights[4] = float[](1.0, 3.0, 3.0, 1.0);
+
+    uint corner = gl_LocalInvocationID.y * 2u * tileWidth + gl_LocalInvocationID.x * 2u;
+    vec3 color = vec3(0.0);
+
+    for (uint y = 0u; y < 4u; y++) {
+        for (uint x = 0u; x < 4u; x++) {
+            uvec2 packedColor = tile[corner + y * tileWidth + x];
+            color += weights[x] * weights[y] * vec3(unpackHalf2x16(packedColor.x), unpackHalf2x16(packedColor.y).x);
+        }
+    }
+
+    imageStore(bloomImage, position, vec4(color / 64.0, 1.0));
+}
@@ -0,0 +1,60 @@
+#version 450
+
+// The workgroup size is chosen when the pipeline is created. Every invocation writes one texel of
+// the full resolution destination image.
+
+layout(local_size_x_id = 0, local_size_y_id = 1) in;
+
+layout(push_constant) uniform PushConstants {
+    uvec2 extent;
+    float strength;
+    float threshold;
+} pushConstants;
+
+layout(binding = 0, rgba16f) uniform readonly image2D sourceImage;
+layout(binding = 1, rgba16f) uniform writeonly image2D destinationImage;
+layout(binding = 2, rgba16f) uniform readonly image2D bloomImage;
+
+// The bloom texels the workgroup interpolates between, half its size plus a border. Every texel is
+// read by up to 16 invocations, so it is loaded into shared memory once. The tile is sized for the
+// largest workgroup (16x16).
+
+const uint maxWorkgroupSize = 16u;
+
+shared vec3 tile[(maxWorkgroupSize / 2u + 3u) * (maxWorkgroupSize / 2u + 3u)];
+
+uint tileIndex(ivec2 tilePosition) {
+    return uint(tilePosition.y) * (gl_WorkGroupSize.x / 2u + 3u) + uint(tilePosition.x);
+}
+
+void main() {
+    uint tileWidth = gl_WorkGroupSize.x / 2u + 3u;
+    uint tileHeight = gl_WorkGroupSize.y / 2u + 3u;
+    ivec2 lastPosition = ivec2(pushConstants.extent) - 1;
+    ivec2 tileOrigin = ivec2(gl_WorkGroupID.xy * gl_WorkGroupSize.xy) / 2 - 1;
+
+    for (uint i = gl_LocalInvocationIndex; i < tileWidth * tileHeight; i += gl_WorkGroupSize.x * gl_WorkGroupSize.y) {
+        tile[i] = imageLoad(bloomImage, clamp(tileOrigin + ivec2(i % tileWidth, i / tileWidth), ivec2(0), lastPosition / 2)).rgb;
+    }
+
+    barrier();
+
+    ivec2 position = ivec2(gl_GlobalInvocationID.xy);
+
+    if (any(greaterThan(position, lastPosition))) {
+        return;
+    }
+
+    // Interpolate bilinearly between the bloom texel covering this texel and its neighbours towards
+    // this texel, which lie to the left (top) for even and to the right (bottom) for odd positions.
+
+    ivec2 nearest = position / 2 - tileOrigin;
+    ivec2 direction = ivec2(position.x % 2, position.y % 2) * 2 - 1;
+
+    vec3 bloom = 0.5625 * tile[tileIndex(nearest)]
+        + 0.1875 * (tile[tileIndex(nearest + ivec2(direction.x, 0))] + tile[tileIndex(nearest + ivec2(0, direction.y))])
+        + 0.0625 * tile[tileIndex(nearest + direction)];
+
+    vec4 color = imageLoad(sourceImage, position);
+    imageStore(destinationImage, position, vec4(color.rgb + pushConstants.strength * bloom, color.a));
+}
@@ -0,0 +1,97 @@
+#version 450
+
+layout(local_size_x = 64) in;
+
+struct Instance {
+    vec2 offset;
+    float scale;
+    float phase;
+    float depth;
+};
+
+struct DrawCommand {
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint firstInstance;
+};
+
+// The parameters of the frame, written into the frame's transient arena.
+
+layout(std140, binding = 3) uniform Parameters {
+    float aspectRatio;
+    float squaredBoundingRadius;
+    uint instanceCount;
+    uint groupSize;
+    uint indexCount;
+    uint useFirstInstance;
+} parameters;
+
+layout(push_constant) uniform PushConstants {
+    uint compactDraws;
+} pushConstants;
+
+layout(std430, binding = 0) readonly buffer Instances {
+    Instance instances[];
+};
+
+layout(std430, binding = 1) writeonly buffer VisibleInstances {
+    Instance visibleInstances[];
+};
+
+// The draw of every group comes first, followed by the draws of the groups with visible
+// instances once they are compacted.
+
+layout(std430, binding = 2) buffer DrawCommands {
+    uint drawCount;
+    DrawCommand drawCommands[];
+};
+
+void main() {
+    uint index = gl_GlobalInvocationID.x;
+
+    // The compaction runs after the culling, with one invocation per group. Groups without visible
+    // instances are left out, so their draws are never issued.
+
+    if (pushConstants.compactDraws != 0) {
+        uint groupCount = (parameters.instanceCount + parameters.groupSize - 1) / parameters.groupSize;
+
+        if (index >= groupCount || drawCommands[index].instanceCount == 0) {
+            return;
+        }
+
+        uint slot = atomicAdd(drawCount, 1);
+        drawCommands[groupCount + slot] = drawCommands[index];
+        return;
+    }
+
+    if (index >= parameters.instanceCount) {
+        return;
+    }
+
+    // Every group of instances is drawn by its own command, which the first instance of the group
+    // fills in. The instance count starts at zero and is only ever incremented.
+
+    uint group = index / parameters.groupSize;
+
+    if (index % parameters.groupSize == 0) {
+        drawCommands[group].indexCount = parameters.indexCount;
+        drawCommands[group].firstIndex = 0;
+        drawCommands[group].vertexOffset = 0;
+        drawCommands[group].firstInstance = parameters.useFirstInstance != 0 ? group * parameters.groupSize : 0;
+    }
+
+    // Keep the instance if its bounding circle overlaps the view, which spans -1 to 1 on both axes
+    // after the x axis is divided by the aspect ratio.
+
+    Instance instance = instances[index];
+    float radius = sqrt(parameters.squaredBoundingRadius) * instance.scale;
+
+    if (abs(instance.offset.x) - radius / parameters.aspectRatio > 1.0 || abs(instance.offset.y) - radius > 1.0) {
+        return;
+    }
+
+    uint slot = atomicAdd(drawCommands[group].instanceCount, 1);
+    visibleInstances[group * parameters.groupSize + slot] = instance;
+}
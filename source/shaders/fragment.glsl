@@ -1,9 +1,31 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+struct Material {
+    vec4 color;
+    uint textureIndex;
+};
+
+layout(push_constant) uniform PushConstants {
+    float time;
+    float aspectRatio;
+    uint materialBufferIndex;
+    uint materialIndex;
+} pushConstants;
+
+layout(std430, set = 0, binding = 0) readonly buffer MaterialBuffer {
+    Material materials[];
+} materialBuffers[];
+
+layout(set = 0, binding = 1) uniform sampler2D textures[];
 
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTextureCoordinates;
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = vec4(fragColor, 1.0);
+    Material material = materialBuffers[pushConstants.materialBufferIndex].materials[pushConstants.materialIndex];
+
+    outColor = vec4(fragColor, 1.0) * material.color * texture(textures[material.textureIndex], fragTextureCoordinates);
 }
@@ -0,0 +1,50 @@
+#version 450
+
+// The workgroup size is chosen when the pipeline is created.
+
+layout(local_size_x_id = 0, local_size_y_id = 1) in;
+
+layout(push_constant) uniform PushConstants {
+    uvec2 extent;
+    float strength;
+    float threshold;
+} pushConstants;
+
+layout(binding = 0, rgba16f) uniform readonly image2D sourceImage;
+layout(binding = 1, rgba16f) uniform writeonly image2D destinationImage;
+
+// The texels of the workgroup with a border of one texel. Every texel is read by up to five
+// invocations, so it is loaded into shared memory once instead. The tile is sized for the largest
+// workgroup (16x16).
+
+const uint maxWorkgroupSize = 16u;
+
+shared vec4 tile[(maxWorkgroupSize + 2u) * (maxWorkgroupSize + 2u)];
+
+void main() {
+    uint tileWidth = gl_WorkGroupSize.x + 2u;
+    uint tileHeight = gl_WorkGroupSize.y + 2u;
+    ivec2 lastPosition = ivec2(pushConstants.extent) - 1;
+    ivec2 tileOrigin = ivec2(gl_WorkGroupID.xy * gl_WorkGroupSize.xy) - 1;
+
+    for (uint i = gl_LocalInvocationIndex; i < tileWidth * tileHeight; i += gl_WorkGroupSize.x * gl_WorkGroupSize.y) {
+        tile[i] = imageLoad(sourceImage, clamp(tileOrigin + ivec2(i % tileWidth, i / tileWidth), ivec2(0), lastPosition));
+    }
+
+    barrier();
+
+    ivec2 position = ivec2(gl_GlobalInvocationID.xy);
+
+    if (any(greaterThan(position, lastPosition))) {
+        return;
+    }
+
+    // Add the difference to the average of the four direct neighbours (an unsharp mask).
+
+    uint center = (gl_LocalInvocationID.y + 1u) * tileWidth + gl_LocalInvocationID.x + 1u;
+    vec4 color = tile[center];
+    vec3 neighbours = tile[center - 1].rgb + tile[center + 1].rgb + tile[center - tileWidth].rgb + tile[center + tileWidth].rgb;
+    vec3 sharpened = color.rgb + pushConstants.strength * (4.0 * color.rgb - neighbours);
+
+    imageStore(destinationImage, position, vec4(max(sharpened, 0.0), color.a));
+}
@@ -0,0 +1,33 @@
+#version 450
+
+// The workgroup size is chosen when the pipeline is created.
+
+layout(local_size_x_id = 0, local_size_y_id = 1) in;
+
+layout(push_constant) uniform PushConstants {
+    uvec2 extent;
+    float strength;
+    float threshold;
+} pushConstants;
+
+layout(binding = 0, rgba16f) uniform readonly image2D sourceImage;
+layout(binding = 1, rgba16f) uniform writeonly image2D destinationImage;
+
+// The ACES filmic curve as fitted by Krzysztof Narkowicz, which maps HDR colors to 0 to 1.
+
+vec3 tonemapAces(vec3 color) {
+    return clamp(color * (2.51 * color + 0.03) / (color * (2.43 * color + 0.59) + 0.14), 0.0, 1.0);
+}
+
+void main() {
+    ivec2 position = ivec2(gl_GlobalInvocationID.xy);
+
+    if (any(greaterThanEqual(uvec2(position), pushConstants.extent))) {
+        return;
+    }
+
+    // The strength is the exposure the colors are scaled by first.
+
+    vec4 color = imageLoad(sourceImage, position);
+    imageStore(destinationImage, position, vec4(tonemapAces(color.rgb * pushConstants.strength), color.a));
+}
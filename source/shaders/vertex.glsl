@@ -1,20 +1,31 @@
 #version 450
 
-layout(location = 0) out vec3 fragColor;
+layout(push_constant) uniform PushConstants {
+    float time;
+    float aspectRatio;
+    uint materialBufferIndex;
+    uint materialIndex;
+} pushConstants;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inInstanceOffset;
+layout(location = 3) in float inInstanceScale;
+layout(location = 4) in float inInstancePhase;
+layout(location = 5) in float inInstanceDepth;
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTextureCoordinates;
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+// The depth pre-pass runs this shader too, its depth has to match the shading pass exactly.
+invariant gl_Position;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
+    float angle = pushConstants.time + inInstancePhase;
+    mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+    vec2 position = rotation * inPosition * inInstanceScale;
+
+    gl_Position = vec4(inInstanceOffset + vec2(position.x / pushConstants.aspectRatio, position.y), inInstanceDepth, 1.0);
+    fragColor = inColor;
+    fragTextureCoordinates = inPosition + 0.5;
 }